@@ -0,0 +1,41 @@
+#ifndef SIMULATED_ARDUINO
+#define SIMULATED_ARDUINO
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+inline unsigned long millis() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// RTC user memory of the ESP8266, accessed in four-byte blocks.
+class EspClass {
+public:
+  bool rtcUserMemoryRead(uint32_t offset, uint32_t* data, size_t size) {
+    if (offset * 4 + size > sizeof(rtc_))
+      return false;
+    memcpy(data, rtc_ + offset * 4, size);
+    return true;
+  }
+
+  bool rtcUserMemoryWrite(uint32_t offset, uint32_t* data, size_t size) {
+    if (offset * 4 + size > sizeof(rtc_))
+      return false;
+    memcpy(rtc_ + offset * 4, data, size);
+    return true;
+  }
+
+private:
+  uint8_t rtc_[512];
+};
+
+extern EspClass ESP;
+
+#endif // SIMULATED_ARDUINO
@@ -0,0 +1,96 @@
+#ifndef SIMULATED_EEPROM
+#define SIMULATED_EEPROM
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+/** This class simulates the ESP8266 EEPROM library on a host machine.
+ *
+ * The EEPROM is a RAM buffer, and commit() counts the flash sectors that the
+ * real library would erase and the bytes it would write.
+ */
+class EEPROMClass {
+public:
+  static constexpr std::size_t SECTOR_SIZE { 4096 };
+
+  struct statistics {
+    unsigned long commits;
+    unsigned long sector_erases;
+    unsigned long bytes_written;
+  };
+
+  void begin(std::size_t size) {
+    size_ = size;
+    memset(data_, 0xff, sizeof(data_));
+    dirty_ = false;
+  }
+
+  std::size_t length() const {
+    return size_;
+  }
+
+  uint8_t read(int address) const {
+    return data_[address];
+  }
+
+  void write(int address, uint8_t value) {
+    data_[address] = value;
+    dirty_ = true;
+  }
+
+  template<class T>
+  T& get(int address, T& value) const {
+    memcpy(&value, data_ + address, sizeof(T));
+    return value;
+  }
+
+  template<class T>
+  const T& put(int address, const T& value) {
+    memcpy(data_ + address, &value, sizeof(T));
+    dirty_ = true;
+    return value;
+  }
+
+  uint8_t* getDataPtr() {
+    dirty_ = true;
+    return data_;
+  }
+
+  const uint8_t* getConstDataPtr() const {
+    return data_;
+  }
+
+  bool commit() {
+    if (size_ == 0)
+      return false;
+    if (!dirty_)
+      return true;
+
+    ++stats_.commits;
+    stats_.sector_erases += (size_ + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    stats_.bytes_written += size_;
+    dirty_ = false;
+    return true;
+  }
+
+  const statistics& stats() const {
+    return stats_;
+  }
+
+  void reset_stats() {
+    stats_ = statistics();
+  }
+
+private:
+  // Aligned like the heap block holding the real library's copy.
+  alignas(std::max_align_t) uint8_t data_[SECTOR_SIZE] {};
+  std::size_t size_ { 0 };
+  bool dirty_ { false };
+  statistics stats_ {};
+};
+
+extern EEPROMClass EEPROM;
+
+#endif // SIMULATED_EEPROM
@@ -0,0 +1,505 @@
+// Host-side benchmark of the persistent containers.
+//
+// Containers run on a simulated EEPROM (see EEPROM.h), RTC memory (see
+// Arduino.h) and SPI flash (see simulator.cpp). Besides timing the
+// operations, the benchmark reports the flash traffic that each usage
+// pattern would cause on an ESP8266: how many commits and sector erases each
+// logical operation costs, and how many bytes it writes to flash.
+
+#include <chrono>
+#include <cstdio>
+
+#include "simulator.h"
+
+#include <cached_persistent_vector.h>
+#include <persistent_blob_queue.h>
+#include <persistent_compressed_queue.h>
+#include <persistent_counters.h>
+#include <persistent_flash_counter.h>
+#include <persistent_flush_scheduler.h>
+#include <persistent_layout.h>
+#include <persistent_log_queue.h>
+#include <persistent_map.h>
+#include <persistent_priority_queue.h>
+#include <persistent_queue.h>
+#include <persistent_transaction.h>
+#include <persistent_vector.h>
+#include <ram_backend.h>
+#include <spsc_persistent_queue.h>
+#include <staged_persistent_queue.h>
+#include <static_persistent_queue.h>
+
+namespace {
+
+struct sample {
+  uint32_t timestamp;
+  int16_t values[6];
+};
+
+constexpr std::size_t EEPROM_SIZE { 4096 };
+constexpr std::size_t QUEUE_CAPACITY { 128 };
+constexpr std::size_t ITERATIONS { 200000 };
+
+typedef persistent_layout<EEPROM_SIZE,
+    persistent_region<persistent_queue<sample>::storage_size(QUEUE_CAPACITY)>,
+    persistent_region<persistent_vector<uint32_t>::storage_size(1)>>
+    traffic_layout;
+
+volatile uint32_t sink;
+
+template<class F>
+double time_per_op(std::size_t ops, F f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / ops;
+}
+
+void print_time_header() {
+  printf("%-44s %10s\n", "operation", "ns/op");
+}
+
+void print_time(const char* name, double ns) {
+  printf("%-44s %10.2f\n", name, ns);
+}
+
+void print_traffic_header() {
+  printf("%-44s %10s %10s %12s\n",
+      "logical operation", "commits", "erases", "bytes");
+}
+
+void print_traffic(const char* name, std::size_t ops) {
+  const EEPROMClass::statistics& eeprom = EEPROM.stats();
+  const spi_flash_statistics& flash = spi_flash_stats();
+  printf("%-44s %10.3f %10.3f %12.1f\n", name,
+      static_cast<double>(eeprom.commits) / ops,
+      static_cast<double>(eeprom.sector_erases + flash.sector_erases) / ops,
+      static_cast<double>(eeprom.bytes_written + flash.bytes_written) / ops);
+}
+
+void reset() {
+  EEPROM.begin(EEPROM_SIZE);
+  spi_flash_reset();
+  EEPROM.reset_stats();
+  spi_flash_stats() = spi_flash_statistics();
+}
+
+sample make_sample(uint32_t i) {
+  sample s {};
+  s.timestamp = i;
+  s.values[0] = static_cast<int16_t>(i);
+  return s;
+}
+
+void bench_queue() {
+  reset();
+  persistent_queue<uint32_t> queue(0, QUEUE_CAPACITY);
+  print_time("queue<uint32_t> push + pop", time_per_op(ITERATIONS, [&] {
+    for (uint32_t i = 0; i < ITERATIONS; ++i) {
+      queue.push(i);
+      sink = queue.front();
+      queue.pop();
+    }
+  }));
+
+  reset();
+  persistent_queue<sample> samples(0, QUEUE_CAPACITY);
+  print_time("queue<sample> push + pop", time_per_op(ITERATIONS, [&] {
+    for (uint32_t i = 0; i < ITERATIONS; ++i) {
+      samples.push(make_sample(i));
+      sink = samples.front().timestamp;
+      samples.pop();
+    }
+  }));
+
+  reset();
+  persistent_queue<sample> ring(0, QUEUE_CAPACITY);
+  print_time("queue<sample> pop + push when full", time_per_op(ITERATIONS, [&] {
+    for (uint32_t i = 0; i < ITERATIONS; ++i) {
+      if (ring.full())
+        ring.pop();
+      ring.push(make_sample(i));
+    }
+  }));
+
+  reset();
+  persistent_queue<sample> overwrite(0, QUEUE_CAPACITY);
+  print_time("queue<sample> push_overwrite", time_per_op(ITERATIONS, [&] {
+    for (uint32_t i = 0; i < ITERATIONS; ++i)
+      overwrite.push_overwrite(make_sample(i));
+  }));
+
+  reset();
+  static_persistent_queue<sample, QUEUE_CAPACITY> fixed(0);
+  print_time("static_queue<sample> push + pop", time_per_op(ITERATIONS, [&] {
+    for (uint32_t i = 0; i < ITERATIONS; ++i) {
+      fixed.push(make_sample(i));
+      sink = fixed.front().timestamp;
+      fixed.pop();
+    }
+  }));
+
+  reset();
+  spsc_persistent_queue<sample, QUEUE_CAPACITY> spsc(0);
+  print_time("spsc_queue<sample> push + pop", time_per_op(ITERATIONS, [&] {
+    for (uint32_t i = 0; i < ITERATIONS; ++i) {
+      spsc.push(make_sample(i));
+      sink = spsc.front().timestamp;
+      spsc.pop();
+    }
+  }));
+
+  reset();
+  persistent_compressed_queue<sample> compressed(0,
+      QUEUE_CAPACITY * sizeof(sample));
+  print_time("compressed_queue<sample> push + pop", time_per_op(ITERATIONS, [&] {
+    for (uint32_t i = 0; i < ITERATIONS; ++i) {
+      compressed.push(make_sample(i));
+      sink = compressed.front().timestamp;
+      compressed.pop();
+    }
+  }));
+
+  reset();
+  persistent_blob_queue<> blobs(0, QUEUE_CAPACITY * sizeof(sample));
+  print_time("blob_queue push + pop (sample-sized)",
+      time_per_op(ITERATIONS, [&] {
+    for (uint32_t i = 0; i < ITERATIONS; ++i) {
+      const sample s = make_sample(i);
+      blobs.push(&s, sizeof(s));
+      sink = blobs.front().size;
+      blobs.pop();
+    }
+  }));
+}
+
+void bench_drain() {
+  const std::size_t rounds = ITERATIONS / QUEUE_CAPACITY;
+  sample buffer[QUEUE_CAPACITY];
+
+  reset();
+  persistent_queue<sample> queue(0, QUEUE_CAPACITY);
+  auto fill = [&] {
+    // Start half-way so that the elements wrap around.
+    queue.pop(queue.size());
+    for (std::size_t i = 0; i < QUEUE_CAPACITY / 2; ++i)
+      queue.push(make_sample(i));
+    queue.pop(QUEUE_CAPACITY / 2);
+    for (std::size_t i = 0; i < QUEUE_CAPACITY; ++i)
+      queue.push(make_sample(i));
+  };
+
+  double ns = 0;
+  for (std::size_t r = 0; r < rounds; ++r) {
+    fill();
+    ns += time_per_op(QUEUE_CAPACITY, [&] {
+      while (!queue.empty()) {
+        sink = queue.front().timestamp;
+        queue.pop();
+      }
+    });
+  }
+  print_time("drain: front + pop", ns / rounds);
+
+  ns = 0;
+  for (std::size_t r = 0; r < rounds; ++r) {
+    fill();
+    ns += time_per_op(QUEUE_CAPACITY, [&] {
+      std::size_t count = queue.read(buffer, QUEUE_CAPACITY);
+      sink = buffer[0].timestamp;
+      queue.pop(count);
+    });
+  }
+  print_time("drain: read + pop(n)", ns / rounds);
+
+  ns = 0;
+  for (std::size_t r = 0; r < rounds; ++r) {
+    fill();
+    ns += time_per_op(QUEUE_CAPACITY, [&] {
+      persistent_queue<sample>::const_span first = queue.first_span();
+      persistent_queue<sample>::const_span second = queue.second_span();
+      sink = first.data[0].timestamp + second.size;
+      queue.pop(first.size + second.size);
+    });
+  }
+  print_time("drain: spans + pop(n)", ns / rounds);
+}
+
+void bench_vector() {
+  reset();
+  persistent_vector<uint32_t> vector(0, QUEUE_CAPACITY);
+  print_time("vector<uint32_t> push_back", time_per_op(ITERATIONS, [&] {
+    for (uint32_t i = 0; i < ITERATIONS; ++i) {
+      if (!vector.push_back(i))
+        vector.clear();
+    }
+  }));
+
+  vector.clear();
+  while (vector.push_back(1)) {}
+  const persistent_vector<uint32_t>& const_vector = vector;
+  print_time("vector<uint32_t> operator[] (read)", time_per_op(ITERATIONS, [&] {
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < ITERATIONS; ++i)
+      sum += const_vector[i % QUEUE_CAPACITY];
+    sink = sum;
+  }));
+
+  print_time("vector<uint32_t> operator[] (write)", time_per_op(ITERATIONS, [&] {
+    for (uint32_t i = 0; i < ITERATIONS; ++i)
+      vector[i % QUEUE_CAPACITY] = i;
+  }));
+
+  typedef ram_backend<EEPROM_SIZE> ram;
+  cached_persistent_vector<uint32_t, 8, ram> cached(0, QUEUE_CAPACITY);
+  while (cached.push_back(1)) {}
+  const auto& const_cached = cached;
+  print_time("cached_vector<uint32_t, 8> operator[] (read)",
+      time_per_op(ITERATIONS, [&] {
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < ITERATIONS; ++i)
+      sum += const_cached[i % 8];
+    sink = sum;
+  }));
+}
+
+void bench_map() {
+  const std::size_t keys = 200;
+
+  typedef persistent_map<uint16_t, uint32_t> map_type;
+
+  reset();
+  map_type map(0, 256);
+  for (uint16_t k = 0; k < keys; ++k)
+    map.insert_or_assign(k * 7, k);
+  print_time("map<uint16_t, uint32_t> find (200 keys)",
+      time_per_op(ITERATIONS, [&] {
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < ITERATIONS; ++i)
+      sum += *map.find((i % keys) * 7);
+    sink = sum;
+  }));
+
+  struct entry {
+    uint16_t key;
+    uint32_t value;
+  };
+  persistent_vector<entry> vector(map_type::storage_size(256), keys);
+  for (uint16_t k = 0; k < keys; ++k)
+    vector.push_back(entry { static_cast<uint16_t>(k * 7), k });
+  const auto& const_vector = vector;
+  print_time("vector<entry> linear search (200 keys)",
+      time_per_op(ITERATIONS, [&] {
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < ITERATIONS; ++i) {
+      const uint16_t key = (i % keys) * 7;
+      for (const entry& e : const_vector) {
+        if (e.key == key) {
+          sum += e.value;
+          break;
+        }
+      }
+    }
+    sink = sum;
+  }));
+
+  // The entries were pushed in key order, so the vector is sorted.
+  struct by_key {
+    bool operator()(const entry& a, const entry& b) const {
+      return a.key < b.key;
+    }
+  };
+  print_time("vector<entry> lower_bound (200 keys)",
+      time_per_op(ITERATIONS, [&] {
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < ITERATIONS; ++i) {
+      const entry key { static_cast<uint16_t>((i % keys) * 7), 0 };
+      sum += const_vector.lower_bound(key, by_key())->value;
+    }
+    sink = sum;
+  }));
+}
+
+void bench_schedule() {
+  const std::size_t jobs = 100;
+
+  // Each tick runs the earliest job and schedules it again.
+  reset();
+  persistent_priority_queue<uint32_t> heap(0, jobs);
+  for (uint32_t j = 0; j < jobs; ++j)
+    heap.push(j * 13 % jobs);
+  print_time("priority_queue<uint32_t> tick (100 jobs)",
+      time_per_op(ITERATIONS, [&] {
+    for (uint32_t i = 0; i < ITERATIONS; ++i) {
+      const uint32_t due = heap.top();
+      heap.pop();
+      heap.push(due + jobs);
+    }
+    sink = heap.top();
+  }));
+
+  reset();
+  persistent_vector<uint32_t> vector(0, jobs);
+  for (uint32_t j = 0; j < jobs; ++j)
+    vector.push_back(j * 13 % jobs);
+  print_time("vector<uint32_t> tick by scan (100 jobs)",
+      time_per_op(ITERATIONS, [&] {
+    for (uint32_t i = 0; i < ITERATIONS; ++i) {
+      const auto& const_vector = vector;
+      std::size_t earliest = 0;
+      for (std::size_t j = 1; j < jobs; ++j) {
+        if (const_vector[j] < const_vector[earliest])
+          earliest = j;
+      }
+      vector[earliest] += jobs;
+    }
+    sink = vector[0];
+  }));
+}
+
+void bench_traffic() {
+  const std::size_t ops = 1024;
+
+  reset();
+  {
+    persistent_queue<sample> queue(0, QUEUE_CAPACITY);
+    queue.commit();
+    EEPROM.reset_stats();
+    for (std::size_t i = 0; i < ops; ++i) {
+      if (queue.full())
+        queue.pop();
+      queue.push(make_sample(i));
+      queue.commit();
+    }
+  }
+  print_traffic("queue push, commit every push", ops);
+
+  reset();
+  {
+    persistent_queue<sample> queue(0, QUEUE_CAPACITY);
+    queue.commit();
+    EEPROM.reset_stats();
+    for (std::size_t i = 0; i < ops; ++i) {
+      if (queue.full())
+        queue.pop();
+      queue.push(make_sample(i));
+      if (i % 32 == 31)
+        queue.commit();
+    }
+  }
+  print_traffic("queue push, commit every 32 pushes", ops);
+
+  reset();
+  {
+    persistent_queue<sample> queue(0, QUEUE_CAPACITY);
+    persistent_flush_scheduler<persistent_queue<sample>> flusher(
+        queue, 32, 10000);
+    queue.commit();
+    EEPROM.reset_stats();
+    for (std::size_t i = 0; i < ops; ++i) {
+      if (queue.full())
+        queue.pop();
+      queue.push(make_sample(i));
+      flusher.modified(1, i * 500);
+      flusher.poll(i * 500);
+    }
+  }
+  print_traffic("queue push every 0.5 s, flush after 10 s", ops);
+
+  reset();
+  {
+    staged_persistent_queue<sample, 16> queue(0, QUEUE_CAPACITY);
+    queue.commit();
+    EEPROM.reset_stats();
+    for (std::size_t i = 0; i < ops; ++i) {
+      if (queue.full())
+        queue.pop();
+      queue.push(make_sample(i));
+    }
+  }
+  print_traffic("staged queue push (16 in RTC memory)", ops);
+
+  reset();
+  {
+    persistent_queue<sample> queue(traffic_layout::offset<0>(), QUEUE_CAPACITY);
+    persistent_vector<uint32_t> totals(traffic_layout::offset<1>(), 1);
+    totals.push_back(0);
+    queue.commit();
+    totals.commit();
+    EEPROM.reset_stats();
+    for (std::size_t i = 0; i < ops; ++i) {
+      if (queue.full())
+        queue.pop();
+      queue.push(make_sample(i));
+      queue.commit();
+      ++totals[0];
+      totals.commit();
+    }
+  }
+  print_traffic("queue push + vector update, two commits", ops);
+
+  reset();
+  {
+    persistent_queue<sample> queue(traffic_layout::offset<0>(), QUEUE_CAPACITY);
+    persistent_vector<uint32_t> totals(traffic_layout::offset<1>(), 1);
+    totals.push_back(0);
+    queue.commit();
+    totals.commit();
+    EEPROM.reset_stats();
+    for (std::size_t i = 0; i < ops; ++i) {
+      persistent_transaction transaction;
+      if (queue.full())
+        queue.pop();
+      queue.push(make_sample(i));
+      ++totals[0];
+    }
+  }
+  print_traffic("queue push + vector update, transaction", ops);
+
+  reset();
+  {
+    persistent_log_queue<sample> log(0, 4);
+    for (std::size_t i = 0; i < ops * 4; ++i) {
+      if (log.full())
+        log.pop();
+      log.push(make_sample(i));
+    }
+  }
+  print_traffic("log queue push (4 sectors)", ops * 4);
+
+  reset();
+  {
+    persistent_counters<8, 16> counters(0);
+    counters.commit();
+    EEPROM.reset_stats();
+    for (std::size_t i = 0; i < ops; ++i) {
+      counters.set(0, i % (counters.max_value() + 1));
+      counters.commit();
+    }
+  }
+  print_traffic("counter increment + commit (EEPROM)", ops);
+
+  reset();
+  {
+    persistent_flash_counter<> counter(8);
+    spi_flash_stats() = spi_flash_statistics();
+    for (std::size_t i = 0; i < ops * 64; ++i)
+      counter.increment();
+  }
+  print_traffic("flash counter increment", ops * 64);
+}
+
+} // namespace
+
+int main() {
+  print_time_header();
+  bench_queue();
+  bench_drain();
+  bench_vector();
+  bench_map();
+  bench_schedule();
+
+  printf("\n");
+  print_traffic_header();
+  bench_traffic();
+}
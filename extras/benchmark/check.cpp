@@ -0,0 +1,1054 @@
+// Host-side checks of the persistent containers.
+//
+// Containers run on the same simulated EEPROM and SPI flash as the
+// benchmark. Power losses are simulated by restoring the storage to a
+// mix of the images before and after a commit, as a byte-write backend
+// (RAM, FRAM, RTC memory) would be left, or by tearing a flash write, and
+// then constructing the containers again. The program reports every failed
+// check and exits with a non-zero status if any failed.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <queue>
+#include <vector>
+
+#include "simulator.h"
+
+#include <cached_persistent_queue.h>
+#include <cached_persistent_vector.h>
+#include <persistent_bitset.h>
+#include <persistent_blob_queue.h>
+#include <persistent_codec.h>
+#include <persistent_compressed_queue.h>
+#include <persistent_counters.h>
+#include <persistent_flash_counter.h>
+#include <persistent_lazy.h>
+#include <persistent_log_queue.h>
+#include <persistent_map.h>
+#include <persistent_pool.h>
+#include <persistent_priority_queue.h>
+#include <persistent_queue.h>
+#include <persistent_transaction.h>
+#include <persistent_vector.h>
+#include <persistent_vector_view.h>
+#include <ram_backend.h>
+#include <spsc_persistent_queue.h>
+#include <staged_persistent_queue.h>
+#include <static_persistent_queue.h>
+#include <static_persistent_vector.h>
+
+namespace {
+
+struct sample {
+  uint32_t timestamp;
+  int16_t values[6];
+};
+
+bool operator==(const sample& a, const sample& b) {
+  return memcmp(&a, &b, sizeof(sample)) == 0;
+}
+
+constexpr std::size_t EEPROM_SIZE { 4096 };
+
+unsigned failures;
+
+void check(bool condition, const char* expression, int line) {
+  if (!condition) {
+    printf("check.cpp:%d: check failed: %s\n", line, expression);
+    ++failures;
+  }
+}
+
+#define CHECK(...) check((__VA_ARGS__), #__VA_ARGS__, __LINE__)
+
+void reset() {
+  EEPROM.begin(EEPROM_SIZE);
+  spi_flash_reset();
+}
+
+typedef std::vector<uint8_t> image;
+
+image snapshot() {
+  const uint8_t* data = EEPROM.getConstDataPtr();
+  return image(data, data + EEPROM_SIZE);
+}
+
+/** Restores the image written by a commit that was interrupted.
+ *
+ * The bytes in [0, header_size) that the commit changed are only written up
+ * to half of them, while the bytes after the header are written in full.
+ */
+void restore_torn(const image& before, const image& after,
+    std::size_t header_size) {
+  image torn = after;
+  std::vector<std::size_t> changed;
+  for (std::size_t i = 0; i < header_size; ++i) {
+    if (before[i] != after[i])
+      changed.push_back(i);
+  }
+  for (std::size_t i = changed.size() / 2; i < changed.size(); ++i)
+    torn[changed[i]] = before[changed[i]];
+  memcpy(EEPROM.getDataPtr(), torn.data(), torn.size());
+}
+
+sample make_sample(uint32_t i) {
+  sample s {};
+  s.timestamp = i * 1000;
+  s.values[0] = static_cast<int16_t>(i);
+  s.values[3] = static_cast<int16_t>(-static_cast<int16_t>(i) / 8);
+  return s;
+}
+
+void check_queue_round_trip() {
+  reset();
+  const std::size_t capacity = 8;
+  std::deque<uint32_t> expected;
+  {
+    persistent_queue<uint32_t> queue(0, capacity);
+    // Several times the capacity, so the indices wrap around.
+    for (uint32_t i = 0; i < 100; ++i) {
+      CHECK(queue.push(i));
+      expected.push_back(i);
+      if (i % 3 == 0) {
+        CHECK(queue.front() == expected.front());
+        CHECK(queue.pop());
+        expected.pop_front();
+      }
+      while (queue.full()) {
+        CHECK(!queue.push(i));
+        CHECK(queue.pop());
+        expected.pop_front();
+      }
+    }
+    CHECK(queue.size() == expected.size());
+    CHECK(queue.commit());
+  }
+
+  persistent_queue<uint32_t> queue(0, capacity);
+  CHECK(queue.size() == expected.size());
+  while (!expected.empty()) {
+    CHECK(queue.front() == expected.front());
+    CHECK(queue.pop());
+    expected.pop_front();
+  }
+  CHECK(queue.empty());
+}
+
+void check_queue_torn_commit() {
+  reset();
+  const std::size_t capacity = 16;
+  const std::size_t header_size
+      = persistent_queue<sample>::storage_size(0);
+
+  image before;
+  image after;
+  {
+    persistent_queue<sample> queue(0, capacity);
+    for (uint32_t i = 0; i < 4; ++i)
+      queue.push(make_sample(i));
+    CHECK(queue.commit());
+    before = snapshot();
+
+    for (uint32_t i = 4; i < 9; ++i)
+      queue.push(make_sample(i));
+    queue.pop();
+    CHECK(queue.commit());
+    after = snapshot();
+  }
+
+  // The torn header falls back to the previous commit.
+  restore_torn(before, after, header_size);
+  {
+    persistent_queue<sample> queue(0, capacity);
+    CHECK(queue.size() == 4);
+    CHECK(queue.front() == make_sample(0));
+  }
+
+  memcpy(EEPROM.getDataPtr(), after.data(), after.size());
+  persistent_queue<sample> queue(0, capacity);
+  CHECK(queue.size() == 8);
+  CHECK(queue.front() == make_sample(1));
+}
+
+/** Overwrites the bytes after a 16-bit signature. */
+template<class Index>
+void corrupt_indices(Index first, Index second) {
+  uint8_t* data = EEPROM.getDataPtr();
+  memcpy(data + sizeof(uint16_t), &first, sizeof(first));
+  memcpy(data + sizeof(uint16_t) + sizeof(first), &second, sizeof(second));
+}
+
+void check_static_corrupt_header() {
+  // Indices over the range of positions, and a size over the capacity,
+  // under a valid signature.
+  typedef static_persistent_queue<uint32_t, 6> queue_type;
+  reset();
+  { queue_type queue(0); queue.push(1); }
+  corrupt_indices<queue_type::index_type>(0, 200);
+  {
+    queue_type queue(0);
+    CHECK(queue.empty());
+    CHECK(queue.push(2) && queue.front() == 2);
+  }
+
+  typedef static_persistent_queue<uint32_t, 8> masked_type;
+  reset();
+  { masked_type queue(0); queue.push(1); }
+  corrupt_indices<masked_type::index_type>(0, 100);
+  CHECK(masked_type(0).empty());
+
+  typedef spsc_persistent_queue<uint32_t, 6> spsc_type;
+  reset();
+  { spsc_type queue(0); queue.push(1); }
+  corrupt_indices<spsc_type::index_type>(12, 3);
+  CHECK(spsc_type(0).empty());
+
+  typedef static_persistent_vector<uint32_t, 6> vector_type;
+  reset();
+  { vector_type vector(0); vector.push_back(1); }
+  corrupt_indices<vector_type::index_type>(200, 0);
+  CHECK(vector_type(0).empty());
+}
+
+void check_log_queue_torn_push() {
+  reset();
+  const std::size_t sectors = 3;
+  std::deque<uint32_t> expected;
+  uint32_t next = 0;
+  auto* log = new persistent_log_queue<uint32_t>(4, sectors);
+
+  for (std::size_t round = 0; round < 20; ++round) {
+    // Enough pushes and pops to move across every sector.
+    for (std::size_t i = 0; i < 400; ++i) {
+      if (log->push(next))
+        expected.push_back(next);
+      ++next;
+    }
+    while (expected.size() > 100) {
+      CHECK(log->front() == expected.front());
+      CHECK(log->pop());
+      expected.pop_front();
+    }
+
+    // Interrupted push, followed by a reboot.
+    spi_flash_tear(round % 8);
+    CHECK(!log->push(next++));
+    delete log;
+    log = new persistent_log_queue<uint32_t>(4, sectors);
+
+    CHECK(log->size() == expected.size());
+    if (!expected.empty())
+      CHECK(log->front() == expected.front());
+  }
+
+  while (!expected.empty()) {
+    CHECK(log->front() == expected.front());
+    CHECK(log->pop());
+    expected.pop_front();
+  }
+  CHECK(log->empty());
+  delete log;
+}
+
+void check_blob_queue_skip() {
+  reset();
+  // Records take 22 bytes with their length, so the third one does not fit
+  // before the end and wraps around behind a skip marker.
+  const std::size_t capacity = 64;
+  const std::size_t header_size = persistent_blob_queue<>::storage_size(0);
+  uint8_t records[3][20];
+  for (std::size_t r = 0; r < 3; ++r)
+    memset(records[r], 'a' + r, sizeof(records[r]));
+
+  image before;
+  image after;
+  {
+    persistent_blob_queue<> queue(0, capacity);
+    CHECK(queue.push(records[0], sizeof(records[0])));
+    CHECK(queue.push(records[1], sizeof(records[1])));
+    CHECK(queue.pop());
+    CHECK(queue.commit());
+    before = snapshot();
+
+    CHECK(queue.push(records[2], sizeof(records[2])));
+    CHECK(queue.commit());
+    after = snapshot();
+  }
+
+  restore_torn(before, after, header_size);
+  {
+    persistent_blob_queue<> queue(0, capacity);
+    CHECK(queue.size() == 1);
+    CHECK(queue.front().size == sizeof(records[1]));
+    CHECK(memcmp(queue.front().data, records[1], sizeof(records[1])) == 0);
+  }
+
+  memcpy(EEPROM.getDataPtr(), after.data(), after.size());
+  persistent_blob_queue<> queue(0, capacity);
+  CHECK(queue.size() == 2);
+  CHECK(queue.pop());
+  persistent_blob_queue<>::const_span front = queue.front();
+  CHECK(front.data == EEPROM.getConstDataPtr() + header_size + 2);
+  CHECK(front.size == sizeof(records[2]));
+  CHECK(memcmp(front.data, records[2], sizeof(records[2])) == 0);
+  CHECK(queue.pop());
+  CHECK(queue.empty());
+
+  // Empty records hold no data.
+  CHECK(queue.push(nullptr, 0));
+  CHECK(queue.size() == 1 && queue.front().size == 0);
+  CHECK(queue.pop());
+}
+
+void check_map_erase() {
+  reset();
+  const std::size_t capacity = 64;
+  {
+    persistent_map<uint16_t, uint32_t> map(0, capacity);
+    for (uint16_t key = 0; key < 48; ++key)
+      CHECK(map.insert_or_assign(key, key * 10u));
+    for (uint16_t key = 0; key < 48; key += 2)
+      CHECK(map.erase(key));
+    CHECK(!map.erase(0));
+
+    // New keys take the freed slots, and the odd keys moved back are still
+    // found.
+    for (uint16_t key = 100; key < 124; ++key)
+      CHECK(map.insert_or_assign(key, key));
+    CHECK(map.insert_or_assign(1, 11));
+    CHECK(map.size() == 48);
+    CHECK(map.commit());
+  }
+
+  persistent_map<uint16_t, uint32_t> map(0, capacity);
+  CHECK(map.size() == 48);
+  for (uint16_t key = 0; key < 48; ++key) {
+    const uint32_t* value = map.find(key);
+    if (key % 2 == 0)
+      CHECK(value == nullptr);
+    else
+      CHECK(value != nullptr && *value == (key == 1 ? 11 : key * 10u));
+  }
+  for (uint16_t key = 100; key < 124; ++key)
+    CHECK(map.contains(key) && *map.find(key) == key);
+  CHECK(!map.contains(200));
+
+  // Lookups leave nothing to commit; modify() marks the value.
+  CHECK(!map.dirty());
+  CHECK(map.modify(200) == nullptr && !map.dirty());
+  *map.modify(1) = 12;
+  CHECK(map.dirty() && *map.find(1) == 12);
+}
+
+void check_map_churn() {
+  reset();
+  // Many more erases than slots, so that keys are moved back across the
+  // end of the table.
+  const std::size_t capacity = 32;
+  persistent_map<uint32_t, uint32_t> map(0, capacity);
+  std::vector<uint32_t> live;
+  unsigned seed = 1;
+  for (uint32_t i = 0; i < 5000; ++i) {
+    seed = seed * 1103515245 + 12345;
+    if (live.size() < capacity - 4 && seed % 3 != 0) {
+      CHECK(map.insert_or_assign(i, ~i));
+      live.push_back(i);
+    } else if (!live.empty()) {
+      const std::size_t victim = (seed >> 8) % live.size();
+      CHECK(map.erase(live[victim]));
+      live[victim] = live.back();
+      live.pop_back();
+    }
+    CHECK(map.size() == live.size());
+  }
+  for (uint32_t key : live)
+    CHECK(map.find(key) != nullptr && *map.find(key) == ~key);
+  for (uint32_t key = 5000; key < 5100; ++key)
+    CHECK(!map.contains(key));
+  for (std::size_t i = live.size(); i < capacity; ++i)
+    CHECK(map.insert_or_assign(100000 + i, 0));
+  CHECK(map.full());
+}
+
+void check_priority_queue() {
+  typedef persistent_priority_queue<uint32_t> queue_type;
+  reset();
+  const std::size_t capacity = 40;
+  std::priority_queue<uint32_t, std::vector<uint32_t>,
+      std::greater<uint32_t>> expected;
+  unsigned seed = 7;
+  for (int round = 0; round < 2; ++round) {
+    // The second round goes on from the committed heap.
+    queue_type queue(0, capacity);
+    CHECK(queue.size() == expected.size());
+    for (uint32_t i = 0; i < 500; ++i) {
+      seed = seed * 1103515245 + 12345;
+      if (seed % 5 < 3) {
+        const uint32_t value = (seed >> 8) % 1000;
+        CHECK(queue.push(value) == (expected.size() < capacity));
+        if (expected.size() < capacity)
+          expected.push(value);
+      } else {
+        CHECK(queue.pop() == !expected.empty());
+        if (!expected.empty())
+          expected.pop();
+      }
+      CHECK(queue.size() == expected.size());
+      CHECK(queue.empty() || queue.top() == expected.top());
+    }
+    CHECK(queue.commit());
+  }
+
+  queue_type queue(0, capacity);
+  CHECK(queue.size() == expected.size());
+  while (!expected.empty()) {
+    CHECK(queue.top() == expected.top());
+    CHECK(queue.pop());
+    expected.pop();
+  }
+  CHECK(queue.empty() && !queue.pop());
+}
+
+void check_pool() {
+  typedef persistent_pool<uint32_t> pool_type;
+  reset();
+  // The last bitmap word only has 6 slots.
+  const std::size_t capacity = 70;
+  std::vector<bool> expected(capacity, false);
+  {
+    pool_type pool(0, capacity);
+    pool_type::handle_type handle;
+    for (std::size_t i = 0; i < capacity; ++i) {
+      CHECK(pool.allocate(static_cast<uint32_t>(i), handle));
+      CHECK(handle == i);
+      expected[handle] = true;
+    }
+    CHECK(pool.full() && !pool.allocate(0, handle));
+
+    for (std::size_t h = 3; h < capacity; h += 4) {
+      CHECK(pool.free(h));
+      expected[h] = false;
+    }
+    CHECK(!pool.free(3) && !pool.free(capacity));
+    // New elements take the lowest free slots.
+    CHECK(pool.allocate(100, handle) && handle == 3);
+    expected[3] = true;
+    CHECK(pool.free(69) && pool.allocate(101, handle) && handle == 7);
+    expected[69] = false;
+    expected[7] = true;
+    CHECK(pool.commit());
+  }
+
+  // Bits past the capacity in the last word are not slots.
+  const std::size_t data_offset
+      = pool_type::storage_size(capacity) - capacity * sizeof(uint32_t);
+  EEPROM.getDataPtr()[data_offset - 1] |= 0xc0;
+
+  pool_type pool(0, capacity);
+  CHECK(pool.size() == static_cast<std::size_t>(
+      std::count(expected.begin(), expected.end(), true)));
+  for (std::size_t h = 0; h < capacity; ++h) {
+    CHECK(pool.allocated(h) == expected[h]);
+    CHECK(!expected[h] || pool[h] == (h == 3 ? 100 : h == 7 ? 101 : h));
+  }
+  CHECK(!pool.allocated(capacity));
+  std::size_t h = 0;
+  for (pool_type::handle_type handle = pool.next(0);
+      handle < pool.capacity(); handle = pool.next(handle + 1)) {
+    while (!expected[h])
+      ++h;
+    CHECK(handle == h++);
+  }
+  CHECK(std::find(expected.begin() + h, expected.end(), true)
+      == expected.end());
+  CHECK(pool.next(68) == 68 && pool.next(69) == capacity);
+
+  pool_type::handle_type handle;
+  while (pool.allocate(0, handle))
+    CHECK(handle < capacity);
+  CHECK(pool.full());
+}
+
+void check_bitset_counters() {
+  // Neither size fills the last word.
+  typedef persistent_bitset<40> bitset_type;
+  typedef persistent_counters<4, 10> counters_type;
+  reset();
+  {
+    bitset_type bits(0);
+    counters_type counters(64);
+    CHECK(bits.none() && bits.find_first() == 40);
+    const std::size_t set[] { 0, 31, 32, 39 };
+    for (std::size_t pos : set)
+      bits.set(pos);
+    CHECK(bits.count() == 4 && !bits.all());
+    CHECK(bits.find_first() == 0 && bits.find_next(1) == 31);
+    CHECK(bits.find_next(32) == 32 && bits.find_next(33) == 39);
+    CHECK(bits.find_next(40) == 40);
+    bits.set();
+    CHECK(bits.all() && bits.count() == 40);
+    bits.flip(39);
+    CHECK(!bits.all() && bits.find_next(39) == 40);
+    bits.flip(39);
+    CHECK(bits.all());
+    bits.reset();
+    bits.set(33);
+
+    for (std::size_t pos = 0; pos < counters.size(); ++pos)
+      CHECK(counters.get(pos) == 0 && !counters.decrement(pos));
+    counters.set(8, 100);
+    CHECK(counters.get(8) == counters_type::max_value());
+    CHECK(!counters.increment(8));
+    CHECK(counters.get(7) == 0 && counters.get(9) == 0);
+    for (int i = 0; i < 20; ++i)
+      counters.increment(9);
+    CHECK(counters.get(9) == 15 && counters.get(8) == 15);
+    CHECK(counters.increment(7) && counters.decrement(8));
+    CHECK(bits.commit() && counters.commit());
+  }
+
+  bitset_type bits(0);
+  counters_type counters(64);
+  CHECK(bits.count() == 1 && bits.find_first() == 33);
+  CHECK(counters.get(7) == 1 && counters.get(8) == 14
+      && counters.get(9) == 15);
+}
+
+void check_flash_counter() {
+  typedef persistent_flash_counter<> counter_type;
+  const uint32_t first_sector = 8;
+  const uint32_t full = counter_type::increments_per_sector();
+  reset();
+  {
+    counter_type counter(first_sector);
+    for (uint32_t i = 0; i < full; ++i)
+      CHECK(counter.increment());
+    CHECK(counter.value() == full);
+
+    // Power is lost while the second sector's header is written.
+    spi_flash_tear(4);
+    CHECK(!counter.increment());
+  }
+  {
+    counter_type counter(first_sector);
+    CHECK(counter.value() == full);
+  }
+
+  // Power is lost after the switch, before the first sector is erased.
+  std::vector<uint32_t> sector(SPI_FLASH_SEC_SIZE / sizeof(uint32_t));
+  const uint32_t address = first_sector * SPI_FLASH_SEC_SIZE;
+  spi_flash_read(address, sector.data(), SPI_FLASH_SEC_SIZE);
+  {
+    counter_type counter(first_sector);
+    CHECK(counter.increment() && counter.increment());
+    CHECK(counter.value() == full + 2);
+  }
+  spi_flash_write(address, sector.data(), SPI_FLASH_SEC_SIZE);
+
+  counter_type counter(first_sector);
+  CHECK(counter.value() == full + 2);
+  CHECK(counter.increment() && counter.value() == full + 3);
+  counter_type reopened(first_sector);
+  CHECK(reopened.value() == full + 3);
+}
+
+void check_lazy_backend() {
+  // format() clears and commits the container's own backend, not the EEPROM.
+  typedef ram_backend<256> ram;
+  typedef persistent_queue<uint32_t, ram> queue_type;
+  reset();
+  memset(ram::data(), 0xaa, 256);
+  const image eeprom = snapshot();
+  const unsigned long commits = EEPROM.stats().commits;
+  const unsigned long ram_commits = ram::commits();
+
+  persistent_lazy<queue_type> queue(0, 8);
+  CHECK(persistent_format_all(queue));
+  CHECK(ram::commits() > ram_commits);
+  CHECK(EEPROM.stats().commits == commits);
+  CHECK(snapshot() == eeprom);
+  CHECK(queue->empty() && queue->push(1) && queue->commit());
+}
+
+/** Staging storage that drops its writes once power is "lost". */
+struct lossy_staging {
+  static uint8_t data[256];
+  static bool lost;
+
+  static void read(size_t offset, void* out, size_t size) {
+    memcpy(out, data + offset, size);
+  }
+
+  static void write(size_t offset, const void* in, size_t size) {
+    if (!lost)
+      memcpy(data + offset, in, size);
+  }
+};
+
+uint8_t lossy_staging::data[256];
+bool lossy_staging::lost;
+
+/** Mapped storage whose commits can be made to fail, or run a function
+ * while they write.
+ */
+struct failing_backend {
+  static uint8_t buffer[1024];
+  static bool failing;
+  static unsigned long attempts;
+  static void (*during_commit)();
+
+  static uint8_t* data() {
+    return buffer;
+  }
+
+  static void read(size_t offset, void* out, size_t size) {
+    memcpy(out, buffer + offset, size);
+  }
+
+  static void write(size_t offset, const void* in, size_t size) {
+    memcpy(buffer + offset, in, size);
+  }
+
+  static bool commit() {
+    ++attempts;
+    if (during_commit != nullptr)
+      during_commit();
+    return !failing;
+  }
+};
+
+alignas(persistent_max_align_type) uint8_t failing_backend::buffer[1024];
+bool failing_backend::failing;
+unsigned long failing_backend::attempts;
+void (*failing_backend::during_commit)();
+
+void check_staged_queue() {
+  typedef staged_persistent_queue<uint32_t, 4, eeprom_backend, lossy_staging>
+      staged_type;
+  reset();
+  memset(lossy_staging::data, 0, sizeof(lossy_staging::data));
+  lossy_staging::lost = false;
+  {
+    staged_type queue(0, 32);
+    for (uint32_t i = 0; i < 3; ++i)
+      CHECK(queue.push(i));
+    // Power is lost right after the queue is committed, before the buffer
+    // is emptied.
+    const unsigned long commits = EEPROM.stats().commits;
+    lossy_staging::lost = true;
+    CHECK(queue.push(3));
+    CHECK(EEPROM.stats().commits == commits + 1);
+  }
+  lossy_staging::lost = false;
+  {
+    staged_type queue(0, 32);
+    CHECK(queue.size() == 4);
+    CHECK(queue.staged() == 0);
+  }
+
+  // Once a spill fails, the commit is retried every N pushes.
+  typedef staged_persistent_queue<uint32_t, 4, failing_backend,
+      lossy_staging> failing_type;
+  memset(lossy_staging::data, 0, sizeof(lossy_staging::data));
+  failing_backend::failing = true;
+  failing_type queue(0, 32);
+  for (uint32_t i = 0; i < 4; ++i)
+    CHECK(queue.push(i));
+  const unsigned long attempts = failing_backend::attempts;
+  for (uint32_t i = 4; i < 7; ++i)
+    CHECK(queue.push(i));
+  CHECK(failing_backend::attempts == attempts);
+
+  failing_backend::failing = false;
+  CHECK(queue.push(7));
+  CHECK(failing_backend::attempts > attempts);
+  CHECK(!queue.dirty());
+  CHECK(queue.size() == 8 && queue.front() == 0);
+}
+
+/** Storage that is not mapped in RAM, like an I2C EEPROM, counting its
+ * writes.
+ */
+struct unmapped_backend {
+  static uint8_t buffer[512];
+  static unsigned long writes;
+
+  static void read(size_t offset, void* out, size_t size) {
+    memcpy(out, buffer + offset, size);
+  }
+
+  static void write(size_t offset, const void* in, size_t size) {
+    memcpy(buffer + offset, in, size);
+    ++writes;
+  }
+
+  static bool commit() {
+    return true;
+  }
+};
+
+uint8_t unmapped_backend::buffer[512];
+unsigned long unmapped_backend::writes;
+
+void check_cached_containers() {
+  // Two lines, so most elements are evicted before the commit.
+  typedef cached_persistent_queue<uint32_t, 2, unmapped_backend> queue_type;
+  typedef cached_persistent_vector<uint32_t, 2, unmapped_backend>
+      vector_type;
+  const std::size_t vector_offset = 256;
+  memset(unmapped_backend::buffer, 0xaa, sizeof(unmapped_backend::buffer));
+  std::deque<uint32_t> expected_queue;
+  std::vector<uint32_t> expected_vector;
+  {
+    queue_type queue(0, 16);
+    vector_type vector(vector_offset, 24);
+    CHECK(queue.empty() && vector.empty());
+    const unsigned long writes = unmapped_backend::writes;
+    for (uint32_t i = 0; i < 40; ++i) {
+      CHECK(queue.push(i));
+      expected_queue.push_back(i);
+      if (queue.full()) {
+        CHECK(!queue.push(i) && queue.front() == expected_queue.front());
+        CHECK(queue.pop());
+        expected_queue.pop_front();
+      }
+      if (vector.push_back(i))
+        expected_vector.push_back(i);
+    }
+    unsigned seed = 5;
+    for (int i = 0; i < 50; ++i) {
+      seed = seed * 1103515245 + 12345;
+      const std::size_t pos = (seed >> 8) % expected_vector.size();
+      vector[pos] = seed;
+      expected_vector[pos] = seed;
+    }
+    CHECK(unmapped_backend::writes > writes);
+    CHECK(queue.dirty() && vector.dirty());
+    CHECK(queue.commit() && vector.commit());
+    CHECK(!queue.dirty() && !vector.dirty());
+  }
+
+  queue_type queue(0, 16);
+  vector_type vector(vector_offset, 24);
+  CHECK(vector.size() == expected_vector.size() && vector.full());
+  for (std::size_t pos = 0; pos < expected_vector.size(); ++pos)
+    CHECK(vector[pos] == expected_vector[pos]);
+  CHECK(queue.size() == expected_queue.size());
+  while (!expected_queue.empty()) {
+    CHECK(queue.front() == expected_queue.front());
+    CHECK(queue.pop());
+    expected_queue.pop_front();
+  }
+  CHECK(queue.empty());
+}
+
+/** Lock that is never taken twice, and tells whether it is held. */
+struct checked_lock {
+  static bool held;
+
+  void lock() {
+    CHECK(!held);
+    held = true;
+  }
+
+  void unlock() {
+    held = false;
+  }
+};
+
+bool checked_lock::held;
+
+typedef persistent_queue<uint32_t, failing_backend, checked_lock>
+    shared_queue;
+
+shared_queue* committing_queue;
+image committed_image;
+
+/** Pops and pushes from another context while the queue is committed. */
+void use_committing_queue() {
+  shared_queue& queue = *committing_queue;
+  CHECK(!checked_lock::held);
+  CHECK(queue.pop() && queue.pop());
+  // The popped slots are still covered by the header being committed.
+  CHECK(queue.push(10u));
+  CHECK(!queue.push(11u));
+  CHECK(!queue.push_overwrite(12u));
+  // The flash write may read the RAM copy as it is now.
+  committed_image.assign(failing_backend::buffer,
+      failing_backend::buffer + sizeof(failing_backend::buffer));
+}
+
+void check_queue_shared_commit() {
+  memset(failing_backend::buffer, 0, sizeof(failing_backend::buffer));
+  failing_backend::failing = false;
+  {
+    shared_queue queue(0, 4);
+    for (uint32_t i = 1; i <= 3; ++i)
+      CHECK(queue.push(i));
+    committing_queue = &queue;
+    failing_backend::during_commit = &use_committing_queue;
+    CHECK(queue.commit());
+    failing_backend::during_commit = nullptr;
+
+    // The changes made meanwhile are left for the next commit, and the
+    // popped slots can be reused.
+    CHECK(queue.dirty() && queue.size() == 2 && queue.front() == 3);
+    CHECK(queue.push(11u) && queue.push(12u) && queue.full());
+
+    failing_backend::failing = true;
+    CHECK(!queue.commit());
+    CHECK(queue.dirty());
+    failing_backend::failing = false;
+    CHECK(queue.commit() && !queue.dirty());
+    CHECK(queue.pop() && queue.commit());
+  }
+  {
+    shared_queue queue(0, 4);
+    CHECK(queue.size() == 3 && queue.front() == 10);
+    CHECK(queue.pop() && queue.front() == 11);
+  }
+
+  memcpy(failing_backend::buffer, committed_image.data(),
+      committed_image.size());
+  shared_queue queue(0, 4);
+  CHECK(queue.size() == 3);
+  for (uint32_t i = 1; i <= 3; ++i)
+    CHECK(queue.front() == i && queue.pop());
+}
+
+void check_transaction() {
+  // Both backends count the commits issued to them.
+  typedef ram_backend<1024> ram;
+  memset(failing_backend::buffer, 0, sizeof(failing_backend::buffer));
+  failing_backend::failing = false;
+  persistent_queue<uint32_t, failing_backend> queue(0, 8);
+  persistent_vector<uint32_t, failing_backend> vector(512, 8);
+  persistent_queue<uint32_t, ram> other(0, 8);
+  CHECK(queue.commit() && vector.commit() && other.commit());
+
+  unsigned long attempts = failing_backend::attempts;
+  {
+    persistent_transaction transaction;
+    CHECK(queue.push(1));
+    {
+      persistent_transaction nested;
+      CHECK(vector.push_back(2));
+      CHECK(vector.commit());
+      CHECK(nested.commit());
+    }
+    CHECK(queue.commit());
+    CHECK(failing_backend::attempts == attempts);
+    CHECK(transaction.commit());
+  }
+  CHECK(failing_backend::attempts == attempts + 1);
+  CHECK(!queue.dirty() && !vector.dirty());
+
+  // Ranges of both backends are interleaved; each backend is committed
+  // once, and the failed one keeps its changes.
+  failing_backend::failing = true;
+  attempts = failing_backend::attempts;
+  const unsigned long ram_commits = ram::commits();
+  {
+    persistent_transaction transaction;
+    CHECK(queue.push(3));
+    CHECK(other.push(4));
+    CHECK(vector.push_back(5));
+    CHECK(!transaction.commit());
+  }
+  CHECK(failing_backend::attempts == attempts + 1);
+  CHECK(ram::commits() == ram_commits + 1);
+  CHECK(queue.dirty() && vector.dirty() && !other.dirty());
+
+  failing_backend::failing = false;
+  {
+    persistent_transaction transaction;
+    CHECK(queue.commit() && vector.commit());
+  }
+  CHECK(failing_backend::attempts == attempts + 2);
+  CHECK(!queue.dirty() && !vector.dirty());
+  CHECK(queue.size() == 2 && vector.size() == 2 && vector[1] == 5);
+}
+
+/** Element ordered by its key only, tagged with the batch it came from. */
+struct entry {
+  uint16_t key;
+  uint16_t tag;
+};
+
+bool operator==(const entry& a, const entry& b) {
+  return a.key == b.key && a.tag == b.tag;
+}
+
+struct entry_less {
+  bool operator()(const entry& a, const entry& b) const {
+    return a.key < b.key;
+  }
+};
+
+/** Returns a sorted batch of entries, with repeated keys. */
+std::vector<entry> make_batch(std::size_t count, uint16_t tag,
+    unsigned& seed) {
+  std::vector<entry> batch;
+  for (std::size_t i = 0; i < count; ++i) {
+    seed = seed * 1103515245 + 12345;
+    batch.push_back(entry { static_cast<uint16_t>((seed >> 8) % 60), tag });
+  }
+  std::stable_sort(batch.begin(), batch.end(), entry_less());
+  return batch;
+}
+
+void check_sorted_vector() {
+  typedef persistent_vector<entry> vector_type;
+  reset();
+  const std::size_t capacity = 64;
+  std::vector<entry> expected;
+  unsigned seed = 3;
+  {
+    vector_type vector(0, capacity);
+    for (const entry& e : make_batch(30, 0, seed)) {
+      CHECK(vector.sorted_insert(e, entry_less()));
+      expected.insert(std::lower_bound(expected.begin(), expected.end(), e,
+          entry_less()), e);
+    }
+
+    // Equivalent elements go after the vector's.
+    const std::vector<entry> batch = make_batch(20, 1, seed);
+    CHECK(vector.merge(batch.begin(), batch.end(), entry_less()) == 20);
+    std::vector<entry> merged;
+    std::merge(expected.begin(), expected.end(), batch.begin(), batch.end(),
+        std::back_inserter(merged), entry_less());
+    expected.swap(merged);
+    CHECK(vector.commit());
+  }
+
+  vector_type vector(0, capacity);
+  CHECK(vector.size() == expected.size());
+  CHECK(std::equal(vector.begin(), vector.end(), expected.begin()));
+  for (uint16_t key = 0; key < 62; ++key) {
+    const entry value { key, 0 };
+    CHECK(vector.lower_bound(value, entry_less()) - vector.begin()
+        == std::lower_bound(expected.begin(), expected.end(), value,
+            entry_less()) - expected.begin());
+    CHECK(vector.contains(value, entry_less())
+        == std::binary_search(expected.begin(), expected.end(), value,
+            entry_less()));
+  }
+
+  // Only the first elements of a batch that does not fit are merged.
+  const std::vector<entry> batch = make_batch(30, 2, seed);
+  const std::size_t room = capacity - expected.size();
+  CHECK(vector.merge(batch.begin(), batch.end(), entry_less()) == room);
+  std::vector<entry> merged;
+  std::merge(expected.begin(), expected.end(), batch.begin(),
+      batch.begin() + room, std::back_inserter(merged), entry_less());
+  CHECK(vector.full());
+  CHECK(std::equal(vector.begin(), vector.end(), merged.begin()));
+  CHECK(vector.merge(batch.begin(), batch.end(), entry_less()) == 0);
+  CHECK(!vector.sorted_insert(batch[0], entry_less()));
+}
+
+void check_vector_view() {
+  // Elements smaller than a word, so most of them are not word-aligned.
+  reset();
+  {
+    persistent_vector<uint16_t> vector(0, 64);
+    for (uint16_t i = 0; i < 50; ++i)
+      CHECK(vector.sorted_insert(static_cast<uint16_t>(i * 37 % 101)));
+    CHECK(vector.commit());
+  }
+
+  persistent_vector<uint16_t> vector(0, 64);
+  persistent_vector_view<uint16_t> view(EEPROM.getConstDataPtr(), 64);
+  CHECK(view.valid() && view.size() == 50);
+  for (std::size_t i = 0; i < view.size(); ++i)
+    CHECK(view[i] == vector[i]);
+  for (uint16_t value = 0; value < 110; ++value) {
+    CHECK(view.lower_bound(value) - view.begin()
+        == vector.lower_bound(value) - vector.begin());
+    CHECK(view.contains(value) == vector.contains(value));
+  }
+  CHECK(!persistent_vector_view<uint32_t>(EEPROM.getConstDataPtr(), 64)
+      .valid());
+}
+
+void check_codec_round_trip() {
+  sample previous = make_sample(0);
+  for (uint32_t i = 1; i < 200; ++i) {
+    sample value = make_sample(i * i);
+    uint8_t encoded[persistent_codec<sample>::max_size];
+    const std::size_t size
+        = persistent_codec<sample>::encode(value, previous, encoded);
+    CHECK(size <= sizeof(encoded));
+
+    sample decoded;
+    CHECK(persistent_codec<sample>::decode(encoded, previous, decoded)
+        == size);
+    CHECK(decoded == value);
+    previous = value;
+  }
+
+  const uint32_t values[] { 0, 1, 127, 128, 16383, 16384, 0xffffffff };
+  for (uint32_t value : values) {
+    uint8_t encoded[5];
+    uint32_t decoded;
+    const std::size_t size = persistent_varint_encode(value, encoded);
+    CHECK(persistent_varint_decode(encoded, decoded) == size);
+    CHECK(decoded == value);
+  }
+
+  const int32_t signed_values[] { 0, -1, 1, -64, 64, INT32_MIN, INT32_MAX };
+  for (int32_t value : signed_values)
+    CHECK(persistent_zigzag_decode(persistent_zigzag_encode(value)) == value);
+
+  reset();
+  {
+    persistent_compressed_queue<sample> queue(0, 256);
+    for (uint32_t i = 0; i < 200; ++i)
+      queue.push_overwrite(make_sample(i));
+    CHECK(queue.commit());
+  }
+  persistent_compressed_queue<sample> queue(0, 256);
+  CHECK(!queue.empty());
+  CHECK(queue.back() == make_sample(199));
+  uint32_t first = queue.front().timestamp / 1000;
+  for (uint32_t i = first; i < 200; ++i) {
+    CHECK(queue.front() == make_sample(i));
+    CHECK(queue.pop());
+  }
+  CHECK(queue.empty());
+}
+
+} // namespace
+
+int main() {
+  check_queue_round_trip();
+  check_queue_torn_commit();
+  check_static_corrupt_header();
+  check_log_queue_torn_push();
+  check_blob_queue_skip();
+  check_map_erase();
+  check_map_churn();
+  check_priority_queue();
+  check_pool();
+  check_bitset_counters();
+  check_flash_counter();
+  check_lazy_backend();
+  check_staged_queue();
+  check_queue_shared_commit();
+  check_transaction();
+  check_cached_containers();
+  check_sorted_vector();
+  check_vector_view();
+  check_codec_round_trip();
+
+  if (failures > 0) {
+    printf("%u checks failed\n", failures);
+    return EXIT_FAILURE;
+  }
+  printf("all checks passed\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,76 @@
+#include "simulator.h"
+
+#include "Arduino.h"
+
+EEPROMClass EEPROM;
+EspClass ESP;
+
+namespace {
+
+constexpr std::size_t FLASH_SECTORS { 16 };
+uint8_t flash[FLASH_SECTORS * SPI_FLASH_SEC_SIZE];
+
+// Bytes programmed by the next write, if it is torn.
+bool tear_next { false };
+uint32_t tear_bytes { 0 };
+
+bool in_range(uint32_t address, uint32_t size) {
+  return address % 4 == 0 && size % 4 == 0 && address + size <= sizeof(flash);
+}
+
+} // namespace
+
+spi_flash_statistics& spi_flash_stats() {
+  static spi_flash_statistics stats {};
+  return stats;
+}
+
+void spi_flash_reset() {
+  memset(flash, 0xff, sizeof(flash));
+  tear_next = false;
+}
+
+void spi_flash_tear(uint32_t bytes) {
+  tear_next = true;
+  tear_bytes = bytes;
+}
+
+extern "C" {
+
+SpiFlashOpResult spi_flash_erase_sector(uint16_t sector) {
+  if (sector >= FLASH_SECTORS)
+    return SPI_FLASH_RESULT_ERR;
+
+  memset(flash + sector * SPI_FLASH_SEC_SIZE, 0xff, SPI_FLASH_SEC_SIZE);
+  ++spi_flash_stats().sector_erases;
+  return SPI_FLASH_RESULT_OK;
+}
+
+SpiFlashOpResult spi_flash_write(uint32_t address, uint32_t* data, uint32_t size) {
+  if (!in_range(address, size))
+    return SPI_FLASH_RESULT_ERR;
+
+  const bool torn = tear_next;
+  if (torn) {
+    tear_next = false;
+    if (tear_bytes < size)
+      size = tear_bytes;
+  }
+
+  // Programming can only clear bits.
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+  for (uint32_t i = 0; i < size; ++i)
+    flash[address + i] &= bytes[i];
+  spi_flash_stats().bytes_written += size;
+  return torn ? SPI_FLASH_RESULT_ERR : SPI_FLASH_RESULT_OK;
+}
+
+SpiFlashOpResult spi_flash_read(uint32_t address, uint32_t* data, uint32_t size) {
+  if (!in_range(address, size))
+    return SPI_FLASH_RESULT_ERR;
+
+  memcpy(data, flash + address, size);
+  return SPI_FLASH_RESULT_OK;
+}
+
+} // extern "C"
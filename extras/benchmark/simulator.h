@@ -0,0 +1,31 @@
+#ifndef SIMULATOR
+#define SIMULATOR
+
+#include "EEPROM.h"
+#include "spi_flash.h"
+
+/** Statistics of the simulated SPI flash. */
+struct spi_flash_statistics {
+  unsigned long sector_erases;
+  unsigned long bytes_written;
+};
+
+/** Returns the statistics of the simulated SPI flash.
+ *
+ * @return A reference to the statistics, which can be reset by assigning.
+ */
+spi_flash_statistics& spi_flash_stats();
+
+/** Erases the whole simulated SPI flash. */
+void spi_flash_reset();
+
+/** Makes the next write to the simulated SPI flash fail part-way.
+ *
+ * Only the first bytes of the write are programmed and the write reports an
+ * error, as if power was lost while writing.
+ *
+ * @param bytes Number of bytes programmed by the torn write.
+ */
+void spi_flash_tear(uint32_t bytes);
+
+#endif // SIMULATOR
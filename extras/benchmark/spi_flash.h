@@ -0,0 +1,26 @@
+#ifndef SIMULATED_SPI_FLASH
+#define SIMULATED_SPI_FLASH
+
+#include <stdint.h>
+
+#define SPI_FLASH_SEC_SIZE 4096
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+  SPI_FLASH_RESULT_OK,
+  SPI_FLASH_RESULT_ERR,
+  SPI_FLASH_RESULT_TIMEOUT
+} SpiFlashOpResult;
+
+SpiFlashOpResult spi_flash_erase_sector(uint16_t sector);
+SpiFlashOpResult spi_flash_write(uint32_t address, uint32_t* data, uint32_t size);
+SpiFlashOpResult spi_flash_read(uint32_t address, uint32_t* data, uint32_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SIMULATED_SPI_FLASH
@@ -0,0 +1,216 @@
+#ifndef CACHED_PERSISTENT_QUEUE
+#define CACHED_PERSISTENT_QUEUE
+
+#include "eeprom_cache.h"
+#include "persistent_signature.h"
+#include "persistent_traits.h"
+
+/** This class implements a fixed-size circular queue cached in RAM.
+ *
+ * The queue works like persistent_queue, but it does not need
+ * the storage to be mapped in memory, so it also works on AVR and with
+ * external memories. The queue's header and a window of elements are kept in
+ * RAM; the storage is only written when commit() is called or when a
+ * modified element is evicted from the cache.
+ *
+ * Unlike persistent_queue, the header is kept in a single copy, without a
+ * sequence number nor a CRC: a commit interrupted by a power loss may leave
+ * the header torn, and a header whose indices do not fit the capacity resets
+ * the queue, rather than falling back to the previous commit. The queue does
+ * not take part in a persistent_transaction either; commit() always commits
+ * the storage right away.
+ *
+ * @tparam T Element type.
+ * @tparam Lines Number of elements kept in RAM.
+ * @tparam Backend Storage backend (see eeprom_backend).
+ */
+template<class T, size_t Lines, class Backend = eeprom_backend>
+class cached_persistent_queue {
+public:
+  typedef T value_type;
+  typedef size_t size_type;
+  typedef Backend backend_type;
+  typedef value_type& reference;
+  typedef const value_type& const_reference;
+
+  static_assert(persistent_storable<value_type>::value,
+      "the element type must be trivially copyable");
+
+  /** Constructor.
+   *
+   * @param offset Offset from the storage's base address.
+   * @param capacity Queue's capacity (in elements).
+   */
+  cached_persistent_queue(int offset, size_type capacity)
+    : capacity_{capacity}
+    , storage_{static_cast<size_type>(offset)}
+  {
+    const header& h = storage_.header();
+    if (h.signature != SIGNATURE
+        || h.begin >= capacity_
+        || h.end >= capacity_
+        || h.size > capacity_) {
+      header& reset = storage_.modify_header();
+      reset.signature = SIGNATURE;
+      reset.begin = 0;
+      reset.end = 0;
+      reset.size = 0;
+    }
+  }
+
+  /**
+   * Computes the necessary storage size to hold a queue of the given capacity.
+   *
+   * @param capacity Queue's capacity (in elements).
+   */
+  static constexpr size_type storage_size(size_type capacity) {
+    return storage_type::storage_size(capacity);
+  }
+
+  /** Checks whether the queue is empty.
+   *
+   * @return True if the queue is empty; false otherwise.
+   */
+  bool empty() const {
+    return size() == 0;
+  }
+
+  /** Checks whether the queue is full.
+   *
+   * @return True if the queue is full; false otherwise.
+   */
+  bool full() const {
+    return size() == capacity();
+  }
+
+  /** Returns the queue's size.
+   *
+   * The size correspond to the number of elements currently in the queue.
+   *
+   * @return The queue's size.
+   */
+  size_type size() const {
+    return storage_.header().size;
+  }
+
+  /** Returns the queue's capacity.
+   *
+   * The capacity correspond to the maximum number of elements that the queue
+   * can store.
+   *
+   * @return The queue's capacity.
+   */
+  size_type capacity() const {
+    return capacity_;
+  }
+
+  /** Returns the element at the queue's front.
+   *
+   * The element is marked as modified, as it can be written through the
+   * returned reference.
+   *
+   * @return The element at the front, valid until the queue is accessed
+   *         again.
+   */
+  reference front() {
+    return storage_.elements().modify(storage_.header().begin);
+  }
+
+  /** Returns the element at the queue's front.
+   *
+   * @return The element at the front, valid until the queue is accessed
+   *         again.
+   */
+  const_reference front() const {
+    return storage_.elements().load(storage_.header().begin);
+  }
+
+  /** Pushes an element into the queue.
+   *
+   * The element is pushed at the end of the queue.
+   *
+   * @param value The element to be pushed.
+   * @return True if the element was insterted; false otherwise.
+   */
+  bool push(const value_type& value) {
+    if (full())
+      return false;
+
+    header& h = storage_.modify_header();
+    storage_.elements().store(h.end, value);
+    increment(h.end);
+    ++(h.size);
+    return true;
+  }
+
+  /** Pops an element from the queue.
+   *
+   * The element at the front is popped (removed).
+   *
+   * @return True if there was an element to pop; false otherwise.
+   */
+  bool pop() {
+    if (empty())
+      return false;
+
+    header& h = storage_.modify_header();
+    increment(h.begin);
+    --(h.size);
+    return true;
+  }
+
+  /** Checks whether the queue was modified since the last commit.
+   *
+   * @return True if there are uncommitted changes; false otherwise.
+   */
+  bool dirty() const {
+    return storage_.dirty();
+  }
+
+  /** Makes the queue's modifications persistent.
+   *
+   * Modified elements are written back to storage, followed by the queue's
+   * header, and the storage is then committed. This is a no-op if the queue
+   * was not modified since the last commit.
+   *
+   * @return True if the changes were committed, or there was nothing to
+   *         commit; false otherwise.
+   */
+  bool commit() {
+    return storage_.commit();
+  }
+
+private:
+  struct header {
+    uint32_t signature;
+    unsigned begin;
+    unsigned end;
+    size_type size;
+  };
+
+  static constexpr uint32_t SIGNATURE {
+    persistent_signature(persistent_kind::cached_queue, sizeof(value_type),
+        persistent_schema<value_type>::version)
+  };
+
+  typedef eeprom_cached_storage<header, value_type, Lines, Backend>
+      storage_type;
+
+  const size_type capacity_;
+  storage_type storage_;
+
+  void increment(unsigned& idx) const {
+    if (++idx == capacity_)
+      idx = 0;
+  }
+
+  cached_persistent_queue() = delete;
+
+  cached_persistent_queue(const cached_persistent_queue& other) = delete;
+  cached_persistent_queue& operator=(const cached_persistent_queue& other) = delete;
+
+  cached_persistent_queue(cached_persistent_queue&& other) = delete;
+  cached_persistent_queue& operator=(cached_persistent_queue&& other) = delete;
+};
+
+#endif // CACHED_PERSISTENT_QUEUE
@@ -0,0 +1,211 @@
+#ifndef CACHED_PERSISTENT_VECTOR
+#define CACHED_PERSISTENT_VECTOR
+
+#include "eeprom_cache.h"
+#include "persistent_signature.h"
+#include "persistent_traits.h"
+
+/** This class implements a fixed-size vector cached in RAM.
+ *
+ * The vector works like persistent_vector, but it does not need
+ * the storage to be mapped in memory, so it also works on AVR and with
+ * external memories. The vector's header and a window of elements are kept
+ * in RAM; the storage is only written when commit() is called or when a
+ * modified element is evicted from the cache.
+ *
+ * Unlike persistent_vector, the header is kept in a single copy, without a
+ * sequence number nor a CRC: a commit interrupted by a power loss may leave
+ * the header torn, and a size that does not fit the capacity resets the
+ * vector, rather than falling back to the previous commit. The vector does
+ * not take part in a persistent_transaction either; commit() always commits
+ * the storage right away.
+ *
+ * @tparam T Element type.
+ * @tparam Lines Number of elements kept in RAM.
+ * @tparam Backend Storage backend (see eeprom_backend).
+ */
+template<class T, size_t Lines, class Backend = eeprom_backend>
+class cached_persistent_vector {
+public:
+  typedef T value_type;
+  typedef size_t size_type;
+  typedef Backend backend_type;
+  typedef value_type& reference;
+  typedef const value_type& const_reference;
+
+  static_assert(persistent_storable<value_type>::value,
+      "the element type must be trivially copyable");
+
+  /** Constructor.
+   *
+   * @param offset Offset from the storage's base address.
+   * @param capacity Vector's capacity (in elements).
+   */
+  cached_persistent_vector(int offset, size_type capacity)
+    : capacity_{capacity}
+    , storage_{static_cast<size_type>(offset)}
+  {
+    const header& h = storage_.header();
+    if (h.signature != SIGNATURE || h.size > capacity_) {
+      header& reset = storage_.modify_header();
+      reset.signature = SIGNATURE;
+      reset.size = 0;
+    }
+  }
+
+  /**
+   * Computes the necessary storage size to hold a vector of the given capacity.
+   *
+   * @param capacity Vector's capacity (in elements).
+   */
+  static constexpr size_type storage_size(size_type capacity) {
+    return storage_type::storage_size(capacity);
+  }
+
+  /** Checks whether the vector is empty.
+   *
+   * @return True if the vector is empty; false otherwise.
+   */
+  bool empty() const {
+    return size() == 0;
+  }
+
+  /** Checks whether the vector is full.
+   *
+   * @return True if the vector is full; false otherwise.
+   */
+  bool full() const {
+    return size() == capacity();
+  }
+
+  /** Returns the vector's size.
+   *
+   * The size correspond to the number of elements currently in the vector.
+   *
+   * @return The vector's size.
+   */
+  size_type size() const {
+    return storage_.header().size;
+  }
+
+  /** Returns the vector's capacity.
+   *
+   * The capacity correspond to the maximum number of elements that the vector
+   * can store.
+   *
+   * @return The vector's capacity.
+   */
+  size_type capacity() const {
+    return capacity_;
+  }
+
+  /** Returns an element given its position in the vector.
+   *
+   * The element is marked as modified, as it can be written through the
+   * returned reference.
+   *
+   * @param pos The position or index of the element to retrieve.
+   * @return A reference to the element, valid until the vector is accessed
+   *         again.
+   */
+  reference operator[](size_type pos) {
+    return storage_.elements().modify(pos);
+  }
+
+  /** Returns an element given its position in the vector.
+   *
+   * @param pos The position or index of the element to retrieve.
+   * @return A constant reference to the element, valid until the vector is
+   *         accessed again.
+   */
+  const_reference operator[](size_type pos) const {
+    return storage_.elements().load(pos);
+  }
+
+  /** Pushes an element into the vector.
+   *
+   * The element is pushed at the end of the vector.
+   *
+   * @param value The element to be pushed.
+   * @return True if the element was insterted; false otherwise.
+   */
+  bool push_back(const value_type& value) {
+    if (full())
+      return false;
+
+    header& h = storage_.modify_header();
+    storage_.elements().store(h.size, value);
+    ++(h.size);
+    return true;
+  }
+
+  /** Pops an element from the vector.
+   *
+   * The element at the end is popped (removed).
+   *
+   * @return True if there was an element to pop; false otherwise.
+   */
+  bool pop_back() {
+    if (empty())
+      return false;
+
+    --(storage_.modify_header().size);
+    return true;
+  }
+
+  /** Removes all the elements from the vector. */
+  void clear() {
+    if (empty())
+      return;
+
+    storage_.modify_header().size = 0;
+  }
+
+  /** Checks whether the vector was modified since the last commit.
+   *
+   * @return True if there are uncommitted changes; false otherwise.
+   */
+  bool dirty() const {
+    return storage_.dirty();
+  }
+
+  /** Makes the vector's modifications persistent.
+   *
+   * Modified elements are written back to storage, followed by the vector's
+   * header, and the storage is then committed. This is a no-op if the vector
+   * was not modified since the last commit.
+   *
+   * @return True if the changes were committed, or there was nothing to
+   *         commit; false otherwise.
+   */
+  bool commit() {
+    return storage_.commit();
+  }
+
+private:
+  struct header {
+    uint32_t signature;
+    size_type size;
+  };
+
+  static constexpr uint32_t SIGNATURE {
+    persistent_signature(persistent_kind::cached_vector, sizeof(value_type),
+        persistent_schema<value_type>::version)
+  };
+
+  typedef eeprom_cached_storage<header, value_type, Lines, Backend>
+      storage_type;
+
+  const size_type capacity_;
+  storage_type storage_;
+
+  cached_persistent_vector() = delete;
+
+  cached_persistent_vector(const cached_persistent_vector& other) = delete;
+  cached_persistent_vector& operator=(const cached_persistent_vector& other) = delete;
+
+  cached_persistent_vector(cached_persistent_vector&& other) = delete;
+  cached_persistent_vector& operator=(cached_persistent_vector&& other) = delete;
+};
+
+#endif // CACHED_PERSISTENT_VECTOR
@@ -0,0 +1,75 @@
+#ifndef CRC_CHECKED
+#define CRC_CHECKED
+
+#include "persistent_crc.h"
+
+/** This class stores an element along with its CRC.
+ *
+ * Wrapping the element type of a container (e.g.,
+ * persistent_queue<crc_checked<sample>>) adds a CRC-16 to every element. The
+ * CRC is computed when the element is stored and only checked when the
+ * element is read, so corruption is detected without scanning the container
+ * at boot. The CRC covers the element's bytes, including any padding.
+ *
+ * @tparam T Element type.
+ */
+template<class T>
+class crc_checked {
+public:
+  typedef T value_type;
+
+  /** Constructor.
+   *
+   * The element is left uninitialized, so it is not valid.
+   */
+  crc_checked() = default;
+
+  /** Constructor.
+   *
+   * @param value The element to store.
+   */
+  crc_checked(const value_type& value)
+    : value_(value)
+    , crc_{crc(value_)}
+  {}
+
+  /** Checks whether the element matches its CRC.
+   *
+   * @return True if the element is valid; false if it is corrupted.
+   */
+  bool valid() const {
+    return crc_ == crc(value_);
+  }
+
+  /** Returns the element, without checking it.
+   *
+   * @return A constant reference to the element.
+   */
+  const value_type& value() const {
+    return value_;
+  }
+
+  /** Copies the element if it matches its CRC.
+   *
+   * @param value Where the element is copied.
+   * @return True if the element is valid; false if it is corrupted, in which
+   *         case value is not modified.
+   */
+  bool get(value_type& value) const {
+    if (!valid())
+      return false;
+
+    value = value_;
+    return true;
+  }
+
+private:
+  value_type value_;
+  uint16_t crc_;
+
+  static uint16_t crc(const value_type& value) {
+    return persistent_crc16(&value, sizeof(value));
+  }
+};
+
+#endif // CRC_CHECKED
@@ -0,0 +1,299 @@
+#ifndef DIRTY_RANGE
+#define DIRTY_RANGE
+
+#include <stddef.h>
+
+#include "persistent_stats.h"
+
+struct persistent_no_lock;
+
+/** This class keeps track of the storage bytes modified by a container.
+ *
+ * The range is expressed as offsets from the storage's base address, and it
+ * grows to cover every byte marked since the last commit. Committing calls
+ * the commit function of the container's storage backend. Containers that
+ * need to update their storage right before it is committed (e.g., to write
+ * a header) can register a commit hook.
+ *
+ * While a persistent_transaction is open, dirty ranges enlist themselves in
+ * it and commits are deferred until the transaction ends.
+ */
+class dirty_range {
+public:
+  typedef size_t size_type;
+  typedef bool (*commit_function)();
+  typedef void (*commit_hook)(void* context, bool committed);
+
+  /** Constructor.
+   *
+   * The range is initially empty (clean).
+   *
+   * @param function Function that commits the storage (e.g.,
+   *                 persistent_commit<eeprom_backend>).
+   * @param hook Function called before the storage is committed (with
+   *             committed set to false), and again once the commit succeeds
+   *             (with committed set to true). It may mark further bytes.
+   * @param context Argument passed to the hook (e.g., the container).
+   */
+  explicit dirty_range(commit_function function, commit_hook hook = nullptr,
+      void* context = nullptr)
+    : commit_{function}
+    , hook_{hook}
+    , context_{context}
+    , begin_{0}
+    , end_{0}
+    , next_{nullptr}
+    , enlisted_{false}
+  {}
+
+  /** Destructor.
+   *
+   * The range is withdrawn from the open transaction, if any.
+   */
+  ~dirty_range() {
+    if (enlisted_)
+      withdraw();
+  }
+
+  /** Checks whether any byte was modified since the last commit.
+   *
+   * @return True if the range is not empty; false otherwise.
+   */
+  bool dirty() const {
+    return begin_ != end_;
+  }
+
+  /** Returns the offset of the first modified byte.
+   *
+   * @return The offset of the first modified byte.
+   */
+  size_type begin() const {
+    return begin_;
+  }
+
+  /** Returns the offset past the last modified byte.
+   *
+   * @return The offset past the last modified byte.
+   */
+  size_type end() const {
+    return end_;
+  }
+
+  /** Extends the range to cover the given bytes.
+   *
+   * @param offset Offset from the storage's base address.
+   * @param length Number of bytes modified.
+   */
+  void mark(size_type offset, size_type length) {
+    if (length == 0)
+      return;
+
+    if (transaction_depth() > 0 && !enlisted_)
+      enlist();
+
+    if (!dirty()) {
+      begin_ = offset;
+      end_ = offset + length;
+      return;
+    }
+
+    if (offset < begin_)
+      begin_ = offset;
+    if (offset + length > end_)
+      end_ = offset + length;
+  }
+
+  /** Returns the statistics of the range's container.
+   *
+   * @return A reference to the statistics.
+   */
+  persistent_stats& stats() {
+    return stats_;
+  }
+
+  /** Returns the statistics of the range's container.
+   *
+   * @return A constant reference to the statistics.
+   */
+  const persistent_stats& stats() const {
+    return stats_;
+  }
+
+  /** Empties the range. */
+  void clear() {
+    begin_ = 0;
+    end_ = 0;
+  }
+
+  /** Commits the storage if the range is not empty.
+   *
+   * The range is cleared once the commit succeeds. If a transaction is open,
+   * the commit is deferred until the transaction ends.
+   *
+   * @return True if the changes were committed (or deferred), or there was
+   *         nothing to commit; false otherwise.
+   */
+  bool commit() {
+    stats_.count_commit_request();
+    if (!dirty())
+      return true;
+
+    // The range may have been marked before the transaction was opened.
+    if (transaction_depth() > 0) {
+      if (!enlisted_)
+        enlist();
+      return true;
+    }
+
+    notify(false);
+    if (!commit_())
+      return false;
+
+    notify(true);
+    stats_.count_commit();
+    clear();
+    return true;
+  }
+
+  /** Commits the storage if the range is not empty, for a container shared
+   * between several contexts.
+   *
+   * The hook is called and the range is taken with the lock held, but the
+   * storage is committed after releasing it, so other contexts can keep
+   * modifying the container meanwhile. Bytes marked during the commit are
+   * left for the next one; if the commit fails, the range taken is marked
+   * again.
+   *
+   * @param lock The container's lock.
+   * @return True if the changes were committed (or deferred), or there was
+   *         nothing to commit; false otherwise.
+   */
+  template<class Lock>
+  bool commit(Lock& lock) {
+    lock.lock();
+    stats_.count_commit_request();
+    if (!dirty() || transaction_depth() > 0) {
+      if (dirty() && !enlisted_)
+        enlist();
+      lock.unlock();
+      return true;
+    }
+
+    notify(false);
+    const size_type begin = begin_;
+    const size_type end = end_;
+    clear();
+    lock.unlock();
+
+    const bool committed = commit_();
+
+    lock.lock();
+    if (committed) {
+      notify(true);
+      stats_.count_commit();
+    } else {
+      mark(begin, end - begin);
+    }
+    lock.unlock();
+    return committed;
+  }
+
+  /** Commits the storage if the range is not empty (see commit()).
+   *
+   * @return True if the changes were committed (or deferred), or there was
+   *         nothing to commit; false otherwise.
+   */
+  bool commit(persistent_no_lock&) {
+    return commit();
+  }
+
+private:
+  friend class persistent_transaction;
+
+  const commit_function commit_;
+  const commit_hook hook_;
+  void* const context_;
+  size_type begin_;
+  size_type end_;
+  dirty_range* next_;
+  bool enlisted_;
+  persistent_stats stats_;
+
+  static unsigned& transaction_depth() {
+    static unsigned depth = 0;
+    return depth;
+  }
+
+  static dirty_range*& enlisted_head() {
+    static dirty_range* head = nullptr;
+    return head;
+  }
+
+  void notify(bool committed) {
+    if (hook_ != nullptr)
+      hook_(context_, committed);
+  }
+
+  void enlist() {
+    next_ = enlisted_head();
+    enlisted_head() = this;
+    enlisted_ = true;
+  }
+
+  void withdraw() {
+    dirty_range** link = &enlisted_head();
+    while (*link != this)
+      link = &(*link)->next_;
+    *link = next_;
+    next_ = nullptr;
+    enlisted_ = false;
+  }
+
+  /** Commits every enlisted range.
+   *
+   * Each storage backend is committed once, no matter how many of its
+   * ranges are enlisted. Ranges are withdrawn from the transaction
+   * regardless of the result, and they are only cleared if their backend's
+   * commit succeeds.
+   */
+  static bool commit_enlisted() {
+    bool result = true;
+
+    while (enlisted_head() != nullptr) {
+      const commit_function commit = enlisted_head()->commit_;
+
+      bool any_dirty = false;
+      for (dirty_range* r = enlisted_head(); r != nullptr; r = r->next_) {
+        if (r->commit_ == commit && r->dirty()) {
+          r->notify(false);
+          any_dirty = true;
+        }
+      }
+
+      const bool committed = !any_dirty || commit();
+      result = result && committed;
+
+      dirty_range** link = &enlisted_head();
+      while (*link != nullptr) {
+        dirty_range* r = *link;
+        if (r->commit_ != commit) {
+          link = &r->next_;
+          continue;
+        }
+
+        *link = r->next_;
+        r->next_ = nullptr;
+        r->enlisted_ = false;
+        if (committed && r->dirty()) {
+          r->notify(true);
+          r->stats_.count_commit();
+          r->clear();
+        }
+      }
+    }
+
+    return result;
+  }
+};
+
+#endif // DIRTY_RANGE
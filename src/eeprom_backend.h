@@ -0,0 +1,103 @@
+#ifndef EEPROM_BACKEND
+#define EEPROM_BACKEND
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <EEPROM.h>
+
+/** This class implements a storage backend on top of the EEPROM.
+ *
+ * A storage backend provides static read(), write() and commit() functions
+ * to access the persistent storage, with offsets relative to the storage's
+ * base address. Backends whose contents are mapped in RAM also provide a
+ * data() function returning a pointer to them; persistent_queue and
+ * persistent_vector require it, while the cached containers do not.
+ *
+ * On the ESP8266 and ESP32 the EEPROM is a RAM copy of a flash sector, so
+ * reads and writes are plain copies and commit() writes the sector back to
+ * flash. On AVR every write goes to the EEPROM itself; only the bytes that
+ * change are written, commit() is a no-op, and data() is not available.
+ */
+struct eeprom_backend {
+#if !defined(ARDUINO_ARCH_AVR)
+  /** Returns a pointer to the EEPROM's RAM copy.
+   *
+   * @return A pointer to the EEPROM's first byte.
+   */
+  static uint8_t* data() {
+    return EEPROM.getDataPtr();
+  }
+#endif
+
+  /** Reads data from the EEPROM.
+   *
+   * @param offset Offset from the EEPROM base address.
+   * @param data Buffer where data is stored.
+   * @param size Number of bytes to read.
+   */
+  static void read(size_t offset, void* data, size_t size) {
+#if defined(ARDUINO_ARCH_AVR)
+    uint8_t* bytes = static_cast<uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i)
+      bytes[i] = EEPROM.read(offset + i);
+#else
+    memcpy(data, EEPROM.getDataPtr() + offset, size);
+#endif
+  }
+
+  /** Writes data into the EEPROM.
+   *
+   * @param offset Offset from the EEPROM base address.
+   * @param data Buffer containing the data to write.
+   * @param size Number of bytes to write.
+   */
+  static void write(size_t offset, const void* data, size_t size) {
+#if defined(ARDUINO_ARCH_AVR)
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i)
+      EEPROM.update(offset + i, bytes[i]);
+#else
+    memcpy(EEPROM.getDataPtr() + offset, data, size);
+#endif
+  }
+
+  /** Makes the written data persistent.
+   *
+   * @return True if data was committed; false otherwise.
+   */
+  static bool commit() {
+#if defined(ARDUINO_ARCH_AVR)
+    return true;
+#else
+    // EEPROM.commit() skips the flash write unless the EEPROM is flagged as
+    // dirty, and writing through the data pointer does not flag it.
+    EEPROM.getDataPtr();
+    return EEPROM.commit();
+#endif
+  }
+};
+
+/** This class tells whether a storage backend is mapped in RAM.
+ *
+ * Most containers access their elements in place, through the backend's
+ * data() function; backends without one (e.g., fram_backend and
+ * rtc_memory_backend) only work with the cached containers.
+ *
+ * @tparam Backend Storage backend.
+ */
+template<class Backend>
+struct persistent_mapped {
+private:
+  template<class B>
+  static char test(decltype(B::data())*);
+
+  template<class B>
+  static long test(...);
+
+public:
+  static constexpr bool value = sizeof(test<Backend>(nullptr)) == 1;
+};
+
+#endif // EEPROM_BACKEND
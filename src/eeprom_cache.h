@@ -0,0 +1,242 @@
+#ifndef EEPROM_CACHE
+#define EEPROM_CACHE
+
+#include "eeprom_backend.h"
+
+/** This class implements a write-back cache of persistent elements.
+ *
+ * Elements are stored consecutively from a base offset, and each element is
+ * cached in the line given by its index modulo the number of lines. Reads
+ * are served from RAM once an element is cached, and modified elements are
+ * only written back when their line is evicted or on write_back().
+ *
+ * @tparam T Element type.
+ * @tparam Lines Number of elements kept in RAM.
+ * @tparam Backend Storage backend (see eeprom_backend).
+ */
+template<class T, size_t Lines, class Backend = eeprom_backend>
+class eeprom_cache {
+public:
+  typedef T value_type;
+  typedef size_t size_type;
+
+  static_assert(Lines > 0, "the cache needs at least one line");
+
+  /** Constructor.
+   *
+   * @param offset Offset of the first element from the storage's base
+   *               address.
+   */
+  explicit eeprom_cache(size_type offset)
+    : offset_{offset}
+  {
+    for (auto& l : lines_) {
+      l.valid = false;
+      l.dirty = false;
+    }
+  }
+
+  /** Returns an element, reading it from storage if it is not cached.
+   *
+   * @param idx Index of the element.
+   * @return A reference to the cached element, valid until the next access.
+   */
+  const value_type& load(size_type idx) {
+    return fetch(idx, true).value;
+  }
+
+  /** Returns an element to be modified.
+   *
+   * The element is read from storage if it is not cached, and its line is
+   * marked as dirty.
+   *
+   * @param idx Index of the element.
+   * @return A reference to the cached element, valid until the next access.
+   */
+  value_type& modify(size_type idx) {
+    line& l = fetch(idx, true);
+    l.dirty = true;
+    return l.value;
+  }
+
+  /** Stores an element.
+   *
+   * The element is not read from storage, as it is fully overwritten.
+   *
+   * @param idx Index of the element.
+   * @param value The element's new value.
+   */
+  void store(size_type idx, const value_type& value) {
+    line& l = fetch(idx, false);
+    l.value = value;
+    l.dirty = true;
+  }
+
+  /** Checks whether any cached element was modified.
+   *
+   * @return True if there are elements to write back; false otherwise.
+   */
+  bool dirty() const {
+    for (auto& l : lines_) {
+      if (l.dirty)
+        return true;
+    }
+    return false;
+  }
+
+  /** Writes the modified elements back to storage.
+   *
+   * Elements stay cached after being written.
+   */
+  void write_back() {
+    for (auto& l : lines_) {
+      if (l.dirty) {
+        Backend::write(address(l.index), &l.value, sizeof(value_type));
+        l.dirty = false;
+      }
+    }
+  }
+
+private:
+  struct line {
+    value_type value;
+    size_type index;
+    bool valid;
+    bool dirty;
+  };
+
+  const size_type offset_;
+  line lines_[Lines];
+
+  size_type address(size_type idx) const {
+    return offset_ + idx * sizeof(value_type);
+  }
+
+  line& fetch(size_type idx, bool read) {
+    line& l = lines_[idx % Lines];
+    if (l.valid && l.index == idx)
+      return l;
+
+    if (l.dirty)
+      Backend::write(address(l.index), &l.value, sizeof(value_type));
+    if (read)
+      Backend::read(address(idx), &l.value, sizeof(value_type));
+
+    l.index = idx;
+    l.valid = true;
+    l.dirty = false;
+    return l;
+  }
+};
+
+/** This class implements the cached storage of a container.
+ *
+ * The storage holds the container's header followed by its elements. The
+ * header is read once, on construction, and kept in RAM; the elements go
+ * through an eeprom_cache. commit() writes the modified elements back,
+ * followed by the header, and then commits the storage.
+ *
+ * The header is written in place with a single copy, so a commit interrupted
+ * by a power loss may leave it torn; the container must validate it when it
+ * is constructed.
+ *
+ * @tparam Header Container's header.
+ * @tparam T Element type.
+ * @tparam Lines Number of elements kept in RAM.
+ * @tparam Backend Storage backend (see eeprom_backend).
+ */
+template<class Header, class T, size_t Lines, class Backend = eeprom_backend>
+class eeprom_cached_storage {
+public:
+  typedef Header header_type;
+  typedef eeprom_cache<T, Lines, Backend> cache_type;
+  typedef size_t size_type;
+
+  /** Constructor.
+   *
+   * The header is read from storage.
+   *
+   * @param offset Offset from the storage's base address.
+   */
+  explicit eeprom_cached_storage(size_type offset)
+    : offset_{offset}
+    , elements_{offset + sizeof(header_type)}
+    , header_dirty_{false}
+  {
+    Backend::read(offset_, &header_, sizeof(header_));
+  }
+
+  /**
+   * Computes the storage size of a header followed by the given elements.
+   *
+   * @param count Number of elements.
+   */
+  static constexpr size_type storage_size(size_type count) {
+    return sizeof(header_type) + count * sizeof(T);
+  }
+
+  /** Returns the header.
+   *
+   * @return A constant reference to the header.
+   */
+  const header_type& header() const {
+    return header_;
+  }
+
+  /** Returns the header to be modified.
+   *
+   * The header is marked as dirty.
+   *
+   * @return A reference to the header.
+   */
+  header_type& modify_header() {
+    header_dirty_ = true;
+    return header_;
+  }
+
+  /** Returns the cache of elements.
+   *
+   * @return A reference to the cache.
+   */
+  cache_type& elements() const {
+    return elements_;
+  }
+
+  /** Checks whether the header or an element was modified since the last
+   * commit.
+   *
+   * @return True if there are uncommitted changes; false otherwise.
+   */
+  bool dirty() const {
+    return header_dirty_ || elements_.dirty();
+  }
+
+  /** Makes the modifications persistent.
+   *
+   * Modified elements are written back to storage, followed by the header,
+   * and the storage is then committed. This is a no-op if nothing was
+   * modified since the last commit.
+   *
+   * @return True if the changes were committed, or there was nothing to
+   *         commit; false otherwise.
+   */
+  bool commit() {
+    if (!dirty())
+      return true;
+
+    elements_.write_back();
+    Backend::write(offset_, &header_, sizeof(header_));
+
+    // Keeping the header dirty makes the next commit retry.
+    header_dirty_ = !Backend::commit();
+    return !header_dirty_;
+  }
+
+private:
+  const size_type offset_;
+  mutable cache_type elements_;
+  header_type header_;
+  bool header_dirty_;
+};
+
+#endif // EEPROM_CACHE
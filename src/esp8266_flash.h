@@ -0,0 +1,67 @@
+#ifndef ESP8266_FLASH
+#define ESP8266_FLASH
+
+#include <Arduino.h>
+
+extern "C" {
+#include "spi_flash.h"
+}
+
+/** This class provides raw access to the SPI flash of an ESP8266.
+ *
+ * Flash memory can only be erased in whole sectors, and writing can only
+ * clear bits that are set. Addresses and sizes must be multiples of four
+ * bytes.
+ */
+struct esp8266_flash {
+  /** Returns the size of an erasable sector (in bytes).
+   *
+   * @return The sector size.
+   */
+  static constexpr std::size_t sector_size() {
+    return SPI_FLASH_SEC_SIZE;
+  }
+
+  /** Erases a sector.
+   *
+   * @param sector Index of the sector to erase.
+   * @return True if the sector was erased; false otherwise.
+   */
+  static bool erase(uint32_t sector) {
+    noInterrupts();
+    bool result = spi_flash_erase_sector(sector) == SPI_FLASH_RESULT_OK;
+    interrupts();
+    return result;
+  }
+
+  /** Reads data from flash.
+   *
+   * @param address Flash address to read from.
+   * @param data Buffer where data is stored.
+   * @param size Number of bytes to read.
+   * @return True if data was read; false otherwise.
+   */
+  static bool read(uint32_t address, uint32_t* data, std::size_t size) {
+    noInterrupts();
+    bool result = spi_flash_read(address, data, size) == SPI_FLASH_RESULT_OK;
+    interrupts();
+    return result;
+  }
+
+  /** Writes data into flash.
+   *
+   * @param address Flash address to write to.
+   * @param data Buffer containing the data to write.
+   * @param size Number of bytes to write.
+   * @return True if data was written; false otherwise.
+   */
+  static bool write(uint32_t address, const uint32_t* data, std::size_t size) {
+    noInterrupts();
+    bool result = spi_flash_write(
+        address, const_cast<uint32_t*>(data), size) == SPI_FLASH_RESULT_OK;
+    interrupts();
+    return result;
+  }
+};
+
+#endif // ESP8266_FLASH
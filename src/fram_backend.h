@@ -0,0 +1,79 @@
+#ifndef FRAM_BACKEND
+#define FRAM_BACKEND
+
+#include <Arduino.h>
+#include <Wire.h>
+
+/** This class implements a storage backend on an I2C FRAM chip.
+ *
+ * FRAM chips such as the MB85RC series are byte-addressable and have no
+ * write cost, so commit() does nothing. Wire.begin() must be called before
+ * using the backend.
+ *
+ * @tparam Address The chip's I2C address.
+ */
+template<uint8_t Address = 0x50>
+struct fram_backend {
+  /** Reads data from the FRAM.
+   *
+   * @param offset Offset from the FRAM base address.
+   * @param data Buffer where data is stored.
+   * @param size Number of bytes to read.
+   */
+  static void read(size_t offset, void* data, size_t size) {
+    uint8_t* bytes = static_cast<uint8_t*>(data);
+    while (size > 0) {
+      const size_t count = size < CHUNK_SIZE ? size : CHUNK_SIZE;
+
+      Wire.beginTransmission(Address);
+      Wire.write(static_cast<uint8_t>(offset >> 8));
+      Wire.write(static_cast<uint8_t>(offset));
+      Wire.endTransmission(false);
+
+      Wire.requestFrom(Address, static_cast<uint8_t>(count));
+      for (size_t i = 0; i < count; ++i)
+        bytes[i] = Wire.read();
+
+      bytes += count;
+      offset += count;
+      size -= count;
+    }
+  }
+
+  /** Writes data into the FRAM.
+   *
+   * @param offset Offset from the FRAM base address.
+   * @param data Buffer containing the data to write.
+   * @param size Number of bytes to write.
+   */
+  static void write(size_t offset, const void* data, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    while (size > 0) {
+      const size_t count = size < CHUNK_SIZE ? size : CHUNK_SIZE;
+
+      Wire.beginTransmission(Address);
+      Wire.write(static_cast<uint8_t>(offset >> 8));
+      Wire.write(static_cast<uint8_t>(offset));
+      Wire.write(bytes, count);
+      Wire.endTransmission();
+
+      bytes += count;
+      offset += count;
+      size -= count;
+    }
+  }
+
+  /** Does nothing, as writes are immediately effective.
+   *
+   * @return Always true.
+   */
+  static bool commit() {
+    return true;
+  }
+
+private:
+  // Wire buffers are 32 bytes long on AVR, two of which hold the address.
+  static constexpr size_t CHUNK_SIZE { 16 };
+};
+
+#endif // FRAM_BACKEND
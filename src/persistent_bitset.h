@@ -0,0 +1,290 @@
+#ifndef PERSISTENT_BITSET
+#define PERSISTENT_BITSET
+
+#include "dirty_range.h"
+#include "eeprom_backend.h"
+#include "persistent_signature.h"
+
+/** This class implements a fixed-size sequence of bits.
+ *
+ * Bits are packed into 32-bit words, and only the words that actually change
+ * are marked as modified, so flipping a flag dirties four bytes at most.
+ * Bulk operations work a word at a time.
+ *
+ * Modifications are only made to the storage's RAM copy. They become
+ * persistent once commit() is called, so several operations can be grouped
+ * into a single flash write.
+ *
+ * @tparam N Number of bits.
+ * @tparam Backend Storage backend mapped in RAM (see eeprom_backend).
+ */
+template<size_t N, class Backend = eeprom_backend>
+class persistent_bitset {
+public:
+  typedef size_t size_type;
+  typedef Backend backend_type;
+
+  static_assert(N > 0, "the bitset needs at least one bit");
+  static_assert(persistent_mapped<Backend>::value,
+      "the backend must be mapped in RAM; use a cached container instead");
+
+  /** Constructor.
+   *
+   * All the bits are cleared if the storage does not hold a bitset of the
+   * same size.
+   *
+   * @param offset Offset from the storage's base address (a multiple of
+   *               persistent_max_align()).
+   */
+  explicit persistent_bitset(int offset)
+    : offset_{static_cast<size_type>(offset)}
+    , dirty_{&persistent_commit<Backend>}
+  {
+    uint8_t* data = Backend::data() + offset;
+    storage_ = reinterpret_cast<storage_area*>(data);
+
+    if (storage_->signature != SIGNATURE) {
+      storage_->signature = SIGNATURE;
+      storage_->reserved = 0;
+      dirty_.mark(offset_, sizeof(storage_area));
+      dirty_.stats().count_header_write();
+      for (size_type w = 0; w < WORDS; ++w)
+        storage_->words()[w] = 0;
+      mark_words(0, WORDS);
+    }
+  }
+
+  /**
+   * Computes the necessary storage size to hold the bitset.
+   */
+  static constexpr size_type storage_size() {
+    return sizeof(storage_area) + WORDS * sizeof(uint32_t);
+  }
+
+  /** Returns the number of bits.
+   *
+   * @return The number of bits.
+   */
+  static constexpr size_type size() {
+    return N;
+  }
+
+  /** Returns the value of a bit.
+   *
+   * @param pos Position of the bit.
+   * @return True if the bit is set; false otherwise.
+   */
+  bool test(size_type pos) const {
+    return (storage_->words()[pos / WORD_BITS] & bit(pos)) != 0;
+  }
+
+  /** Sets a bit to the given value.
+   *
+   * @param pos Position of the bit.
+   * @param value The bit's new value.
+   */
+  void set(size_type pos, bool value = true) {
+    const size_type w = pos / WORD_BITS;
+    const uint32_t word = value
+        ? storage_->words()[w] | bit(pos)
+        : storage_->words()[w] & ~bit(pos);
+    store(w, word);
+  }
+
+  /** Sets all the bits. */
+  void set() {
+    for (size_type w = 0; w < WORDS; ++w)
+      store(w, word_mask(w));
+  }
+
+  /** Clears a bit.
+   *
+   * @param pos Position of the bit.
+   */
+  void reset(size_type pos) {
+    set(pos, false);
+  }
+
+  /** Clears all the bits. */
+  void reset() {
+    for (size_type w = 0; w < WORDS; ++w)
+      store(w, 0);
+  }
+
+  /** Toggles a bit.
+   *
+   * @param pos Position of the bit.
+   */
+  void flip(size_type pos) {
+    const size_type w = pos / WORD_BITS;
+    store(w, storage_->words()[w] ^ bit(pos));
+  }
+
+  /** Returns the number of bits that are set.
+   *
+   * @return The number of bits set.
+   */
+  size_type count() const {
+    size_type result = 0;
+    for (size_type w = 0; w < WORDS; ++w)
+      result += __builtin_popcountl(storage_->words()[w]);
+    return result;
+  }
+
+  /** Checks whether all the bits are set.
+   *
+   * @return True if all the bits are set; false otherwise.
+   */
+  bool all() const {
+    for (size_type w = 0; w < WORDS; ++w) {
+      if (storage_->words()[w] != word_mask(w))
+        return false;
+    }
+    return true;
+  }
+
+  /** Checks whether any bit is set.
+   *
+   * @return True if at least one bit is set; false otherwise.
+   */
+  bool any() const {
+    return find_first() != N;
+  }
+
+  /** Checks whether no bit is set.
+   *
+   * @return True if all the bits are cleared; false otherwise.
+   */
+  bool none() const {
+    return !any();
+  }
+
+  /** Returns the position of the first bit that is set.
+   *
+   * @return The position of the first bit set, or size() if none is set.
+   */
+  size_type find_first() const {
+    return find_next(0);
+  }
+
+  /** Returns the position of the first bit set from a given position.
+   *
+   * @param pos The position to start from (included).
+   * @return The position of the first bit set at or after pos, or size() if
+   *         there is none.
+   */
+  size_type find_next(size_type pos) const {
+    while (pos < N) {
+      const size_type w = pos / WORD_BITS;
+      const uint32_t bits = storage_->words()[w] & ~(bit(pos) - 1);
+      if (bits != 0)
+        return w * WORD_BITS + __builtin_ctzl(bits);
+      pos = (w + 1) * WORD_BITS;
+    }
+    return N;
+  }
+
+  /** Checks whether the bitset was modified since the last commit.
+   *
+   * @return True if there are uncommitted changes; false otherwise.
+   */
+  bool dirty() const {
+    return dirty_.dirty();
+  }
+
+  /** Makes the bitset's modifications persistent.
+   *
+   * The storage backend is only committed if the bitset was modified since
+   * the last commit; otherwise, this is a no-op.
+   *
+   * @return True if the changes were committed, or there was nothing to
+   *         commit; false otherwise.
+   */
+  bool commit() {
+    return dirty_.commit();
+  }
+
+#if defined(PERSISTENT_CONTAINERS_STATS)
+  /** Returns the bitset's statistics.
+   *
+   * Only available if PERSISTENT_CONTAINERS_STATS is defined. Each modified
+   * word counts as an element write.
+   *
+   * @return A constant reference to the statistics.
+   */
+  const persistent_stats& stats() const {
+    return dirty_.stats();
+  }
+
+  /** Returns the estimated erase cycles of the flash backing the bitset.
+   *
+   * This is the number of commits issued to the storage backend since boot,
+   * by any container. Only available if PERSISTENT_CONTAINERS_STATS is
+   * defined.
+   *
+   * @return The estimated erase cycles.
+   */
+  unsigned long estimated_erase_cycles() const {
+    return backend_commits<Backend>();
+  }
+#endif
+
+private:
+  struct storage_area {
+    uint16_t signature;
+    uint16_t reserved;
+
+    uint32_t* words() {
+      uint8_t* ptr_to_data = reinterpret_cast<uint8_t*>(this) + sizeof(*this);
+      return reinterpret_cast<uint32_t*>(ptr_to_data);
+    }
+  };
+
+  static constexpr size_type WORD_BITS { 32 };
+  static constexpr size_type WORDS { (N + WORD_BITS - 1) / WORD_BITS };
+
+  static constexpr uint16_t SIGNATURE {
+    persistent_signature16(persistent_kind::bitset, N, 0)
+  };
+
+  const size_type offset_;
+  storage_area* storage_;
+  dirty_range dirty_;
+
+  static uint32_t bit(size_type pos) {
+    return uint32_t(1) << (pos % WORD_BITS);
+  }
+
+  /** Returns the bits of a word that correspond to actual bits. */
+  static uint32_t word_mask(size_type w) {
+    return w + 1 < WORDS || N % WORD_BITS == 0
+        ? ~uint32_t(0)
+        : (uint32_t(1) << (N % WORD_BITS)) - 1;
+  }
+
+  /** Writes a word, marking it only if its value changes. */
+  void store(size_type w, uint32_t word) {
+    if (storage_->words()[w] == word)
+      return;
+
+    storage_->words()[w] = word;
+    mark_words(w, 1);
+  }
+
+  void mark_words(size_type w, size_type count) {
+    dirty_.mark(
+        offset_ + sizeof(storage_area) + w * sizeof(uint32_t),
+        count * sizeof(uint32_t));
+    dirty_.stats().count_element_writes(count);
+  }
+
+  persistent_bitset() = delete;
+
+  persistent_bitset(const persistent_bitset& other) = delete;
+  persistent_bitset& operator=(const persistent_bitset& other) = delete;
+
+  persistent_bitset(persistent_bitset&& other) = delete;
+  persistent_bitset& operator=(persistent_bitset&& other) = delete;
+};
+
+#endif // PERSISTENT_BITSET
@@ -0,0 +1,402 @@
+#ifndef PERSISTENT_BLOB_QUEUE
+#define PERSISTENT_BLOB_QUEUE
+
+#include "dirty_range.h"
+#include "eeprom_backend.h"
+#include "persistent_header.h"
+#include "persistent_signature.h"
+
+/** This class implements a circular queue of variable-length records.
+ *
+ * Each record is stored as a 16-bit length followed by its bytes, back to
+ * back in a circular buffer of bytes, so records of different lengths (e.g.,
+ * strings or message payloads) take no padding. The capacity is given in
+ * bytes, and it includes the length of every record.
+ *
+ * A record is never split at the end of the buffer: if it does not fit in
+ * the bytes left before the end, those bytes are skipped (a length of 0xffff
+ * marks them, if there is room for it) and the record is stored at the
+ * start. front() thus returns a record's bytes in place.
+ *
+ * Modifications are only made to the storage's RAM copy. They become
+ * persistent once commit() is called, so several operations can be grouped
+ * into a single flash write.
+ *
+ * The queue's header is double-buffered (see persistent_header).
+ *
+ * @tparam Backend Storage backend mapped in RAM (see eeprom_backend).
+ */
+template<class Backend = eeprom_backend>
+class persistent_blob_queue {
+public:
+  typedef std::size_t size_type;
+  typedef Backend backend_type;
+
+  static_assert(persistent_mapped<Backend>::value,
+      "the backend must be mapped in RAM; use a cached container instead");
+
+  /** Contiguous sequence of bytes stored in the queue. */
+  struct const_span {
+    const uint8_t* data;
+    size_type size;
+  };
+
+  /** Constructor.
+   *
+   * @param offset Offset from the storage's base address (a multiple of
+   *               persistent_max_align()).
+   * @param capacity Queue's capacity (in bytes, including the records'
+   *                 lengths).
+   */
+  persistent_blob_queue(int offset, size_type capacity)
+    : capacity_{capacity}
+    , offset_{static_cast<size_type>(offset)}
+    , header_{Backend::data() + offset, SIGNATURE}
+    , data_{Backend::data() + offset + header_type::storage_size()}
+    , header_changed_{false}
+    , dirty_{&persistent_commit<Backend>, &persistent_blob_queue::on_commit,
+          this}
+  {
+    if (!header_.load(fields_)
+        || fields_.begin >= capacity_
+        || fields_.end >= capacity_
+        || fields_.used > capacity_
+        || (fields_.begin + fields_.used) % capacity_ != fields_.end
+        || (fields_.size == 0) != (fields_.used == 0)) {
+      reset();
+      mark_header();
+    }
+  }
+
+  /**
+   * Computes the necessary storage size to hold a queue of the given capacity.
+   *
+   * @param capacity Queue's capacity (in bytes).
+   */
+  static constexpr size_type storage_size(size_type capacity) {
+    return header_type::storage_size() + capacity;
+  }
+
+  /** Returns the size of the longest record that fits in an empty queue.
+   *
+   * @return The maximum record size (in bytes).
+   */
+  size_type max_record_size() const {
+    const size_type size = capacity_ - LENGTH_SIZE;
+    return size < SKIP ? size : SKIP - 1;
+  }
+
+  /** Checks whether the queue is empty.
+   *
+   * @return True if the queue is empty; false otherwise.
+   */
+  bool empty() const {
+    return size() == 0;
+  }
+
+  /** Returns the queue's size.
+   *
+   * @return The number of records currently in the queue.
+   */
+  size_type size() const {
+    return fields_.size;
+  }
+
+  /** Returns the queue's capacity.
+   *
+   * @return The queue's capacity (in bytes).
+   */
+  size_type capacity() const {
+    return capacity_;
+  }
+
+  /** Returns the number of bytes taken by the records.
+   *
+   * This includes the records' lengths, and the bytes skipped at the end of
+   * the buffer.
+   *
+   * @return The number of bytes in use.
+   */
+  size_type bytes_used() const {
+    return fields_.used;
+  }
+
+  /** Returns the record at the queue's front.
+   *
+   * @return The record's bytes (an empty span if the queue is empty).
+   */
+  const_span front() const {
+    if (empty())
+      return { data_, 0 };
+    return { &data_[fields_.begin + LENGTH_SIZE], length(fields_.begin) };
+  }
+
+  /** Pushes a record into the queue.
+   *
+   * The record is pushed at the end of the queue.
+   *
+   * @param data Pointer to the record's bytes.
+   * @param size Record's size (in bytes).
+   * @return True if the record was inserted; false if it did not fit in the
+   *         remaining capacity.
+   */
+  bool push(const void* data, size_type size) {
+    if (size > max_record_size() || !fits(size)) {
+      dirty_.stats().count_rejected_push();
+      return false;
+    }
+
+    append(data, size);
+    return true;
+  }
+
+  /** Pushes a record into the queue, dropping the oldest ones if needed.
+   *
+   * Records at the front are popped until the new record fits, so that the
+   * queue keeps the most recent records.
+   *
+   * @param data Pointer to the record's bytes.
+   * @param size Record's size (in bytes).
+   * @return True if some record was dropped; false otherwise.
+   */
+  bool push_overwrite(const void* data, size_type size) {
+    if (size > max_record_size()) {
+      dirty_.stats().count_rejected_push();
+      return false;
+    }
+
+    bool dropped = false;
+    while (!fits(size)) {
+      pop_front();
+      dropped = true;
+    }
+
+    append(data, size);
+    return dropped;
+  }
+
+  /** Pops a record from the queue.
+   *
+   * The record at the front is popped (removed).
+   *
+   * @return True if there was a record to pop; false otherwise.
+   */
+  bool pop() {
+    if (empty())
+      return false;
+
+    pop_front();
+    mark_header();
+    return true;
+  }
+
+  /** Pops several records from the queue.
+   *
+   * The records at the front are popped (removed). The queue's header is
+   * updated only once.
+   *
+   * @param count Number of records to pop.
+   * @return The number of records popped, which is lower than count if the
+   *         queue did not have enough records.
+   */
+  size_type pop(size_type count) {
+    if (count > size())
+      count = size();
+    if (count == 0)
+      return 0;
+
+    for (size_type i = 0; i < count; ++i)
+      pop_front();
+    mark_header();
+    return count;
+  }
+
+  /** Checks whether the queue was modified since the last commit.
+   *
+   * @return True if there are uncommitted changes; false otherwise.
+   */
+  bool dirty() const {
+    return dirty_.dirty();
+  }
+
+  /** Makes the queue's modifications persistent.
+   *
+   * The storage backend is only committed if the queue was modified since
+   * the last commit; otherwise, this is a no-op.
+   *
+   * @return True if the changes were committed, or there was nothing to
+   *         commit; false otherwise.
+   */
+  bool commit() {
+    return dirty_.commit();
+  }
+
+#if defined(PERSISTENT_CONTAINERS_STATS)
+  /** Returns the queue's statistics.
+   *
+   * Only available if PERSISTENT_CONTAINERS_STATS is defined.
+   *
+   * @return A constant reference to the statistics.
+   */
+  const persistent_stats& stats() const {
+    return dirty_.stats();
+  }
+
+  /** Returns the estimated erase cycles of the flash backing the queue.
+   *
+   * This is the number of commits issued to the storage backend since boot,
+   * by any container. Only available if PERSISTENT_CONTAINERS_STATS is
+   * defined.
+   *
+   * @return The estimated erase cycles.
+   */
+  unsigned long estimated_erase_cycles() const {
+    return backend_commits<Backend>();
+  }
+#endif
+
+private:
+  // used counts the records' bytes and lengths, and the bytes skipped at
+  // the end of the buffer between begin and end.
+  struct header_fields {
+    unsigned begin;
+    unsigned end;
+    size_type used;
+    size_type size;
+  };
+
+  typedef persistent_header<header_fields> header_type;
+
+  static constexpr unsigned SIGNATURE {
+    persistent_signature(persistent_kind::blob_queue, 1, 0)
+  };
+
+  static constexpr size_type LENGTH_SIZE { sizeof(uint16_t) };
+  static constexpr size_type SKIP { 0xffff };
+
+  const size_type capacity_;
+  const size_type offset_;
+  header_type header_;
+  header_fields fields_;
+  uint8_t* const data_;
+  bool header_changed_;
+  dirty_range dirty_;
+
+  /** Writes the header before the storage is committed. */
+  static void on_commit(void* context, bool committed) {
+    persistent_blob_queue* queue =
+        static_cast<persistent_blob_queue*>(context);
+    if (!queue->header_changed_)
+      return;
+
+    if (committed) {
+      queue->header_.committed();
+      queue->header_changed_ = false;
+    } else {
+      queue->header_.stage(queue->fields_);
+    }
+  }
+
+  void reset() {
+    fields_.begin = 0;
+    fields_.end = 0;
+    fields_.used = 0;
+    fields_.size = 0;
+  }
+
+  size_type length(unsigned idx) const {
+    uint16_t length;
+    memcpy(&length, &data_[idx], LENGTH_SIZE);
+    return length;
+  }
+
+  /** Returns how many bytes are skipped at idx before the next record. */
+  size_type skipped(unsigned idx) const {
+    const size_type tail = capacity_ - idx;
+    return tail < LENGTH_SIZE || length(idx) == SKIP ? tail : 0;
+  }
+
+  /** Checks whether a record fits in the remaining capacity.
+   *
+   * The free bytes start at the end. If they wrap around, the record may
+   * be stored at the start, after skipping the bytes left before the end.
+   */
+  bool fits(size_type size) const {
+    const size_type needed = LENGTH_SIZE + size;
+    const size_type free = capacity_ - fields_.used;
+    const size_type tail = capacity_ - fields_.end;
+    if (free <= tail)
+      return needed <= free;
+    return needed <= tail || needed <= free - tail;
+  }
+
+  /** Appends a record that fits in the remaining capacity. */
+  void append(const void* data, size_type size) {
+    const size_type needed = LENGTH_SIZE + size;
+    const size_type tail = capacity_ - fields_.end;
+    if (needed > tail) {
+      if (tail >= LENGTH_SIZE)
+        write_length(fields_.end, SKIP);
+      fields_.used += tail;
+      fields_.end = 0;
+      dirty_.stats().count_wrap_around();
+    }
+
+    write_length(fields_.end, size);
+    if (size != 0)
+      memcpy(&data_[fields_.end + LENGTH_SIZE], data, size);
+    dirty_.mark(offset_ + storage_size(fields_.end), needed);
+
+    fields_.end += needed;
+    if (fields_.end == capacity_)
+      fields_.end = 0;
+    fields_.used += needed;
+    ++(fields_.size);
+    mark_header();
+    dirty_.stats().count_element_writes(1);
+  }
+
+  /** Pops the front record without marking the header. */
+  void pop_front() {
+    if (--(fields_.size) == 0) {
+      reset();
+      return;
+    }
+
+    const size_type size = LENGTH_SIZE + length(fields_.begin);
+    fields_.begin += size;
+    fields_.used -= size;
+    if (fields_.begin == capacity_) {
+      fields_.begin = 0;
+      return;
+    }
+
+    const size_type skip = skipped(fields_.begin);
+    if (skip > 0) {
+      fields_.begin = 0;
+      fields_.used -= skip;
+    }
+  }
+
+  void write_length(unsigned idx, size_type length) {
+    const uint16_t value = static_cast<uint16_t>(length);
+    memcpy(&data_[idx], &value, LENGTH_SIZE);
+    dirty_.mark(offset_ + storage_size(idx), LENGTH_SIZE);
+  }
+
+  void mark_header() {
+    header_changed_ = true;
+    dirty_.mark(offset_ + header_.staged_offset(), header_type::copy_size());
+    dirty_.stats().count_header_write();
+  }
+
+  persistent_blob_queue() = delete;
+
+  persistent_blob_queue(const persistent_blob_queue& other) = delete;
+  persistent_blob_queue& operator=(const persistent_blob_queue& other) = delete;
+
+  persistent_blob_queue(persistent_blob_queue&& other) = delete;
+  persistent_blob_queue& operator=(persistent_blob_queue&& other) = delete;
+};
+
+#endif // PERSISTENT_BLOB_QUEUE
@@ -0,0 +1,132 @@
+#ifndef PERSISTENT_CODEC
+#define PERSISTENT_CODEC
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/** This class encodes the elements of a persistent_compressed_queue.
+ *
+ * Each element is encoded relative to the element pushed before it. The
+ * default codec stores a bit mask of the bytes that differ from the previous
+ * element, followed by those bytes only, which suits structs of slowly
+ * changing readings. It can be specialized for other element types, for
+ * instance to store the deltas of each field as varints:
+ *
+ *     template<> struct persistent_codec<sample> {
+ *       static constexpr size_t max_size = 15;
+ *       static size_t encode(const sample& value, const sample& previous,
+ *           uint8_t* out) { ... }
+ *       static size_t decode(const uint8_t* in, const sample& previous,
+ *           sample& value) { ... }
+ *     };
+ *
+ * @tparam T Element type.
+ */
+template<class T>
+struct persistent_codec {
+  /** Maximum size of an encoded element (in bytes). */
+  static constexpr size_t max_size = (sizeof(T) + 7) / 8 + sizeof(T);
+
+  /** Encodes an element.
+   *
+   * @param value The element to encode.
+   * @param previous The element pushed before value.
+   * @param out Buffer of at least max_size bytes for the encoded element.
+   * @return The size of the encoded element (in bytes).
+   */
+  static size_t encode(const T& value, const T& previous, uint8_t* out) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+    const uint8_t* prev = reinterpret_cast<const uint8_t*>(&previous);
+
+    memset(out, 0, MASK_SIZE);
+    size_t size = MASK_SIZE;
+    for (size_t i = 0; i < sizeof(T); ++i) {
+      if (bytes[i] != prev[i]) {
+        out[i / 8] |= 1 << (i % 8);
+        out[size++] = bytes[i];
+      }
+    }
+    return size;
+  }
+
+  /** Decodes an element.
+   *
+   * @param in The encoded element.
+   * @param previous The element pushed before the encoded one.
+   * @param value Where the element is stored; it can be previous itself.
+   * @return The size of the encoded element (in bytes).
+   */
+  static size_t decode(const uint8_t* in, const T& previous, T& value) {
+    value = previous;
+    uint8_t* bytes = reinterpret_cast<uint8_t*>(&value);
+
+    size_t size = MASK_SIZE;
+    for (size_t i = 0; i < sizeof(T); ++i) {
+      if (in[i / 8] & (1 << (i % 8)))
+        bytes[i] = in[size++];
+    }
+    return size;
+  }
+
+private:
+  static constexpr size_t MASK_SIZE = (sizeof(T) + 7) / 8;
+};
+
+/** Encodes an unsigned integer as a varint.
+ *
+ * Seven bits are stored per byte, lowest first, and the top bit of a byte is
+ * set when more bytes follow, so small values take a single byte.
+ *
+ * @param value The value to encode.
+ * @param out Buffer of at least 5 bytes for the encoded value.
+ * @return The size of the encoded value (in bytes).
+ */
+inline size_t persistent_varint_encode(uint32_t value, uint8_t* out) {
+  size_t size = 0;
+  while (value >= 0x80) {
+    out[size++] = static_cast<uint8_t>(value | 0x80);
+    value >>= 7;
+  }
+  out[size++] = static_cast<uint8_t>(value);
+  return size;
+}
+
+/** Decodes a varint.
+ *
+ * @param in The encoded value.
+ * @param value Where the value is stored.
+ * @return The size of the encoded value (in bytes).
+ */
+inline size_t persistent_varint_decode(const uint8_t* in, uint32_t& value) {
+  value = 0;
+  size_t size = 0;
+  unsigned shift = 0;
+  do {
+    value |= static_cast<uint32_t>(in[size] & 0x7f) << shift;
+    shift += 7;
+  } while (in[size++] & 0x80 && shift < 35);
+  return size;
+}
+
+/** Maps a signed integer to an unsigned one, so that small deltas of either
+ * sign become small varints.
+ *
+ * @param value The value to map.
+ * @return The mapped value.
+ */
+inline uint32_t persistent_zigzag_encode(int32_t value) {
+  return (static_cast<uint32_t>(value) << 1)
+      ^ static_cast<uint32_t>(value >> 31);
+}
+
+/** Reverses persistent_zigzag_encode().
+ *
+ * @param value The mapped value.
+ * @return The original value.
+ */
+inline int32_t persistent_zigzag_decode(uint32_t value) {
+  return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+}
+
+#endif // PERSISTENT_CODEC
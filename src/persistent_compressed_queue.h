@@ -0,0 +1,424 @@
+#ifndef PERSISTENT_COMPRESSED_QUEUE
+#define PERSISTENT_COMPRESSED_QUEUE
+
+#include "dirty_range.h"
+#include "eeprom_backend.h"
+#include "persistent_codec.h"
+#include "persistent_header.h"
+#include "persistent_signature.h"
+#include "persistent_traits.h"
+
+/** This class implements a circular queue of compressed elements.
+ *
+ * Elements are encoded with persistent_codec, each one relative to the
+ * element pushed before it, and stored back to back in a circular buffer of
+ * bytes. The capacity is thus given in bytes, and the number of elements
+ * that fit depends on how much successive elements differ.
+ *
+ * The element at the front and the last element pushed are kept decoded in
+ * the queue's header, so front() takes constant time and pushing only writes
+ * the new element's encoded bytes. The header is double-buffered (see
+ * persistent_header).
+ *
+ * Modifications are only made to the storage's RAM copy. They become
+ * persistent once commit() is called, so several operations can be grouped
+ * into a single flash write.
+ *
+ * @tparam T Element type.
+ * @tparam Backend Storage backend mapped in RAM (see eeprom_backend).
+ */
+template<class T, class Backend = eeprom_backend>
+class persistent_compressed_queue {
+public:
+  typedef T value_type;
+  typedef std::size_t size_type;
+  typedef Backend backend_type;
+  typedef const value_type& const_reference;
+  typedef persistent_codec<value_type> codec_type;
+
+  static_assert(persistent_storable<value_type>::value,
+      "the element type must be trivially copyable");
+  static_assert(persistent_mapped<Backend>::value,
+      "the backend must be mapped in RAM; use a cached container instead");
+
+  /** Constructor.
+   *
+   * @param offset Offset from the storage's base address (a multiple of
+   *               persistent_max_align()).
+   * @param capacity Queue's capacity (in bytes of encoded elements), which
+   *                 should be at least codec_type::max_size.
+   */
+  persistent_compressed_queue(int offset, size_type capacity)
+    : capacity_{capacity}
+    , offset_{static_cast<size_type>(offset)}
+    , header_{Backend::data() + offset, SIGNATURE}
+    , data_{Backend::data() + offset + header_type::storage_size()}
+    , header_changed_{false}
+    , dirty_{&persistent_commit<Backend>,
+          &persistent_compressed_queue::on_commit, this}
+  {
+    if (!header_.load(fields_)
+        || fields_.begin >= capacity_
+        || fields_.end >= capacity_
+        || fields_.used > capacity_
+        || (fields_.begin + fields_.used) % capacity_ != fields_.end
+        || (fields_.size == 0 && fields_.used != 0)) {
+      fields_.begin = 0;
+      fields_.end = 0;
+      fields_.used = 0;
+      fields_.size = 0;
+      memset(&fields_.front, 0, sizeof(value_type));
+      memset(&fields_.back, 0, sizeof(value_type));
+      mark_header();
+    }
+  }
+
+  /**
+   * Computes the necessary storage size to hold a queue of the given capacity.
+   *
+   * @param capacity Queue's capacity (in bytes of encoded elements).
+   */
+  static constexpr size_type storage_size(size_type capacity) {
+    return header_type::storage_size() + capacity;
+  }
+
+  /** Checks whether the queue is empty.
+   *
+   * @return True if the queue is empty; false otherwise.
+   */
+  bool empty() const {
+    return size() == 0;
+  }
+
+  /** Returns the queue's size.
+   *
+   * The size correspond to the number of elements currently in the queue.
+   *
+   * @return The queue's size.
+   */
+  size_type size() const {
+    return fields_.size;
+  }
+
+  /** Returns the queue's capacity.
+   *
+   * @return The queue's capacity (in bytes of encoded elements).
+   */
+  size_type capacity() const {
+    return capacity_;
+  }
+
+  /** Returns the number of bytes taken by the encoded elements.
+   *
+   * The element at the front is kept in the header, so it takes no bytes.
+   *
+   * @return The number of bytes in use.
+   */
+  size_type bytes_used() const {
+    return fields_.used;
+  }
+
+  /** Returns the element at the queue's front.
+   *
+   * @return The element at the front.
+   */
+  const_reference front() const {
+    return fields_.front;
+  }
+
+  /** Returns the last element pushed into the queue.
+   *
+   * @return The element at the back.
+   */
+  const_reference back() const {
+    return fields_.back;
+  }
+
+  /** Pushes an element into the queue.
+   *
+   * The element is pushed at the end of the queue.
+   *
+   * @param value The element to be pushed.
+   * @return True if the element was insterted; false if its encoding did
+   *         not fit in the remaining capacity.
+   */
+  bool push(const value_type& value) {
+    if (empty()) {
+      push_first(value);
+      return true;
+    }
+
+    uint8_t record[codec_type::max_size];
+    const size_type size = codec_type::encode(value, fields_.back, record);
+    if (size > capacity_ - fields_.used) {
+      dirty_.stats().count_rejected_push();
+      return false;
+    }
+
+    append(value, record, size);
+    return true;
+  }
+
+  /** Pushes an element into the queue, dropping the oldest ones if needed.
+   *
+   * Elements at the front are popped until the new element's encoding fits,
+   * so that the queue keeps the most recent elements.
+   *
+   * @param value The element to be pushed.
+   * @return True if some element was dropped; false otherwise.
+   */
+  bool push_overwrite(const value_type& value) {
+    if (empty()) {
+      push_first(value);
+      return false;
+    }
+
+    uint8_t record[codec_type::max_size];
+    const size_type size = codec_type::encode(value, fields_.back, record);
+    if (size > capacity_) {
+      dirty_.stats().count_rejected_push();
+      return false;
+    }
+
+    bool dropped = false;
+    while (size > capacity_ - fields_.used) {
+      pop_front();
+      dropped = true;
+    }
+
+    append(value, record, size);
+    return dropped;
+  }
+
+  /** Pops an element from the queue.
+   *
+   * The element at the front is popped (removed), and the next one is
+   * decoded into the header.
+   *
+   * @return True if there was an element to pop; false otherwise.
+   */
+  bool pop() {
+    if (empty())
+      return false;
+
+    pop_front();
+    mark_header();
+    return true;
+  }
+
+  /** Pops several elements from the queue.
+   *
+   * The elements at the front are popped (removed). The queue's header is
+   * updated only once.
+   *
+   * @param count Number of elements to pop.
+   * @return The number of elements popped, which is lower than count if the
+   *         queue did not have enough elements.
+   */
+  size_type pop(size_type count) {
+    if (count > size())
+      count = size();
+    if (count == 0)
+      return 0;
+
+    for (size_type i = 0; i < count; ++i)
+      pop_front();
+    mark_header();
+    return count;
+  }
+
+  /** Copies elements from the queue's front without popping them.
+   *
+   * @param values Pointer to the buffer where elements are decoded.
+   * @param count Maximum number of elements to copy.
+   * @return The number of elements copied, which is lower than count if the
+   *         queue did not have enough elements.
+   */
+  size_type read(value_type* values, size_type count) const {
+    if (count > size())
+      count = size();
+    if (count == 0)
+      return 0;
+
+    values[0] = fields_.front;
+    unsigned idx = fields_.begin;
+    size_type used = fields_.used;
+    for (size_type i = 1; i < count; ++i) {
+      const size_type size = decode(idx, used, values[i - 1], values[i]);
+      advance(idx, size);
+      used -= size;
+    }
+    return count;
+  }
+
+  /** Checks whether the queue was modified since the last commit.
+   *
+   * @return True if there are uncommitted changes; false otherwise.
+   */
+  bool dirty() const {
+    return dirty_.dirty();
+  }
+
+  /** Makes the queue's modifications persistent.
+   *
+   * The storage backend is only committed if the queue was modified since
+   * the last commit; otherwise, this is a no-op.
+   *
+   * @return True if the changes were committed, or there was nothing to
+   *         commit; false otherwise.
+   */
+  bool commit() {
+    return dirty_.commit();
+  }
+
+#if defined(PERSISTENT_CONTAINERS_STATS)
+  /** Returns the queue's statistics.
+   *
+   * Only available if PERSISTENT_CONTAINERS_STATS is defined.
+   *
+   * @return A constant reference to the statistics.
+   */
+  const persistent_stats& stats() const {
+    return dirty_.stats();
+  }
+
+  /** Returns the estimated erase cycles of the flash backing the queue.
+   *
+   * This is the number of commits issued to the storage backend since boot,
+   * by any container. Only available if PERSISTENT_CONTAINERS_STATS is
+   * defined.
+   *
+   * @return The estimated erase cycles.
+   */
+  unsigned long estimated_erase_cycles() const {
+    return backend_commits<Backend>();
+  }
+#endif
+
+private:
+  // begin is the offset of the element that follows the front one, whose
+  // decoded copy is kept in the header instead.
+  struct header_fields {
+    unsigned begin;
+    unsigned end;
+    size_type used;
+    size_type size;
+    value_type front;
+    value_type back;
+  };
+
+  typedef persistent_header<header_fields> header_type;
+
+  static constexpr unsigned SIGNATURE {
+    persistent_signature(persistent_kind::compressed_queue,
+        sizeof(value_type), persistent_schema<value_type>::version)
+  };
+
+  const size_type capacity_;
+  const size_type offset_;
+  header_type header_;
+  header_fields fields_;
+  uint8_t* const data_;
+  bool header_changed_;
+  dirty_range dirty_;
+
+  /** Writes the header before the storage is committed. */
+  static void on_commit(void* context, bool committed) {
+    persistent_compressed_queue* queue =
+        static_cast<persistent_compressed_queue*>(context);
+    if (!queue->header_changed_)
+      return;
+
+    if (committed) {
+      queue->header_.committed();
+      queue->header_changed_ = false;
+    } else {
+      queue->header_.stage(queue->fields_);
+    }
+  }
+
+  void advance(unsigned& idx, size_type count) const {
+    idx += count;
+    if (idx >= capacity_)
+      idx -= capacity_;
+  }
+
+  /** Returns how many of count bytes starting at idx fit before the storage
+   * wraps around.
+   */
+  size_type contiguous(unsigned idx, size_type count) const {
+    return count < capacity_ - idx ? count : capacity_ - idx;
+  }
+
+  /** Decodes the element stored at idx, out of used encoded bytes. */
+  size_type decode(unsigned idx, size_type used, const value_type& previous,
+      value_type& value) const {
+    uint8_t record[codec_type::max_size];
+    const size_type count =
+        used < codec_type::max_size ? used : codec_type::max_size;
+    const size_type first_part = contiguous(idx, count);
+    memcpy(record, &data_[idx], first_part);
+    memcpy(record + first_part, &data_[0], count - first_part);
+    return codec_type::decode(record, previous, value);
+  }
+
+  /** Pushes an element into an empty queue, which only writes the header. */
+  void push_first(const value_type& value) {
+    fields_.front = value;
+    fields_.back = value;
+    fields_.size = 1;
+    mark_header();
+    dirty_.stats().count_element_writes(1);
+  }
+
+  /** Appends an encoded element that fits in the remaining capacity. */
+  void append(const value_type& value, const uint8_t* record,
+      size_type size) {
+    const size_type first_part = contiguous(fields_.end, size);
+    memcpy(&data_[fields_.end], record, first_part);
+    memcpy(&data_[0], record + first_part, size - first_part);
+    mark_bytes(fields_.end, size);
+    if (first_part < size)
+      dirty_.stats().count_wrap_around();
+
+    advance(fields_.end, size);
+    fields_.used += size;
+    fields_.back = value;
+    ++(fields_.size);
+    mark_header();
+    dirty_.stats().count_element_writes(1);
+  }
+
+  /** Pops the front element without marking the header. */
+  void pop_front() {
+    if (--(fields_.size) == 0)
+      return;
+
+    const size_type size =
+        decode(fields_.begin, fields_.used, fields_.front, fields_.front);
+    advance(fields_.begin, size);
+    fields_.used -= size;
+  }
+
+  void mark_header() {
+    header_changed_ = true;
+    dirty_.mark(offset_ + header_.staged_offset(), header_type::copy_size());
+    dirty_.stats().count_header_write();
+  }
+
+  void mark_bytes(unsigned idx, size_type count) {
+    const size_type first_part = contiguous(idx, count);
+    dirty_.mark(offset_ + storage_size(idx), first_part);
+    dirty_.mark(offset_ + storage_size(0), count - first_part);
+  }
+
+  persistent_compressed_queue() = delete;
+
+  persistent_compressed_queue(const persistent_compressed_queue& other) = delete;
+  persistent_compressed_queue& operator=(const persistent_compressed_queue& other) = delete;
+
+  persistent_compressed_queue(persistent_compressed_queue&& other) = delete;
+  persistent_compressed_queue& operator=(persistent_compressed_queue&& other) = delete;
+};
+
+#endif // PERSISTENT_COMPRESSED_QUEUE
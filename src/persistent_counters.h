@@ -0,0 +1,237 @@
+#ifndef PERSISTENT_COUNTERS
+#define PERSISTENT_COUNTERS
+
+#include "dirty_range.h"
+#include "eeprom_backend.h"
+#include "persistent_signature.h"
+
+/** This class implements a fixed-size array of small counters.
+ *
+ * Counters are packed into 32-bit words, Bits bits each, and updating a
+ * counter only marks the word that holds it. Counters saturate instead of
+ * wrapping around.
+ *
+ * Modifications are only made to the storage's RAM copy. They become
+ * persistent once commit() is called, so several operations can be grouped
+ * into a single flash write.
+ *
+ * @tparam Bits Bits per counter (1, 2, 4, 8 or 16).
+ * @tparam N Number of counters.
+ * @tparam Backend Storage backend mapped in RAM (see eeprom_backend).
+ */
+template<size_t Bits, size_t N, class Backend = eeprom_backend>
+class persistent_counters {
+public:
+  typedef size_t size_type;
+  typedef Backend backend_type;
+  typedef uint32_t value_type;
+
+  static_assert(Bits == 1 || Bits == 2 || Bits == 4 || Bits == 8
+      || Bits == 16, "counters must not straddle words");
+  static_assert(N > 0, "the array needs at least one counter");
+  static_assert(persistent_mapped<Backend>::value,
+      "the backend must be mapped in RAM; use a cached container instead");
+
+  /** Constructor.
+   *
+   * All the counters are set to zero if the storage does not hold an array
+   * of the same shape.
+   *
+   * @param offset Offset from the storage's base address (a multiple of
+   *               persistent_max_align()).
+   */
+  explicit persistent_counters(int offset)
+    : offset_{static_cast<size_type>(offset)}
+    , dirty_{&persistent_commit<Backend>}
+  {
+    uint8_t* data = Backend::data() + offset;
+    storage_ = reinterpret_cast<storage_area*>(data);
+
+    if (storage_->signature != SIGNATURE) {
+      storage_->signature = SIGNATURE;
+      storage_->reserved = 0;
+      dirty_.mark(offset_, sizeof(storage_area));
+      dirty_.stats().count_header_write();
+      reset();
+    }
+  }
+
+  /**
+   * Computes the necessary storage size to hold the counters.
+   */
+  static constexpr size_type storage_size() {
+    return sizeof(storage_area) + WORDS * sizeof(uint32_t);
+  }
+
+  /** Returns the number of counters.
+   *
+   * @return The number of counters.
+   */
+  static constexpr size_type size() {
+    return N;
+  }
+
+  /** Returns the largest value a counter can hold.
+   *
+   * @return The counters' maximum value.
+   */
+  static constexpr value_type max_value() {
+    return MASK;
+  }
+
+  /** Returns the value of a counter.
+   *
+   * @param pos Position of the counter.
+   * @return The counter's value.
+   */
+  value_type get(size_type pos) const {
+    return (storage_->words()[pos / PER_WORD] >> shift(pos)) & MASK;
+  }
+
+  /** Sets the value of a counter.
+   *
+   * @param pos Position of the counter.
+   * @param value The counter's new value, saturated to max_value().
+   */
+  void set(size_type pos, value_type value) {
+    if (value > MASK)
+      value = MASK;
+
+    const size_type w = pos / PER_WORD;
+    const uint32_t word = (storage_->words()[w] & ~(MASK << shift(pos)))
+        | (value << shift(pos));
+    if (word == storage_->words()[w])
+      return;
+
+    storage_->words()[w] = word;
+    mark_words(w, 1);
+  }
+
+  /** Increments a counter.
+   *
+   * @param pos Position of the counter.
+   * @return True if the counter was incremented; false if it already held
+   *         max_value().
+   */
+  bool increment(size_type pos) {
+    const value_type value = get(pos);
+    if (value == MASK)
+      return false;
+
+    set(pos, value + 1);
+    return true;
+  }
+
+  /** Decrements a counter.
+   *
+   * @param pos Position of the counter.
+   * @return True if the counter was decremented; false if it was zero.
+   */
+  bool decrement(size_type pos) {
+    const value_type value = get(pos);
+    if (value == 0)
+      return false;
+
+    set(pos, value - 1);
+    return true;
+  }
+
+  /** Sets all the counters to zero. */
+  void reset() {
+    for (size_type w = 0; w < WORDS; ++w) {
+      if (storage_->words()[w] != 0) {
+        storage_->words()[w] = 0;
+        mark_words(w, 1);
+      }
+    }
+  }
+
+  /** Checks whether the counters were modified since the last commit.
+   *
+   * @return True if there are uncommitted changes; false otherwise.
+   */
+  bool dirty() const {
+    return dirty_.dirty();
+  }
+
+  /** Makes the counters' modifications persistent.
+   *
+   * The storage backend is only committed if the counters were modified
+   * since the last commit; otherwise, this is a no-op.
+   *
+   * @return True if the changes were committed, or there was nothing to
+   *         commit; false otherwise.
+   */
+  bool commit() {
+    return dirty_.commit();
+  }
+
+#if defined(PERSISTENT_CONTAINERS_STATS)
+  /** Returns the counters' statistics.
+   *
+   * Only available if PERSISTENT_CONTAINERS_STATS is defined. Each modified
+   * word counts as an element write.
+   *
+   * @return A constant reference to the statistics.
+   */
+  const persistent_stats& stats() const {
+    return dirty_.stats();
+  }
+
+  /** Returns the estimated erase cycles of the flash backing the counters.
+   *
+   * This is the number of commits issued to the storage backend since boot,
+   * by any container. Only available if PERSISTENT_CONTAINERS_STATS is
+   * defined.
+   *
+   * @return The estimated erase cycles.
+   */
+  unsigned long estimated_erase_cycles() const {
+    return backend_commits<Backend>();
+  }
+#endif
+
+private:
+  struct storage_area {
+    uint16_t signature;
+    uint16_t reserved;
+
+    uint32_t* words() {
+      uint8_t* ptr_to_data = reinterpret_cast<uint8_t*>(this) + sizeof(*this);
+      return reinterpret_cast<uint32_t*>(ptr_to_data);
+    }
+  };
+
+  static constexpr size_type PER_WORD { 32 / Bits };
+  static constexpr size_type WORDS { (N + PER_WORD - 1) / PER_WORD };
+  static constexpr uint32_t MASK { (uint32_t(1) << Bits) - 1 };
+
+  static constexpr uint16_t SIGNATURE {
+    persistent_signature16(persistent_kind::counters, N * 32 + Bits, 0)
+  };
+
+  const size_type offset_;
+  storage_area* storage_;
+  dirty_range dirty_;
+
+  static unsigned shift(size_type pos) {
+    return (pos % PER_WORD) * Bits;
+  }
+
+  void mark_words(size_type w, size_type count) {
+    dirty_.mark(
+        offset_ + sizeof(storage_area) + w * sizeof(uint32_t),
+        count * sizeof(uint32_t));
+    dirty_.stats().count_element_writes(count);
+  }
+
+  persistent_counters() = delete;
+
+  persistent_counters(const persistent_counters& other) = delete;
+  persistent_counters& operator=(const persistent_counters& other) = delete;
+
+  persistent_counters(persistent_counters&& other) = delete;
+  persistent_counters& operator=(persistent_counters&& other) = delete;
+};
+
+#endif // PERSISTENT_COUNTERS
@@ -0,0 +1,61 @@
+#ifndef PERSISTENT_CRC
+#define PERSISTENT_CRC
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Computes the CRC-32 (IEEE 802.3) of a block of data.
+ *
+ * The CRC is computed a nibble at a time, with a 16-entry table, which keeps
+ * the code small on micro-controllers. Blocks can be chained by passing the
+ * result of a call as the crc argument of the next one.
+ *
+ * @param data Pointer to the data.
+ * @param size Number of bytes.
+ * @param crc CRC of the preceding data, if any.
+ * @return The CRC of the data.
+ */
+inline uint32_t persistent_crc32(const void* data, size_t size,
+    uint32_t crc = 0) {
+  static const uint32_t table[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+    0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+    0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+  };
+
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  crc = ~crc;
+  for (size_t i = 0; i < size; ++i) {
+    crc ^= bytes[i];
+    crc = (crc >> 4) ^ table[crc & 0x0f];
+    crc = (crc >> 4) ^ table[crc & 0x0f];
+  }
+  return ~crc;
+}
+
+/** Computes the CRC-16 (CCITT) of a block of data.
+ *
+ * The CRC is computed a nibble at a time, with a 16-entry table.
+ *
+ * @param data Pointer to the data.
+ * @param size Number of bytes.
+ * @param crc CRC of the preceding data, if any.
+ * @return The CRC of the data.
+ */
+inline uint16_t persistent_crc16(const void* data, size_t size,
+    uint16_t crc = 0xffff) {
+  static const uint16_t table[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+  };
+
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    crc = static_cast<uint16_t>((crc << 4) ^ table[(crc >> 12) ^ (bytes[i] >> 4)]);
+    crc = static_cast<uint16_t>((crc << 4) ^ table[(crc >> 12) ^ (bytes[i] & 0x0f)]);
+  }
+  return crc;
+}
+
+#endif // PERSISTENT_CRC
@@ -0,0 +1,210 @@
+#ifndef PERSISTENT_FLASH_COUNTER
+#define PERSISTENT_FLASH_COUNTER
+
+#include "esp8266_flash.h"
+#include "persistent_signature.h"
+
+/** This class implements a counter stored directly on flash.
+ *
+ * Flash bits can be cleared without erasing, so the counter keeps a base
+ * value in a sector header and counts increments in unary: each increment
+ * clears one more bit of the sector, which programs a single word and needs
+ * no erase. Only once every bit of the sector is cleared does the counter
+ * move to its second sector, with the current value as the new base, and
+ * erase the first one. Each sector thus takes about 32000 increments per
+ * erase cycle.
+ *
+ * Every increment is persistent when it returns; there is no need to
+ * commit. The sectors must not overlap the EEPROM sector nor the sketch.
+ *
+ * @tparam Flash Class providing raw flash access (see esp8266_flash).
+ */
+template<class Flash = esp8266_flash>
+class persistent_flash_counter {
+public:
+  typedef uint32_t value_type;
+  typedef std::size_t size_type;
+
+  /** Constructor.
+   *
+   * @param first_sector Index of the first of the two flash sectors used by
+   *                     the counter.
+   */
+  explicit persistent_flash_counter(uint32_t first_sector)
+    : first_sector_{first_sector}
+    , active_{0}
+    , base_{0}
+    , count_{0}
+  {
+    recover();
+  }
+
+  /** Returns the number of increments that fit in a sector.
+   *
+   * @return The increments per sector.
+   */
+  static constexpr size_type increments_per_sector() {
+    return (Flash::sector_size() - HEADER_SIZE) * 8;
+  }
+
+  /** Returns the counter's value.
+   *
+   * @return The counter's value.
+   */
+  value_type value() const {
+    return base_ + count_;
+  }
+
+  /** Increments the counter.
+   *
+   * @return True if the counter was incremented; false otherwise.
+   */
+  bool increment() {
+    if (count_ == increments_per_sector() && !switch_sector())
+      return false;
+
+    // Bits are cleared from the lowest one up.
+    const size_type bit = count_ % 32;
+    const uint32_t word = bit == 31 ? 0 : ~uint32_t(0) << (bit + 1);
+    if (!Flash::write(
+        word_address(active_, count_ / 32), &word, sizeof(word)))
+      return false;
+
+    ++count_;
+    return true;
+  }
+
+private:
+  struct sector_header {
+    uint32_t base;
+    uint32_t check;
+  };
+
+  static constexpr size_type HEADER_SIZE { sizeof(sector_header) };
+  static constexpr size_type WORDS {
+    (Flash::sector_size() - HEADER_SIZE) / sizeof(uint32_t)
+  };
+
+  static constexpr uint32_t SIGNATURE {
+    persistent_signature(persistent_kind::flash_counter, sizeof(value_type),
+        0)
+  };
+
+  const uint32_t first_sector_;
+  unsigned active_;
+  value_type base_;
+  size_type count_;
+
+  uint32_t sector_address(unsigned sector) const {
+    return (first_sector_ + sector) * Flash::sector_size();
+  }
+
+  uint32_t word_address(unsigned sector, size_type w) const {
+    return sector_address(sector) + HEADER_SIZE + w * sizeof(uint32_t);
+  }
+
+  uint32_t read_word(unsigned sector, size_type w) const {
+    uint32_t word = 0;
+    Flash::read(word_address(sector, w), &word, sizeof(word));
+    return word;
+  }
+
+  /** Reads a sector's header; the base is written before the check, so a
+   * torn header write is detected.
+   */
+  bool read_header(unsigned sector, value_type& base) const {
+    sector_header header;
+    if (!Flash::read(sector_address(sector),
+        reinterpret_cast<uint32_t*>(&header), HEADER_SIZE))
+      return false;
+
+    base = header.base;
+    return header.check == (header.base ^ SIGNATURE);
+  }
+
+  bool write_header(unsigned sector, value_type base) {
+    const sector_header header { base, base ^ SIGNATURE };
+    return Flash::write(sector_address(sector),
+        reinterpret_cast<const uint32_t*>(&header), HEADER_SIZE);
+  }
+
+  /** Moves the counter to the other sector, once the active one is full.
+   *
+   * The old sector is only erased after the new one holds a valid header,
+   * so the value survives a power loss at any point.
+   */
+  bool switch_sector() {
+    const unsigned other = 1 - active_;
+    if (!Flash::erase(first_sector_ + other)
+        || !write_header(other, value()))
+      return false;
+
+    Flash::erase(first_sector_ + active_);
+    active_ = other;
+    base_ = value();
+    count_ = 0;
+    return true;
+  }
+
+  /** Counts the increments recorded in a sector.
+   *
+   * Cleared words precede the partially cleared one, so the latter is found
+   * with a binary search.
+   */
+  size_type count(unsigned sector) const {
+    size_type low = 0;
+    size_type high = WORDS;
+    while (low < high) {
+      const size_type mid = low + (high - low) / 2;
+      if (read_word(sector, mid) == 0)
+        low = mid + 1;
+      else
+        high = mid;
+    }
+
+    if (low == WORDS)
+      return increments_per_sector();
+    return low * 32 + (32 - __builtin_popcountl(read_word(sector, low)));
+  }
+
+  /** Recovers the counter from the sector with the highest valid base.
+   *
+   * If neither sector holds a valid header, the counter starts from zero.
+   */
+  void recover() {
+    value_type bases[2];
+    const bool valid[2] = {
+      read_header(0, bases[0]),
+      read_header(1, bases[1]),
+    };
+
+    if (!valid[0] && !valid[1]) {
+      Flash::erase(first_sector_);
+      write_header(0, 0);
+      active_ = 0;
+      return;
+    }
+
+    if (valid[0] && valid[1])
+      active_ = bases[1] > bases[0] ? 1 : 0;
+    else
+      active_ = valid[1] ? 1 : 0;
+
+    // A switch may have been interrupted before erasing the old sector.
+    if (valid[1 - active_])
+      Flash::erase(first_sector_ + (1 - active_));
+
+    base_ = bases[active_];
+    count_ = count(active_);
+  }
+
+  persistent_flash_counter() = delete;
+
+  persistent_flash_counter(const persistent_flash_counter& other) = delete;
+  persistent_flash_counter& operator=(const persistent_flash_counter& other) = delete;
+
+  persistent_flash_counter(persistent_flash_counter&& other) = delete;
+  persistent_flash_counter& operator=(persistent_flash_counter&& other) = delete;
+};
+
+#endif // PERSISTENT_FLASH_COUNTER
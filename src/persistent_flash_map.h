@@ -0,0 +1,120 @@
+#ifndef PERSISTENT_FLASH_MAP
+#define PERSISTENT_FLASH_MAP
+
+#include <Arduino.h>
+
+#if defined(ARDUINO_ARCH_ESP32)
+#include <esp_idf_version.h>
+#include <esp_partition.h>
+
+/** This class maps a flash data partition of the ESP32 in the address space.
+ *
+ * Mapped flash is read through the cache, so containers stored on the
+ * partition can be read in place with persistent_vector_view. The mapping
+ * is released when the object is destroyed.
+ */
+class persistent_partition {
+public:
+  /** Constructor. Maps the whole partition.
+   *
+   * @param label Partition's label, as given in the partition table.
+   */
+  explicit persistent_partition(const char* label)
+    : data_{nullptr}
+    , size_{0}
+  {
+    const esp_partition_t* partition = esp_partition_find_first(
+        ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    if (partition == nullptr)
+      return;
+
+    const void* data;
+#if ESP_IDF_VERSION_MAJOR >= 5
+    if (esp_partition_mmap(partition, 0, partition->size,
+        ESP_PARTITION_MMAP_DATA, &data, &handle_) != ESP_OK)
+      return;
+#else
+    if (esp_partition_mmap(partition, 0, partition->size,
+        SPI_FLASH_MMAP_DATA, &data, &handle_) != ESP_OK)
+      return;
+#endif
+
+    data_ = static_cast<const uint8_t*>(data);
+    size_ = partition->size;
+  }
+
+  /** Destructor. Unmaps the partition. */
+  ~persistent_partition() {
+    if (data_ == nullptr)
+      return;
+
+#if ESP_IDF_VERSION_MAJOR >= 5
+    esp_partition_munmap(handle_);
+#else
+    spi_flash_munmap(handle_);
+#endif
+  }
+
+  /** Checks whether the partition was mapped.
+   *
+   * @return True if the partition was found and mapped; false otherwise.
+   */
+  bool mapped() const {
+    return data_ != nullptr;
+  }
+
+  /** Returns the partition's contents.
+   *
+   * @param offset Offset from the partition's start.
+   * @return A pointer to the byte at offset.
+   */
+  const uint8_t* data(size_t offset = 0) const {
+    return data_ + offset;
+  }
+
+  /** Returns the partition's size.
+   *
+   * @return The partition's size (in bytes).
+   */
+  size_t size() const {
+    return size_;
+  }
+
+private:
+  const uint8_t* data_;
+  size_t size_;
+#if ESP_IDF_VERSION_MAJOR >= 5
+  esp_partition_mmap_handle_t handle_;
+#else
+  spi_flash_mmap_handle_t handle_;
+#endif
+
+  persistent_partition(const persistent_partition& other) = delete;
+  persistent_partition& operator=(const persistent_partition& other) = delete;
+
+  persistent_partition(persistent_partition&& other) = delete;
+  persistent_partition& operator=(persistent_partition&& other) = delete;
+};
+
+#elif defined(ARDUINO_ARCH_ESP8266)
+
+extern "C" uint32_t _EEPROM_start;
+
+/** Returns the EEPROM's flash sector, as mapped in the address space.
+ *
+ * The sector holds what was last committed to the EEPROM, and it can be
+ * read without EEPROM.begin(), which allocates and fills a RAM copy. The
+ * mapped flash only allows aligned 32-bit loads, so elements must be read
+ * as whole words unless the core handles other loads (e.g., with the MMU
+ * option for non-32-bit access).
+ *
+ * @param offset Offset from the EEPROM's base address.
+ * @return A pointer to the byte at offset.
+ */
+inline const uint8_t* persistent_eeprom_flash(size_t offset = 0) {
+  return reinterpret_cast<const uint8_t*>(&_EEPROM_start) + offset;
+}
+
+#endif
+
+#endif // PERSISTENT_FLASH_MAP
@@ -0,0 +1,193 @@
+#ifndef PERSISTENT_FLUSH_SCHEDULER
+#define PERSISTENT_FLUSH_SCHEDULER
+
+#include <Arduino.h>
+
+/** This class decides when to commit a container.
+ *
+ * Committing erases and programs a flash sector, which blocks for tens of
+ * milliseconds. The scheduler commits a container once enough changes have
+ * accumulated, once the oldest uncommitted change is old enough, or once
+ * the container has been idle for a while, whichever comes first. Call
+ * modified() after changing the container, and poll() from the main loop;
+ * flush() commits right away (e.g., on a low-battery signal):
+ *
+ *     persistent_flush_scheduler<persistent_queue<sample>> flusher(
+ *         queue, 32, 60000); // every 32 changes or 60 s
+ *     queue.push(value);
+ *     flusher.modified();
+ *     flusher.poll();
+ *
+ * A container that poll() finds dirty counts as changed, so the time
+ * thresholds also apply to changes that modified() was not told about.
+ *
+ * On the ESP32, start() moves the commits to a task of their own, and
+ * poll() and flush() only wake it up, so the caller never blocks on the
+ * flash. The container must then be protected by a lock policy (see
+ * persistent_lock.h), which commit() releases while the storage is being
+ * written.
+ *
+ * @tparam Container Container type (anything with dirty() and commit()).
+ */
+template<class Container>
+class persistent_flush_scheduler {
+public:
+  typedef Container container_type;
+
+  /** Constructor.
+   *
+   * A threshold of zero is disabled.
+   *
+   * @param container The container to commit.
+   * @param max_changes Number of changes after which it is committed.
+   * @param max_age Time after the first uncommitted change after which it
+   *                is committed (in milliseconds).
+   * @param max_idle Time after the last change after which it is committed
+   *                 (in milliseconds).
+   */
+  persistent_flush_scheduler(container_type& container, unsigned max_changes,
+      unsigned long max_age, unsigned long max_idle = 0)
+    : container_(container)
+    , max_changes_{max_changes}
+    , max_age_{max_age}
+    , max_idle_{max_idle}
+    , changes_{0}
+    , first_change_{0}
+    , last_change_{0}
+#if defined(ARDUINO_ARCH_ESP32)
+    , task_{nullptr}
+#endif
+  {}
+
+  /** Returns the number of changes since the last commit.
+   *
+   * @return The number of changes.
+   */
+  unsigned changes() const {
+    return changes_;
+  }
+
+  /** Counts changes made to the container.
+   *
+   * @param count Number of changes (e.g., elements pushed).
+   */
+  void modified(unsigned count = 1) {
+    modified(count, millis());
+  }
+
+  /** Counts changes made to the container at a given time.
+   *
+   * @param count Number of changes (e.g., elements pushed).
+   * @param now Current time (in milliseconds).
+   */
+  void modified(unsigned count, unsigned long now) {
+    if (changes_ == 0)
+      first_change_ = now;
+    changes_ += count;
+    last_change_ = now;
+  }
+
+  /** Commits the container if any of the thresholds was reached.
+   *
+   * @return True if the container was committed (or its commit was
+   *         started); false otherwise.
+   */
+  bool poll() {
+    return poll(millis());
+  }
+
+  /** Commits the container if any of the thresholds was reached at a given
+   * time.
+   *
+   * @param now Current time (in milliseconds).
+   * @return True if the container was committed (or its commit was
+   *         started); false otherwise.
+   */
+  bool poll(unsigned long now) {
+    if (changes_ == 0) {
+      if (!container_.dirty())
+        return false;
+      modified(1, now);
+    }
+
+    const bool due = (max_changes_ > 0 && changes_ >= max_changes_)
+        || (max_age_ > 0 && now - first_change_ >= max_age_)
+        || (max_idle_ > 0 && now - last_change_ >= max_idle_);
+    return due && flush();
+  }
+
+  /** Commits the container now.
+   *
+   * If the commit fails, the changes are kept, so poll() retries it.
+   *
+   * @return True if the container was committed (or its commit was
+   *         started), or there was nothing to commit; false otherwise.
+   */
+  bool flush() {
+#if defined(ARDUINO_ARCH_ESP32)
+    if (task_ != nullptr) {
+      changes_ = 0;
+      xTaskNotifyGive(task_);
+      return true;
+    }
+#endif
+
+    if (!container_.commit())
+      return false;
+
+    changes_ = 0;
+    return true;
+  }
+
+#if defined(ARDUINO_ARCH_ESP32)
+  /** Starts a task that performs the commits.
+   *
+   * A commit that fails in the task leaves the container dirty, so the next
+   * poll() schedules it again.
+   *
+   * @param priority Task's priority.
+   * @param core Core the task runs on.
+   * @param stack_size Task's stack size (in bytes).
+   * @return True if the task was started; false otherwise.
+   */
+  bool start(UBaseType_t priority = 1, BaseType_t core = 0,
+      uint32_t stack_size = 2048) {
+    if (task_ != nullptr)
+      return true;
+
+    return xTaskCreatePinnedToCore(&persistent_flush_scheduler::run,
+        "persistent_flush", stack_size, this, priority, &task_, core) == pdPASS;
+  }
+#endif
+
+private:
+  container_type& container_;
+  const unsigned max_changes_;
+  const unsigned long max_age_;
+  const unsigned long max_idle_;
+  unsigned changes_;
+  unsigned long first_change_;
+  unsigned long last_change_;
+#if defined(ARDUINO_ARCH_ESP32)
+  TaskHandle_t task_;
+
+  static void run(void* context) {
+    persistent_flush_scheduler* scheduler =
+        static_cast<persistent_flush_scheduler*>(context);
+    for (;;) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      scheduler->container_.commit();
+    }
+  }
+#endif
+
+  persistent_flush_scheduler() = delete;
+
+  persistent_flush_scheduler(const persistent_flush_scheduler& other) = delete;
+  persistent_flush_scheduler& operator=(const persistent_flush_scheduler& other) = delete;
+
+  persistent_flush_scheduler(persistent_flush_scheduler&& other) = delete;
+  persistent_flush_scheduler& operator=(persistent_flush_scheduler&& other) = delete;
+};
+
+#endif // PERSISTENT_FLUSH_SCHEDULER
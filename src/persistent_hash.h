@@ -0,0 +1,37 @@
+#ifndef PERSISTENT_HASH
+#define PERSISTENT_HASH
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** This class computes the hash of a persistent_map's key.
+ *
+ * The default hash is FNV-1a over the key's bytes, which suits plain keys
+ * such as integers and fixed-size character arrays without padding. It can
+ * be specialized for other key types:
+ *
+ *     template<> struct persistent_hash<config_key> {
+ *       static uint32_t hash(const config_key& key) { ... }
+ *     };
+ *
+ * @tparam K Key type.
+ */
+template<class K>
+struct persistent_hash {
+  /** Computes the hash of a key.
+   *
+   * @param key The key.
+   * @return The key's hash.
+   */
+  static uint32_t hash(const K& key) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&key);
+    uint32_t h = 0x811c9dc5;
+    for (size_t i = 0; i < sizeof(K); ++i) {
+      h ^= bytes[i];
+      h *= 0x01000193;
+    }
+    return h;
+  }
+};
+
+#endif // PERSISTENT_HASH
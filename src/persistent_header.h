@@ -0,0 +1,145 @@
+#ifndef PERSISTENT_HEADER
+#define PERSISTENT_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "persistent_crc.h"
+
+/** This class implements a double-buffered (A/B) container header.
+ *
+ * The header is stored twice. Each copy holds the header's fields, a
+ * sequence number and a CRC, which also covers the container's signature.
+ * Updates are always written to the copy that is not in use. When the
+ * container is constructed, the valid copy with the highest sequence number
+ * is used; checking both copies takes constant time.
+ *
+ * This only protects against a power loss while committing if the storage
+ * is written in place, byte by byte, as RAM, FRAM or the RTC memory are:
+ * the last committed copy then stays intact, and the header is recovered
+ * from it. With eeprom_backend on the ESP8266, EEPROM.commit() erases the
+ * whole flash sector before programming it again, and both copies are in
+ * that sector, so a power loss during a commit may lose both of them and
+ * the container is then reset. Either way, only the header goes back to the
+ * previous commit: elements that the container rewrites in place (e.g.,
+ * through a vector's operator[] or erase(), a heap's sift path, or a queue
+ * slot reused by a push after a pop) may keep their new contents.
+ *
+ * The header works on storage mapped in RAM: it only writes the copies, and
+ * the container marks and commits them like any other data.
+ *
+ * @tparam Fields Header's fields (a trivially copyable struct).
+ */
+template<class Fields>
+class persistent_header {
+public:
+  typedef size_t size_type;
+
+  /** Constructor.
+   *
+   * @param storage Pointer to the header's storage.
+   * @param signature Container's signature.
+   */
+  persistent_header(uint8_t* storage, uint32_t signature)
+    : copies_{reinterpret_cast<copy*>(storage)}
+    , signature_{signature}
+    , active_{0}
+    , sequence_{0}
+  {}
+
+  /**
+   * Computes the necessary storage size to hold the header.
+   */
+  static constexpr size_type storage_size() {
+    return 2 * sizeof(copy);
+  }
+
+  /** Loads the header's fields from the most recent valid copy.
+   *
+   * @param fields Where the header's fields are stored.
+   * @return True if a valid copy was found; false if neither copy is valid
+   *         (e.g., the storage was never formatted), in which case fields
+   *         is not modified.
+   */
+  bool load(Fields& fields) {
+    const bool valid[2] = { valid_copy(0), valid_copy(1) };
+    if (!valid[0] && !valid[1])
+      return false;
+
+    if (valid[0] && valid[1]) {
+      const int32_t distance = static_cast<int32_t>(
+          copies_[1].sequence - copies_[0].sequence);
+      active_ = distance > 0 ? 1 : 0;
+    } else {
+      active_ = valid[1] ? 1 : 0;
+    }
+
+    sequence_ = copies_[active_].sequence;
+    memcpy(&fields, &copies_[active_].fields, sizeof(Fields));
+    return true;
+  }
+
+  /** Writes the header's fields into the copy that is not in use.
+   *
+   * The copy in use is not modified, so it is still the one loaded after a
+   * reboot until committed() is called.
+   *
+   * @param fields The header's new fields.
+   */
+  void stage(const Fields& fields) {
+    copy c;
+    memset(&c, 0, sizeof(c));
+    c.sequence = sequence_ + 1;
+    c.fields = fields;
+    c.crc = crc(c);
+    memcpy(&copies_[1 - active_], &c, sizeof(c));
+  }
+
+  /** Makes the staged copy the one in use, once it has been committed. */
+  void committed() {
+    active_ = 1 - active_;
+    ++sequence_;
+  }
+
+  /** Returns the offset of the staged copy from the header's storage.
+   *
+   * @return The staged copy's offset.
+   */
+  size_type staged_offset() const {
+    return (1 - active_) * sizeof(copy);
+  }
+
+  /** Returns the size of each copy.
+   *
+   * @return The copy's size (in bytes).
+   */
+  static constexpr size_type copy_size() {
+    return sizeof(copy);
+  }
+
+private:
+  struct copy {
+    uint32_t sequence;
+    Fields fields;
+    uint32_t crc;
+  };
+
+  copy* const copies_;
+  const uint32_t signature_;
+  unsigned active_;
+  uint32_t sequence_;
+
+  uint32_t crc(const copy& c) const {
+    const uint32_t crc = persistent_crc32(&signature_, sizeof(signature_));
+    return persistent_crc32(&c, offsetof(copy, crc), crc);
+  }
+
+  bool valid_copy(unsigned idx) const {
+    copy c;
+    memcpy(&c, &copies_[idx], sizeof(c));
+    return c.crc == crc(c);
+  }
+};
+
+#endif // PERSISTENT_HEADER
@@ -0,0 +1,28 @@
+#ifndef PERSISTENT_INDEX
+#define PERSISTENT_INDEX
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** This class selects the narrowest unsigned type that can hold an index.
+ *
+ * @tparam Max Largest value the index has to hold.
+ */
+template<size_t Max,
+         bool Fits8 = (Max <= 0xff),
+         bool Fits16 = (Max <= 0xffff)>
+struct persistent_index {
+  typedef uint32_t type;
+};
+
+template<size_t Max, bool Fits16>
+struct persistent_index<Max, true, Fits16> {
+  typedef uint8_t type;
+};
+
+template<size_t Max>
+struct persistent_index<Max, false, true> {
+  typedef uint16_t type;
+};
+
+#endif // PERSISTENT_INDEX
@@ -0,0 +1,147 @@
+#ifndef PERSISTENT_LAYOUT
+#define PERSISTENT_LAYOUT
+
+#include <stddef.h>
+
+#include "persistent_traits.h"
+
+/** This class describes a region of storage in a persistent_layout.
+ *
+ * @tparam Size Region's size (e.g., a container's storage_size()).
+ * @tparam Align Alignment of the region's offset (a power of two). The
+ *         default suits any element type (see persistent_max_align()), as
+ *         containers only align their elements relative to their offset.
+ * @tparam OwnSector Whether the region gets sectors of its own. Such a
+ *         region starts on a sector boundary and no other region shares
+ *         its last sector, which keeps frequently committed containers
+ *         apart from rarely modified ones.
+ */
+template<size_t Size, size_t Align = persistent_max_align(),
+    bool OwnSector = false>
+struct persistent_region {
+  static_assert(Align > 0 && (Align & (Align - 1)) == 0,
+      "the alignment must be a power of two");
+
+  static constexpr size_t size = Size;
+  static constexpr size_t align = Align;
+  static constexpr bool own_sector = OwnSector;
+};
+
+/** This class assigns the offsets of several containers at compile time.
+ *
+ * Regions are placed in order, each one at the lowest offset that honours
+ * its alignment and does not overlap the previous ones. All the results are
+ * constant expressions:
+ *
+ *     typedef persistent_layout<4096,
+ *         persistent_region<persistent_queue<sample>::storage_size(64)>,
+ *         persistent_region<persistent_vector<int>::storage_size(8)>> layout;
+ *
+ *     EEPROM.begin(layout::size());
+ *     persistent_queue<sample> queue(layout::offset<0>(), 64);
+ *     persistent_vector<int> totals(layout::offset<1>(), 8);
+ *
+ * @tparam SectorSize Size of the storage's erase sectors.
+ * @tparam Regions Regions to place (see persistent_region).
+ */
+template<size_t SectorSize, class... Regions>
+class persistent_layout {
+  static_assert(SectorSize > 0, "the sector size must be positive");
+
+  static constexpr size_t round_up(size_t value, size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+  }
+
+  // Places the regions after Start; Used is the end of the last region.
+  template<size_t Start, size_t Used, class... R>
+  struct plan {
+    static constexpr size_t total = Used;
+  };
+
+  template<size_t Start, size_t Used, class R, class... Rest>
+  struct plan<Start, Used, R, Rest...> {
+    static constexpr size_t offset =
+        round_up(Start, R::own_sector ? SectorSize : R::align);
+    static constexpr size_t end = offset + R::size;
+    typedef plan<R::own_sector ? round_up(end, SectorSize) : end, end, Rest...>
+        next;
+    static constexpr size_t total = next::total;
+  };
+
+  template<size_t I, class Plan>
+  struct at {
+    typedef typename at<I - 1, typename Plan::next>::type type;
+  };
+
+  template<class Plan>
+  struct at<0, Plan> {
+    typedef Plan type;
+  };
+
+  typedef plan<0, 0, Regions...> layout_plan;
+
+  template<size_t I>
+  using region_plan = typename at<I, layout_plan>::type;
+
+public:
+  /** Returns the number of regions.
+   *
+   * @return The number of regions.
+   */
+  static constexpr size_t count() {
+    return sizeof...(Regions);
+  }
+
+  /** Returns the offset assigned to a region.
+   *
+   * @tparam I Index of the region.
+   * @return The region's offset from the storage's base address.
+   */
+  template<size_t I>
+  static constexpr size_t offset() {
+    static_assert(I < sizeof...(Regions), "region index out of range");
+    return region_plan<I>::offset;
+  }
+
+  /** Returns the storage size needed by all the regions.
+   *
+   * This is the size to pass to EEPROM.begin().
+   *
+   * @return The total size (in bytes).
+   */
+  static constexpr size_t size() {
+    return layout_plan::total;
+  }
+
+  /** Returns the sector holding a region's first byte.
+   *
+   * @tparam I Index of the region.
+   * @return The index of the region's first sector.
+   */
+  template<size_t I>
+  static constexpr size_t first_sector() {
+    return offset<I>() / SectorSize;
+  }
+
+  /** Returns the sector holding a region's last byte.
+   *
+   * @tparam I Index of the region.
+   * @return The index of the region's last sector.
+   */
+  template<size_t I>
+  static constexpr size_t last_sector() {
+    return region_plan<I>::end > region_plan<I>::offset
+        ? (region_plan<I>::end - 1) / SectorSize
+        : first_sector<I>();
+  }
+
+  /** Returns the number of sectors spanned by all the regions.
+   *
+   * @return The number of sectors.
+   */
+  static constexpr size_t sector_count() {
+    return round_up(size(), SectorSize) / SectorSize;
+  }
+};
+
+#endif // PERSISTENT_LAYOUT
@@ -0,0 +1,222 @@
+#ifndef PERSISTENT_LAZY
+#define PERSISTENT_LAZY
+
+#include <stddef.h>
+#include <stdint.h>
+#include <new>
+
+#include "dirty_range.h"
+#include "persistent_transaction.h"
+
+/** This class attaches a container to its storage on first access.
+ *
+ * Constructing a container reads and validates its header, and formats it
+ * if it is not valid. Wrapping the container in this class defers all of it
+ * until the container is first accessed through get() or the -> operator,
+ * so that constructing it only stores its offset. Containers that are not
+ * needed after a wake-up are then never validated.
+ *
+ * The container is constructed in place, from the offset and, if given,
+ * the capacity:
+ *
+ *     persistent_lazy<persistent_queue<sample>> queue(0, 128);
+ *     queue->push(value); // constructs the queue
+ *
+ * The storage is accessed through the container's own backend (its
+ * backend_type).
+ *
+ * @tparam Container Container type.
+ */
+template<class Container>
+class persistent_lazy {
+public:
+  typedef Container container_type;
+  typedef typename container_type::backend_type backend_type;
+  typedef size_t size_type;
+
+  /** Constructor, for containers with a static capacity.
+   *
+   * @param offset Offset from the storage's base address.
+   */
+  explicit persistent_lazy(int offset)
+    : offset_{offset}
+    , capacity_{0}
+    , size_{container_type::storage_size()}
+    , attach_{&persistent_lazy::attach_static}
+    , attached_{false}
+  {}
+
+  /** Constructor, for containers whose capacity is given at run time.
+   *
+   * @param offset Offset from the storage's base address.
+   * @param capacity Container's capacity.
+   */
+  persistent_lazy(int offset, size_type capacity)
+    : offset_{offset}
+    , capacity_{capacity}
+    , size_{container_type::storage_size(capacity)}
+    , attach_{&persistent_lazy::attach_dynamic}
+    , attached_{false}
+  {}
+
+  /** Destructor.
+   *
+   * The container is destroyed if it was attached; its uncommitted
+   * modifications are not committed.
+   */
+  ~persistent_lazy() {
+    detach();
+  }
+
+  /** Returns the size of the container's storage.
+   *
+   * @return The storage size (in bytes).
+   */
+  size_type storage_size() const {
+    return size_;
+  }
+
+  /** Checks whether the container was attached to its storage.
+   *
+   * @return True if the container was constructed; false otherwise.
+   */
+  bool attached() const {
+    return attached_;
+  }
+
+  /** Attaches the container to its storage, if not attached yet.
+   *
+   * The container's constructor validates its header, and formats it if it
+   * is not valid.
+   */
+  void attach() {
+    if (attached_)
+      return;
+
+    attach_(storage_, offset_, capacity_);
+    attached_ = true;
+  }
+
+  /** Returns the container, attaching it first if needed.
+   *
+   * @return A reference to the container.
+   */
+  container_type& get() {
+    attach();
+    return *container();
+  }
+
+  /** Returns the container, attaching it first if needed.
+   *
+   * @return A pointer to the container.
+   */
+  container_type* operator->() {
+    return &get();
+  }
+
+  /** Returns the container, attaching it first if needed.
+   *
+   * @return A reference to the container.
+   */
+  container_type& operator*() {
+    return get();
+  }
+
+  /** Formats the container's storage and attaches a new, empty container.
+   *
+   * The storage is cleared, so the container is formatted when it attaches,
+   * and the result is committed. Within a persistent_transaction, the commit
+   * is deferred until the transaction ends (see persistent_format_all).
+   *
+   * @return True if the new container was committed; false otherwise.
+   */
+  bool format() {
+    persistent_transaction transaction;
+    detach();
+
+    static const uint8_t zeros[16] = {};
+    for (size_type done = 0; done < size_; done += sizeof(zeros)) {
+      const size_type count =
+          size_ - done < sizeof(zeros) ? size_ - done : sizeof(zeros);
+      backend_type::write(offset_ + done, zeros, count);
+    }
+    cleared().mark(offset_, size_);
+
+    attach();
+    return transaction.commit();
+  }
+
+private:
+  typedef void (*attach_function)(void* storage, int offset,
+      size_type capacity);
+
+  alignas(container_type) uint8_t storage_[sizeof(container_type)];
+  const int offset_;
+  const size_type capacity_;
+  const size_type size_;
+  const attach_function attach_;
+  bool attached_;
+
+  /** Returns the range that tracks the cleared storage, which is shared by
+   * all the wrappers of the same type to save RAM.
+   */
+  static dirty_range& cleared() {
+    static dirty_range range { &persistent_commit<backend_type> };
+    return range;
+  }
+
+  static void attach_static(void* storage, int offset, size_type) {
+    new (storage) container_type(offset);
+  }
+
+  static void attach_dynamic(void* storage, int offset, size_type capacity) {
+    new (storage) container_type(offset, capacity);
+  }
+
+  container_type* container() {
+    return reinterpret_cast<container_type*>(storage_);
+  }
+
+  void detach() {
+    if (!attached_)
+      return;
+
+    container()->~container_type();
+    attached_ = false;
+  }
+
+  persistent_lazy() = delete;
+
+  persistent_lazy(const persistent_lazy& other) = delete;
+  persistent_lazy& operator=(const persistent_lazy& other) = delete;
+
+  persistent_lazy(persistent_lazy&& other) = delete;
+  persistent_lazy& operator=(persistent_lazy&& other) = delete;
+};
+
+/** Formats no container. */
+inline bool persistent_format_all() {
+  return true;
+}
+
+/** Formats several containers with a single commit.
+ *
+ * This is meant for the first boot, or a factory reset: every container is
+ * formatted (see persistent_lazy::format) within one transaction, so the
+ * storage is committed once per backend instead of once per container.
+ *
+ * @param first The first container to format.
+ * @param rest The rest of containers to format.
+ * @return True if every container was formatted and committed; false
+ *         otherwise.
+ */
+template<class Lazy, class... Rest>
+bool persistent_format_all(Lazy& first, Rest&... rest) {
+  persistent_transaction transaction;
+  // Every container is formatted, even if an earlier one failed.
+  const bool formatted = first.format();
+  const bool rest_formatted = persistent_format_all(rest...);
+  return transaction.commit() && formatted && rest_formatted;
+}
+
+#endif // PERSISTENT_LAZY
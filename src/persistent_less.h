@@ -0,0 +1,49 @@
+#ifndef PERSISTENT_LESS
+#define PERSISTENT_LESS
+
+#include <stddef.h>
+
+/** This class compares elements with the < operator.
+ *
+ * It is the default order of persistent_priority_queue and of the sorted
+ * operations of persistent_vector.
+ *
+ * @tparam T Element type.
+ */
+template<class T>
+struct persistent_less {
+  bool operator()(const T& a, const T& b) const {
+    return a < b;
+  }
+};
+
+/** Binary searches a sorted sequence of elements.
+ *
+ * The elements are read through a function object, so that sequences that
+ * cannot be dereferenced in place (see persistent_vector_view) share the
+ * same search as those that can.
+ *
+ * @param at Function object that returns the element at a position.
+ * @param size Number of elements.
+ * @param value The value to search for.
+ * @param compare Function object that returns true if its first argument
+ *                goes before its second one.
+ * @return The position of the first element that does not go before value,
+ *         or size if there is none.
+ */
+template<class At, class T, class Compare>
+size_t persistent_lower_bound(At at, size_t size, const T& value,
+    Compare compare) {
+  size_t low = 0;
+  size_t high = size;
+  while (low < high) {
+    const size_t mid = low + (high - low) / 2;
+    if (compare(at(mid), value))
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return low;
+}
+
+#endif // PERSISTENT_LESS
@@ -0,0 +1,84 @@
+#ifndef PERSISTENT_LOCK
+#define PERSISTENT_LOCK
+
+#include <Arduino.h>
+
+/** Lock policy that does nothing, for containers used from a single
+ * context. This is the default, and it costs nothing.
+ */
+struct persistent_no_lock {
+  void lock() {}
+  void unlock() {}
+};
+
+/** Lock policy that disables interrupts, for single-core boards (e.g., the
+ * ESP8266) whose containers are also modified from an interrupt handler.
+ */
+struct persistent_interrupt_lock {
+  void lock() {
+    noInterrupts();
+  }
+
+  void unlock() {
+    interrupts();
+  }
+};
+
+#if defined(ARDUINO_ARCH_ESP32)
+/** Lock policy that takes a spinlock, for containers modified from tasks
+ * running on both cores of the ESP32, or from interrupt handlers.
+ *
+ * Interrupts are disabled on the calling core while the lock is held, so
+ * critical sections must be short and must not access the flash. Containers
+ * take the lock around each operation, but not while the storage is being
+ * committed.
+ */
+class persistent_spinlock {
+public:
+  persistent_spinlock()
+    : mux_(portMUX_INITIALIZER_UNLOCKED)
+  {}
+
+  void lock() {
+    portENTER_CRITICAL_SAFE(&mux_);
+  }
+
+  void unlock() {
+    portEXIT_CRITICAL_SAFE(&mux_);
+  }
+
+private:
+  portMUX_TYPE mux_;
+};
+#endif
+
+/** This class holds a lock for the duration of a scope.
+ *
+ * @tparam Lock Lock policy (e.g., persistent_interrupt_lock).
+ */
+template<class Lock>
+class persistent_lock_guard {
+public:
+  /** Constructor. Takes the lock.
+   *
+   * @param lock The lock to hold.
+   */
+  explicit persistent_lock_guard(Lock& lock)
+    : lock_(lock)
+  {
+    lock_.lock();
+  }
+
+  /** Destructor. Releases the lock. */
+  ~persistent_lock_guard() {
+    lock_.unlock();
+  }
+
+private:
+  Lock& lock_;
+
+  persistent_lock_guard(const persistent_lock_guard& other) = delete;
+  persistent_lock_guard& operator=(const persistent_lock_guard& other) = delete;
+};
+
+#endif // PERSISTENT_LOCK
@@ -0,0 +1,400 @@
+#ifndef PERSISTENT_LOG_QUEUE
+#define PERSISTENT_LOG_QUEUE
+
+#include "esp8266_flash.h"
+#include "persistent_signature.h"
+#include "persistent_traits.h"
+
+/** This class implements a wear-leveled queue stored directly on flash.
+ *
+ * Elements are appended as records to a rotating set of flash sectors, so
+ * pushing and popping only write erased words and never rewrite a header in
+ * place. A sector is erased only once all its records have been consumed.
+ * Every operation is persistent as soon as it returns; there is no need to
+ * commit.
+ *
+ * Each sector starts with a header holding a sequence number, followed by
+ * fixed-size records. Each record holds an element and a state word that is
+ * programmed along with the element, and cleared when the element is popped.
+ * The queue's front and back are recovered by scanning the sectors when the
+ * queue is constructed.
+ *
+ * The sectors must not overlap the EEPROM sector nor the sketch.
+ *
+ * @tparam T Element type. It must be trivially copyable.
+ * @tparam Flash Class providing raw flash access (see esp8266_flash).
+ */
+template<class T, class Flash = esp8266_flash>
+class persistent_log_queue {
+public:
+  typedef T value_type;
+  typedef std::size_t size_type;
+
+  static_assert(persistent_storable<value_type>::value,
+      "the element type must be trivially copyable");
+
+  /** Constructor.
+   *
+   * @param first_sector Index of the first flash sector used by the queue.
+   * @param sector_count Number of sectors used by the queue (at least two
+   *                     are recommended, so that a sector can be erased while
+   *                     the other one keeps the queue's elements).
+   */
+  persistent_log_queue(uint32_t first_sector, size_type sector_count)
+    : first_sector_{first_sector}
+    , sector_count_{sector_count}
+    , sequence_{0}
+    , size_{0}
+    , tail_open_{false}
+  {
+    recover();
+  }
+
+  /** Returns the number of records that fit in a sector.
+   *
+   * @return The number of records per sector.
+   */
+  static constexpr size_type records_per_sector() {
+    return (Flash::sector_size() - HEADER_SIZE) / RECORD_SIZE;
+  }
+
+  /** Checks whether the queue is empty.
+   *
+   * @return True if the queue is empty; false otherwise.
+   */
+  bool empty() const {
+    return size() == 0;
+  }
+
+  /** Checks whether the queue is full.
+   *
+   * @return True if the queue is full; false otherwise.
+   */
+  bool full() const {
+    return tail_.record == records_per_sector()
+        && next(tail_.sector) == head_.sector
+        && !empty();
+  }
+
+  /** Returns the queue's size.
+   *
+   * The size correspond to the number of elements currently in the queue.
+   *
+   * @return The queue's size.
+   */
+  size_type size() const {
+    return size_;
+  }
+
+  /** Returns the queue's capacity.
+   *
+   * The capacity correspond to the maximum number of elements that the queue
+   * can store. Records are only reused once their whole sector is erased, so
+   * the records already popped from the head's sector, as well as those left
+   * behind by an interrupted push, do not count towards it: the queue may be
+   * full with up to one sector's worth of elements less, i.e., only
+   * (sector_count - 1) * records_per_sector() elements are guaranteed to fit.
+   *
+   * @return The queue's capacity.
+   */
+  size_type capacity() const {
+    return sector_count_ * records_per_sector();
+  }
+
+  /** Returns the element at the queue's front.
+   *
+   * The element is read from flash.
+   *
+   * @return The element at the front.
+   */
+  value_type front() const {
+    record r;
+    read_record(head_, r);
+    value_type value;
+    memcpy(&value, r.data, sizeof(value_type));
+    return value;
+  }
+
+  /** Pushes an element into the queue.
+   *
+   * The element is pushed at the end of the queue.
+   *
+   * @param value The element to be pushed.
+   * @return True if the element was insterted; false otherwise.
+   */
+  bool push(const value_type& value) {
+    if (tail_.record == records_per_sector() && !advance_tail())
+      return false;
+
+    if (!tail_open_ && !open_tail_sector())
+      return false;
+
+    record r;
+    memset(&r, 0xff, sizeof(r));
+    memcpy(r.data, &value, sizeof(value_type));
+    r.state = RECORD_VALID;
+    if (!Flash::write(record_address(tail_), r.data, RECORD_SIZE))
+      return false;
+
+    ++tail_.record;
+    ++size_;
+    return true;
+  }
+
+  /** Pops an element from the queue.
+   *
+   * The element at the front is popped (removed).
+   *
+   * @return True if there was an element to pop; false otherwise.
+   */
+  bool pop() {
+    if (empty())
+      return false;
+
+    uint32_t state = RECORD_CONSUMED;
+    if (!Flash::write(state_address(head_), &state, sizeof(state)))
+      return false;
+
+    ++head_.record;
+    --size_;
+    skip_to_valid();
+    return true;
+  }
+
+private:
+  struct position {
+    size_type sector;
+    size_type record;
+
+    bool operator==(const position& other) const {
+      return sector == other.sector && record == other.record;
+    }
+  };
+
+  struct sector_header {
+    uint32_t sequence;
+    uint32_t signature;
+  };
+
+  static constexpr size_type DATA_WORDS {
+    (sizeof(value_type) + sizeof(uint32_t) - 1) / sizeof(uint32_t)
+  };
+
+  struct record {
+    uint32_t data[DATA_WORDS];
+    uint32_t state;
+  };
+
+  static constexpr size_type HEADER_SIZE { sizeof(sector_header) };
+  static constexpr size_type RECORD_SIZE { sizeof(record) };
+
+  static constexpr uint32_t SIGNATURE {
+    persistent_signature(persistent_kind::log_queue, sizeof(value_type),
+        persistent_schema<value_type>::version)
+  };
+  static constexpr uint32_t RECORD_ERASED { 0xffffffff };
+  static constexpr uint32_t RECORD_VALID { 0x5a5a5a5a };
+  static constexpr uint32_t RECORD_CONSUMED { 0x00000000 };
+
+  const uint32_t first_sector_;
+  const size_type sector_count_;
+  uint32_t sequence_;
+  size_type size_;
+  position head_;
+  position tail_;
+  bool tail_open_;
+
+  size_type next(size_type sector) const {
+    return sector + 1 == sector_count_ ? 0 : sector + 1;
+  }
+
+  uint32_t sector_address(size_type sector) const {
+    return (first_sector_ + sector) * Flash::sector_size();
+  }
+
+  uint32_t record_address(const position& pos) const {
+    return sector_address(pos.sector) + HEADER_SIZE + pos.record * RECORD_SIZE;
+  }
+
+  uint32_t state_address(const position& pos) const {
+    return record_address(pos) + offsetof(record, state);
+  }
+
+  bool read_record(const position& pos, record& r) const {
+    return Flash::read(record_address(pos), r.data, RECORD_SIZE);
+  }
+
+  uint32_t read_state(const position& pos) const {
+    uint32_t state = RECORD_CONSUMED;
+    Flash::read(state_address(pos), &state, sizeof(state));
+    return state;
+  }
+
+  bool read_header(size_type sector, sector_header& header) const {
+    return Flash::read(
+        sector_address(sector),
+        reinterpret_cast<uint32_t*>(&header),
+        HEADER_SIZE);
+  }
+
+  /** Writes the header of the tail sector.
+   *
+   * The sector is erased first unless its header is blank, so a sector
+   * whose erase failed earlier on (see skip_to_valid() and recover()) is
+   * never written to as if it were blank.
+   */
+  bool open_tail_sector() {
+    if (!blank(tail_.sector) && !Flash::erase(first_sector_ + tail_.sector))
+      return false;
+
+    sector_header header { sequence_ + 1, SIGNATURE };
+    if (!Flash::write(
+        sector_address(tail_.sector),
+        reinterpret_cast<const uint32_t*>(&header),
+        HEADER_SIZE))
+      return false;
+
+    ++sequence_;
+    tail_open_ = true;
+    return true;
+  }
+
+  /** Moves the tail to the next sector once the current one is full.
+   *
+   * If the queue is empty, the sector is erased and the head moves along
+   * with the tail.
+   */
+  bool advance_tail() {
+    if (head_ == tail_) {
+      if (!Flash::erase(first_sector_ + tail_.sector))
+        return false;
+      tail_ = { next(tail_.sector), 0 };
+      head_ = tail_;
+      tail_open_ = false;
+      return true;
+    }
+
+    if (next(tail_.sector) == head_.sector)
+      return false;
+
+    tail_ = { next(tail_.sector), 0 };
+    tail_open_ = false;
+    return true;
+  }
+
+  /** Moves the head to the next valid record.
+   *
+   * Sectors left behind by the head are erased. If an erase fails, the
+   * sector is erased again before the tail reuses it (see open_tail_sector()).
+   */
+  void skip_to_valid() {
+    while (!(head_ == tail_)) {
+      if (head_.record == records_per_sector()) {
+        Flash::erase(first_sector_ + head_.sector);
+        head_ = { next(head_.sector), 0 };
+        continue;
+      }
+
+      if (read_state(head_) == RECORD_VALID)
+        return;
+
+      ++head_.record;
+    }
+  }
+
+  /** Checks whether a sector's header has never been written. */
+  bool blank(size_type sector) const {
+    sector_header header;
+    return read_header(sector, header)
+        && header.sequence == RECORD_ERASED
+        && header.signature == RECORD_ERASED;
+  }
+
+  /** Checks whether a record has never been written. */
+  bool erased(const position& pos) const {
+    record r;
+    if (!read_record(pos, r))
+      return false;
+
+    for (auto word : r.data) {
+      if (word != RECORD_ERASED)
+        return false;
+    }
+    return r.state == RECORD_ERASED;
+  }
+
+  /** Recovers the queue's state by scanning its sectors.
+   *
+   * Sectors that do not hold a valid header are erased; if an erase fails,
+   * it is retried before the tail writes to the sector. Records left
+   * half-written by an interrupted push are marked as consumed.
+   */
+  void recover() {
+    bool found = false;
+    uint32_t oldest = 0;
+
+    for (size_type sector = 0; sector < sector_count_; ++sector) {
+      sector_header header;
+      if (!read_header(sector, header))
+        continue;
+
+      if (header.signature != SIGNATURE) {
+        if (!blank(sector))
+          Flash::erase(first_sector_ + sector);
+        continue;
+      }
+
+      if (!found || header.sequence < oldest) {
+        oldest = header.sequence;
+        head_ = { sector, 0 };
+      }
+      if (!found || header.sequence > sequence_) {
+        sequence_ = header.sequence;
+        tail_ = { sector, 0 };
+      }
+      found = true;
+    }
+
+    if (!found) {
+      head_ = { 0, 0 };
+      tail_ = head_;
+      return;
+    }
+
+    tail_open_ = true;
+    while (tail_.record < records_per_sector()) {
+      uint32_t state = read_state(tail_);
+      if (state == RECORD_ERASED) {
+        if (erased(tail_))
+          break;
+
+        uint32_t consumed = RECORD_CONSUMED;
+        Flash::write(state_address(tail_), &consumed, sizeof(consumed));
+      }
+      ++tail_.record;
+    }
+
+    position pos = head_;
+    while (!(pos == tail_)) {
+      if (pos.record == records_per_sector()) {
+        pos = { next(pos.sector), 0 };
+        continue;
+      }
+      if (read_state(pos) == RECORD_VALID)
+        ++size_;
+      ++pos.record;
+    }
+
+    skip_to_valid();
+  }
+
+  persistent_log_queue() = delete;
+
+  persistent_log_queue(const persistent_log_queue& other) = delete;
+  persistent_log_queue& operator=(const persistent_log_queue& other) = delete;
+
+  persistent_log_queue(persistent_log_queue&& other) = delete;
+  persistent_log_queue& operator=(persistent_log_queue&& other) = delete;
+};
+
+#endif // PERSISTENT_LOG_QUEUE
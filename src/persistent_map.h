@@ -0,0 +1,398 @@
+#ifndef PERSISTENT_MAP
+#define PERSISTENT_MAP
+
+#include "dirty_range.h"
+#include "eeprom_backend.h"
+#include "persistent_hash.h"
+#include "persistent_header.h"
+#include "persistent_signature.h"
+#include "persistent_traits.h"
+
+/** This class implements a fixed-size hash map.
+ *
+ * The map is an open-addressing hash table with linear probing, stored on
+ * the EEPROM of an ESP8266 micro-controller. Lookups, insertions and erases
+ * take constant time on average. Lookups do not modify the map, and
+ * insertions only modify the slot they touch (and the map's header when its
+ * size changes). Erasing a key
+ * moves the keys that follow it in its cluster back into the freed slot
+ * (backward-shift deletion), so that they can still be found without
+ * leaving tombstones behind: lookups for missing keys stop at the first
+ * free slot however many keys were erased, and every free slot can be
+ * reused.
+ *
+ * Modifications are only made to the EEPROM's RAM copy. They become
+ * persistent once commit() is called, so several operations can be grouped
+ * into a single flash write. Like persistent_queue, the map's header is
+ * double-buffered.
+ *
+ * @tparam K Key type (compared with operator==, hashed with persistent_hash).
+ * @tparam V Mapped type.
+ * @tparam Backend Storage backend mapped in RAM (see eeprom_backend).
+ */
+template<class K, class V, class Backend = eeprom_backend>
+class persistent_map {
+public:
+  typedef K key_type;
+  typedef V mapped_type;
+  typedef size_t size_type;
+  typedef Backend backend_type;
+
+  static_assert(persistent_storable<key_type>::value
+      && persistent_storable<mapped_type>::value,
+      "the key and value types must be trivially copyable");
+  static_assert(persistent_mapped<Backend>::value,
+      "the backend must be mapped in RAM; use a cached container instead");
+  static_assert(persistent_schema<key_type>::version < 16
+      && persistent_schema<mapped_type>::version < 16,
+      "the key and value schema versions must be lower than 16");
+
+  /** Constructor.
+   *
+   * @param offset Offset from the storage's base address (a multiple of
+   *               persistent_max_align()).
+   * @param capacity Map's capacity (in elements).
+   */
+  persistent_map(int offset, size_type capacity)
+    : capacity_{capacity}
+    , offset_{static_cast<size_type>(offset)}
+    , header_{Backend::data() + offset, SIGNATURE}
+    , slots_{reinterpret_cast<slot*>(
+          Backend::data() + offset + DATA_OFFSET)}
+    , header_changed_{false}
+    , dirty_{&persistent_commit<Backend>, &persistent_map::on_commit, this}
+  {
+    if (!header_.load(fields_) || fields_.size > capacity_)
+      clear();
+  }
+
+  /**
+   * Computes the necessary storage size to hold a map of the given capacity.
+   *
+   * @param capacity Map's capacity (in elements).
+   */
+  static constexpr size_type storage_size(size_type capacity) {
+    return DATA_OFFSET + capacity * sizeof(slot);
+  }
+
+  /** Checks whether the map is empty.
+   *
+   * @return True if the map is empty; false otherwise.
+   */
+  bool empty() const {
+    return size() == 0;
+  }
+
+  /** Checks whether the map is full.
+   *
+   * @return True if the map is full; false otherwise.
+   */
+  bool full() const {
+    return size() == capacity();
+  }
+
+  /** Returns the map's size.
+   *
+   * The size correspond to the number of elements currently in the map.
+   *
+   * @return The map's size.
+   */
+  size_type size() const {
+    return fields_.size;
+  }
+
+  /** Returns the map's capacity.
+   *
+   * The capacity correspond to the maximum number of elements that the map
+   * can store. Lookups are faster when the map is not close to full.
+   *
+   * @return The map's capacity.
+   */
+  size_type capacity() const {
+    return capacity_;
+  }
+
+  /** Finds the value mapped to a key.
+   *
+   * @param key The key to look for.
+   * @return A constant pointer to the value, or nullptr if the key is not in
+   *         the map.
+   */
+  const mapped_type* find(const key_type& key) const {
+    const size_type idx = lookup(key);
+    return idx == capacity_ ? nullptr : &slots_[idx].value;
+  }
+
+  /** Finds the value mapped to a key, to modify it in place.
+   *
+   * The value is marked as modified, as it can be written through the
+   * returned pointer. Use find() to only read it.
+   *
+   * @param key The key to look for.
+   * @return A pointer to the value, or nullptr if the key is not in the map.
+   */
+  mapped_type* modify(const key_type& key) {
+    const size_type idx = lookup(key);
+    if (idx == capacity_)
+      return nullptr;
+
+    mark_value(idx);
+    return &slots_[idx].value;
+  }
+
+  /** Checks whether a key is in the map.
+   *
+   * @param key The key to look for.
+   * @return True if the key is in the map; false otherwise.
+   */
+  bool contains(const key_type& key) const {
+    return lookup(key) != capacity_;
+  }
+
+  /** Maps a value to a key.
+   *
+   * If the key is already in the map, only its value is written; otherwise,
+   * the key and value are stored in a free slot.
+   *
+   * @param key The key.
+   * @param value The value to map to the key.
+   * @return True if the value was stored; false if the key was not in the
+   *         map and the map is full.
+   */
+  bool insert_or_assign(const key_type& key, const mapped_type& value) {
+    size_type free = capacity_;
+    size_type idx = home(key);
+    for (size_type probes = 0; probes < capacity_; ++probes) {
+      slot& s = slots_[idx];
+      if (s.state == SLOT_EMPTY) {
+        free = idx;
+        break;
+      }
+      if (s.key == key) {
+        s.value = value;
+        mark_value(idx);
+        return true;
+      }
+      idx = next(idx);
+    }
+
+    if (free == capacity_ || full()) {
+      dirty_.stats().count_rejected_push();
+      return false;
+    }
+
+    slot& s = slots_[free];
+    s.key = key;
+    s.value = value;
+    s.state = SLOT_USED;
+    mark_slot(free);
+    ++(fields_.size);
+    mark_header();
+    return true;
+  }
+
+  /** Removes a key from the map.
+   *
+   * The keys stored after the erased one in its cluster are moved back when
+   * their probe sequence passes through the freed slot, so only the slots of
+   * that cluster are written.
+   *
+   * @param key The key to remove.
+   * @return True if the key was removed; false if it was not in the map.
+   */
+  bool erase(const key_type& key) {
+    size_type idx = lookup(key);
+    if (idx == capacity_)
+      return false;
+
+    // idx is the hole; a key can fill it if its home slot is not in
+    // (idx, pos], i.e., if its probe sequence goes through the hole.
+    size_type pos = next(idx);
+    for (size_type probes = 1; probes < capacity_; ++probes) {
+      const slot& s = slots_[pos];
+      if (s.state == SLOT_EMPTY)
+        break;
+      if (distance(home(s.key), pos) >= distance(idx, pos)) {
+        slots_[idx] = s;
+        mark_slot(idx);
+        idx = pos;
+      }
+      pos = next(pos);
+    }
+    set_state(idx, SLOT_EMPTY);
+
+    --(fields_.size);
+    mark_header();
+    return true;
+  }
+
+  /** Removes all the elements from the map. */
+  void clear() {
+    for (size_type i = 0; i < capacity_; ++i)
+      slots_[i].state = SLOT_EMPTY;
+    dirty_.mark(offset_ + DATA_OFFSET,
+        capacity_ * sizeof(slot));
+
+    fields_.size = 0;
+    mark_header();
+  }
+
+  /** Checks whether the map was modified since the last commit.
+   *
+   * @return True if there are uncommitted changes; false otherwise.
+   */
+  bool dirty() const {
+    return dirty_.dirty();
+  }
+
+  /** Makes the map's modifications persistent.
+   *
+   * The storage backend is only committed if the map was modified since the
+   * last commit; otherwise, this is a no-op.
+   *
+   * @return True if the changes were committed, or there was nothing to
+   *         commit; false otherwise.
+   */
+  bool commit() {
+    return dirty_.commit();
+  }
+
+#if defined(PERSISTENT_CONTAINERS_STATS)
+  /** Returns the map's statistics.
+   *
+   * Only available if PERSISTENT_CONTAINERS_STATS is defined.
+   *
+   * @return A constant reference to the statistics.
+   */
+  const persistent_stats& stats() const {
+    return dirty_.stats();
+  }
+
+  /** Returns the estimated erase cycles of the flash backing the map.
+   *
+   * This is the number of commits issued to the storage backend since boot,
+   * by any container. Only available if PERSISTENT_CONTAINERS_STATS is
+   * defined.
+   *
+   * @return The estimated erase cycles.
+   */
+  unsigned long estimated_erase_cycles() const {
+    return backend_commits<Backend>();
+  }
+#endif
+
+private:
+  struct slot {
+    key_type key;
+    mapped_type value;
+    uint8_t state;
+  };
+
+  struct header_fields {
+    size_type size;
+  };
+
+  typedef persistent_header<header_fields> header_type;
+
+  static constexpr uint8_t SLOT_EMPTY { 0 };
+  static constexpr uint8_t SLOT_USED { 1 };
+
+  // The key's and the value's schema versions take four bits each.
+  static constexpr unsigned SIGNATURE {
+    persistent_signature(persistent_kind::map, sizeof(slot),
+        static_cast<uint8_t>(persistent_schema<key_type>::version << 4
+            | persistent_schema<mapped_type>::version))
+  };
+
+  // Slots start right after the header, at the next multiple of their
+  // alignment.
+  static constexpr size_type DATA_OFFSET {
+    persistent_align(header_type::storage_size(), alignof(slot))
+  };
+
+  const size_type capacity_;
+  const size_type offset_;
+  header_type header_;
+  header_fields fields_;
+  slot* const slots_;
+  bool header_changed_;
+  dirty_range dirty_;
+
+  /** Writes the header before the storage is committed. */
+  static void on_commit(void* context, bool committed) {
+    persistent_map* map = static_cast<persistent_map*>(context);
+    if (!map->header_changed_)
+      return;
+
+    if (committed) {
+      map->header_.committed();
+      map->header_changed_ = false;
+    } else {
+      map->header_.stage(map->fields_);
+    }
+  }
+
+  size_type home(const key_type& key) const {
+    return persistent_hash<key_type>::hash(key) % capacity_;
+  }
+
+  size_type next(size_type idx) const {
+    return idx + 1 == capacity_ ? 0 : idx + 1;
+  }
+
+  /** Returns how many probes it takes to go from one slot to another. */
+  size_type distance(size_type from, size_type to) const {
+    return to >= from ? to - from : to + capacity_ - from;
+  }
+
+  /** Returns the slot holding a key, or the capacity if it is not found. */
+  size_type lookup(const key_type& key) const {
+    size_type idx = home(key);
+    for (size_type probes = 0; probes < capacity_; ++probes) {
+      const slot& s = slots_[idx];
+      if (s.state == SLOT_EMPTY)
+        break;
+      if (s.key == key)
+        return idx;
+      idx = next(idx);
+    }
+    return capacity_;
+  }
+
+  void set_state(size_type idx, uint8_t state) {
+    slots_[idx].state = state;
+    dirty_.mark(slot_offset(idx) + offsetof(slot, state), sizeof(uint8_t));
+    dirty_.stats().count_element_writes(1);
+  }
+
+  size_type slot_offset(size_type idx) const {
+    return offset_ + DATA_OFFSET + idx * sizeof(slot);
+  }
+
+  void mark_header() {
+    header_changed_ = true;
+    dirty_.mark(offset_ + header_.staged_offset(), header_type::copy_size());
+    dirty_.stats().count_header_write();
+  }
+
+  void mark_slot(size_type idx) {
+    dirty_.mark(slot_offset(idx), sizeof(slot));
+    dirty_.stats().count_element_writes(1);
+  }
+
+  void mark_value(size_type idx) {
+    dirty_.mark(slot_offset(idx) + offsetof(slot, value),
+        sizeof(mapped_type));
+    dirty_.stats().count_element_writes(1);
+  }
+
+  persistent_map() = delete;
+
+  persistent_map(const persistent_map& other) = delete;
+  persistent_map& operator=(const persistent_map& other) = delete;
+
+  persistent_map(persistent_map&& other) = delete;
+  persistent_map& operator=(persistent_map&& other) = delete;
+};
+
+#endif // PERSISTENT_MAP
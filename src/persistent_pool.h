@@ -0,0 +1,372 @@
+#ifndef PERSISTENT_POOL
+#define PERSISTENT_POOL
+
+#include "dirty_range.h"
+#include "eeprom_backend.h"
+#include "persistent_header.h"
+#include "persistent_signature.h"
+#include "persistent_traits.h"
+
+/** This class implements a fixed-size pool of elements.
+ *
+ * Elements are stored in slots that are allocated and freed in any order,
+ * and an element keeps its slot (its handle) until it is freed. Which slots
+ * are allocated is recorded in a bitmap, so allocating or freeing an element
+ * only writes its slot and one bitmap word; no other element is moved.
+ *
+ * The pool is stored on the EEPROM of an ESP8266 micro-controller.
+ * Modifications are only made to the EEPROM's RAM copy. They become
+ * persistent once commit() is called, so several operations can be grouped
+ * into a single flash write.
+ *
+ * @tparam T Element type.
+ * @tparam Backend Storage backend mapped in RAM (see eeprom_backend).
+ */
+template<class T, class Backend = eeprom_backend>
+class persistent_pool {
+public:
+  typedef T value_type;
+  typedef size_t size_type;
+  typedef Backend backend_type;
+  typedef size_t handle_type;
+  typedef value_type& reference;
+  typedef const value_type& const_reference;
+
+  static_assert(persistent_storable<value_type>::value,
+      "the element type must be trivially copyable");
+  static_assert(persistent_mapped<Backend>::value,
+      "the backend must be mapped in RAM; use a cached container instead");
+
+  /** Constructor.
+   *
+   * @param offset Offset from the storage's base address (a multiple of
+   *               persistent_max_align()).
+   * @param capacity Pool's capacity (in elements).
+   */
+  persistent_pool(int offset, size_type capacity)
+    : capacity_{capacity}
+    , offset_{static_cast<size_type>(offset)}
+    , header_{Backend::data() + offset, SIGNATURE}
+    , bitmap_{reinterpret_cast<uint32_t*>(
+          Backend::data() + offset + header_type::storage_size())}
+    , data_{reinterpret_cast<value_type*>(
+          Backend::data() + offset + storage_size(0, capacity))}
+    , size_{0}
+    , hint_{0}
+    , header_changed_{false}
+    , dirty_{&persistent_commit<Backend>, &persistent_pool::on_commit, this}
+  {
+    header_fields fields;
+    if (!header_.load(fields) || fields.capacity != capacity_) {
+      format();
+      return;
+    }
+
+    for (size_type w = 0; w < words(); ++w)
+      size_ += __builtin_popcountl(bitmap_[w] & word_mask(w));
+  }
+
+  /**
+   * Computes the necessary storage size to hold a pool of the given capacity.
+   *
+   * @param capacity Pool's capacity (in elements).
+   */
+  static constexpr size_type storage_size(size_type capacity) {
+    return storage_size(capacity, capacity);
+  }
+
+  /** Checks whether the pool is empty.
+   *
+   * @return True if no element is allocated; false otherwise.
+   */
+  bool empty() const {
+    return size() == 0;
+  }
+
+  /** Checks whether the pool is full.
+   *
+   * @return True if every slot is allocated; false otherwise.
+   */
+  bool full() const {
+    return size() == capacity();
+  }
+
+  /** Returns the pool's size.
+   *
+   * The size correspond to the number of elements currently allocated.
+   *
+   * @return The pool's size.
+   */
+  size_type size() const {
+    return size_;
+  }
+
+  /** Returns the pool's capacity.
+   *
+   * The capacity correspond to the maximum number of elements that the pool
+   * can store.
+   *
+   * @return The pool's capacity.
+   */
+  size_type capacity() const {
+    return capacity_;
+  }
+
+  /** Returns an element given its handle.
+   *
+   * The element is marked as modified, as it can be written through the
+   * returned reference.
+   *
+   * @param handle The element's handle, which must be allocated.
+   * @return A reference to the element.
+   */
+  reference operator[](handle_type handle) {
+    mark_element(handle);
+    return data_[handle];
+  }
+
+  /** Returns an element given its handle.
+   *
+   * @param handle The element's handle, which must be allocated.
+   * @return A constant reference to the element.
+   */
+  const_reference operator[](handle_type handle) const {
+    return data_[handle];
+  }
+
+  /** Checks whether a handle is allocated.
+   *
+   * @param handle The handle to check.
+   * @return True if the handle is allocated; false otherwise.
+   */
+  bool allocated(handle_type handle) const {
+    return handle < capacity_
+        && (bitmap_[handle / WORD_BITS] & bit(handle)) != 0;
+  }
+
+  /** Allocates a slot and stores an element on it.
+   *
+   * @param value The element to store.
+   * @param handle Where the element's handle is stored.
+   * @return True if the element was allocated; false if the pool is full.
+   */
+  bool allocate(const value_type& value, handle_type& handle) {
+    if (full()) {
+      dirty_.stats().count_rejected_push();
+      return false;
+    }
+
+    // hint_ is the first word that may have a free slot.
+    size_type w = hint_;
+    while ((~bitmap_[w] & word_mask(w)) == 0)
+      w = w + 1 == words() ? 0 : w + 1;
+    hint_ = w;
+
+    handle = w * WORD_BITS + __builtin_ctzl(~bitmap_[w]);
+    data_[handle] = value;
+    mark_element(handle);
+    bitmap_[w] |= bit(handle);
+    mark_word(w);
+    ++size_;
+    return true;
+  }
+
+  /** Frees a slot.
+   *
+   * The element on it is not modified; only the slot's bitmap word is
+   * written.
+   *
+   * @param handle The handle to free.
+   * @return True if the handle was freed; false if it was not allocated.
+   */
+  bool free(handle_type handle) {
+    if (!allocated(handle))
+      return false;
+
+    const size_type w = handle / WORD_BITS;
+    bitmap_[w] &= ~bit(handle);
+    mark_word(w);
+    if (w < hint_)
+      hint_ = w;
+    --size_;
+    return true;
+  }
+
+  /** Returns the first allocated handle from a given one.
+   *
+   * Allocated elements can be visited in handle order with:
+   *
+   *     for (h = pool.next(0); h < pool.capacity(); h = pool.next(h + 1))
+   *
+   * @param handle The handle to start from.
+   * @return The first allocated handle not lower than handle, or capacity()
+   *         if there is none.
+   */
+  handle_type next(handle_type handle) const {
+    while (handle < capacity_) {
+      const size_type w = handle / WORD_BITS;
+      const uint32_t bits = bitmap_[w] & word_mask(w) & ~(bit(handle) - 1);
+      if (bits != 0)
+        return w * WORD_BITS + __builtin_ctzl(bits);
+      handle = (w + 1) * WORD_BITS;
+    }
+    return capacity_;
+  }
+
+  /** Frees all the slots. */
+  void clear() {
+    for (size_type w = 0; w < words(); ++w) {
+      if (bitmap_[w] != 0) {
+        bitmap_[w] = 0;
+        mark_word(w);
+      }
+    }
+    size_ = 0;
+    hint_ = 0;
+  }
+
+  /** Checks whether the pool was modified since the last commit.
+   *
+   * @return True if there are uncommitted changes; false otherwise.
+   */
+  bool dirty() const {
+    return dirty_.dirty();
+  }
+
+  /** Makes the pool's modifications persistent.
+   *
+   * The storage backend is only committed if the pool was modified since the
+   * last commit; otherwise, this is a no-op.
+   *
+   * @return True if the changes were committed, or there was nothing to
+   *         commit; false otherwise.
+   */
+  bool commit() {
+    return dirty_.commit();
+  }
+
+#if defined(PERSISTENT_CONTAINERS_STATS)
+  /** Returns the pool's statistics.
+   *
+   * Only available if PERSISTENT_CONTAINERS_STATS is defined.
+   *
+   * @return A constant reference to the statistics.
+   */
+  const persistent_stats& stats() const {
+    return dirty_.stats();
+  }
+
+  /** Returns the estimated erase cycles of the flash backing the pool.
+   *
+   * This is the number of commits issued to the storage backend since boot,
+   * by any container. Only available if PERSISTENT_CONTAINERS_STATS is
+   * defined.
+   *
+   * @return The estimated erase cycles.
+   */
+  unsigned long estimated_erase_cycles() const {
+    return backend_commits<Backend>();
+  }
+#endif
+
+private:
+  // The header only changes when the pool is formatted; the element count is
+  // derived from the bitmap, so allocations do not rewrite it.
+  struct header_fields {
+    size_type capacity;
+  };
+
+  typedef persistent_header<header_fields> header_type;
+
+  static constexpr size_type WORD_BITS { 32 };
+
+  static constexpr unsigned SIGNATURE {
+    persistent_signature(persistent_kind::pool, sizeof(value_type),
+        persistent_schema<value_type>::version)
+  };
+
+  const size_type capacity_;
+  const size_type offset_;
+  header_type header_;
+  uint32_t* const bitmap_;
+  value_type* const data_;
+  size_type size_;
+  size_type hint_;
+  bool header_changed_;
+  dirty_range dirty_;
+
+  /** Writes the header before the storage is committed. */
+  static void on_commit(void* context, bool committed) {
+    persistent_pool* pool = static_cast<persistent_pool*>(context);
+    if (!pool->header_changed_)
+      return;
+
+    if (committed) {
+      pool->header_.committed();
+      pool->header_changed_ = false;
+    } else {
+      const header_fields fields { pool->capacity_ };
+      pool->header_.stage(fields);
+    }
+  }
+
+  /** Computes the storage size needed by the given number of elements of a
+   * pool with the given capacity.
+   *
+   * Elements start right after the bitmap, at the next multiple of their
+   * alignment.
+   */
+  static constexpr size_type storage_size(size_type count, size_type capacity) {
+    return persistent_align(header_type::storage_size()
+        + (capacity + WORD_BITS - 1) / WORD_BITS * sizeof(uint32_t),
+        alignof(value_type)) + count * sizeof(value_type);
+  }
+
+  size_type words() const {
+    return (capacity_ + WORD_BITS - 1) / WORD_BITS;
+  }
+
+  static uint32_t bit(handle_type handle) {
+    return uint32_t(1) << (handle % WORD_BITS);
+  }
+
+  /** Returns the bits of a bitmap word that correspond to actual slots. */
+  uint32_t word_mask(size_type w) const {
+    const size_type used = capacity_ - w * WORD_BITS;
+    return used >= WORD_BITS ? ~uint32_t(0) : (uint32_t(1) << used) - 1;
+  }
+
+  void format() {
+    for (size_type w = 0; w < words(); ++w)
+      bitmap_[w] = 0;
+    dirty_.mark(offset_ + header_type::storage_size(),
+        words() * sizeof(uint32_t));
+
+    header_changed_ = true;
+    dirty_.mark(offset_ + header_.staged_offset(), header_type::copy_size());
+    dirty_.stats().count_header_write();
+  }
+
+  void mark_word(size_type w) {
+    dirty_.mark(
+        offset_ + header_type::storage_size() + w * sizeof(uint32_t),
+        sizeof(uint32_t));
+    dirty_.stats().count_header_write();
+  }
+
+  void mark_element(handle_type handle) {
+    dirty_.mark(
+        offset_ + storage_size(handle, capacity_), sizeof(value_type));
+    dirty_.stats().count_element_writes(1);
+  }
+
+  persistent_pool() = delete;
+
+  persistent_pool(const persistent_pool& other) = delete;
+  persistent_pool& operator=(const persistent_pool& other) = delete;
+
+  persistent_pool(persistent_pool&& other) = delete;
+  persistent_pool& operator=(persistent_pool&& other) = delete;
+};
+
+#endif // PERSISTENT_POOL
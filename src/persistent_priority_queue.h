@@ -0,0 +1,302 @@
+#ifndef PERSISTENT_PRIORITY_QUEUE
+#define PERSISTENT_PRIORITY_QUEUE
+
+#include "dirty_range.h"
+#include "eeprom_backend.h"
+#include "persistent_header.h"
+#include "persistent_less.h"
+#include "persistent_signature.h"
+#include "persistent_traits.h"
+
+/** This class implements a fixed-size priority queue.
+ *
+ * Elements are kept as a binary heap, so the element at the top is the
+ * first one in the order given by Compare (e.g., the earliest due time with
+ * persistent_less), and it is read in constant time. Pushing and popping
+ * take logarithmic time, and they only write the elements on the path
+ * between the top and the bottom of the heap.
+ *
+ * Modifications are only made to the storage's RAM copy. They become
+ * persistent once commit() is called, so several operations can be grouped
+ * into a single flash write.
+ *
+ * The queue's header is double-buffered (see persistent_header).
+ *
+ * @tparam T Element type.
+ * @tparam Compare Function object that returns true if its first argument
+ *                 goes before its second one.
+ * @tparam Backend Storage backend mapped in RAM (see eeprom_backend).
+ */
+template<class T, class Compare = persistent_less<T>,
+    class Backend = eeprom_backend>
+class persistent_priority_queue {
+public:
+  typedef T value_type;
+  typedef std::size_t size_type;
+  typedef Backend backend_type;
+  typedef const value_type& const_reference;
+
+  static_assert(persistent_storable<value_type>::value,
+      "the element type must be trivially copyable");
+  static_assert(persistent_mapped<Backend>::value,
+      "the backend must be mapped in RAM; use a cached container instead");
+
+  /** Constructor.
+   *
+   * @param offset Offset from the storage's base address (a multiple of
+   *               persistent_max_align()).
+   * @param capacity Queue's capacity (in elements).
+   */
+  persistent_priority_queue(int offset, size_type capacity)
+    : capacity_{capacity}
+    , offset_{static_cast<size_type>(offset)}
+    , header_{Backend::data() + offset, SIGNATURE}
+    , data_{reinterpret_cast<value_type*>(
+          Backend::data() + offset + DATA_OFFSET)}
+    , header_changed_{false}
+    , dirty_{&persistent_commit<Backend>,
+          &persistent_priority_queue::on_commit, this}
+  {
+    if (!header_.load(fields_) || fields_.size > capacity_) {
+      fields_.size = 0;
+      mark_header();
+    }
+  }
+
+  /**
+   * Computes the necessary storage size to hold a queue of the given capacity.
+   *
+   * @param capacity Queue's capacity (in elements).
+   */
+  static constexpr size_type storage_size(size_type capacity) {
+    return DATA_OFFSET + capacity * sizeof(value_type);
+  }
+
+  /** Checks whether the queue is empty.
+   *
+   * @return True if the queue is empty; false otherwise.
+   */
+  bool empty() const {
+    return size() == 0;
+  }
+
+  /** Checks whether the queue is full.
+   *
+   * @return True if the queue is full; false otherwise.
+   */
+  bool full() const {
+    return size() == capacity();
+  }
+
+  /** Returns the queue's size.
+   *
+   * The size correspond to the number of elements currently in the queue.
+   *
+   * @return The queue's size.
+   */
+  size_type size() const {
+    return fields_.size;
+  }
+
+  /** Returns the queue's capacity.
+   *
+   * The capacity correspond to the maximum number of elements that the queue
+   * can store.
+   *
+   * @return The queue's capacity.
+   */
+  size_type capacity() const {
+    return capacity_;
+  }
+
+  /** Returns the element at the queue's top.
+   *
+   * @return The first element in the queue's order.
+   */
+  const_reference top() const {
+    return data_[0];
+  }
+
+  /** Pushes an element into the queue.
+   *
+   * The element moves up from the bottom of the heap while it goes before
+   * its parent.
+   *
+   * @param value The element to be pushed.
+   * @return True if the element was insterted; false otherwise.
+   */
+  bool push(const value_type& value) {
+    if (full()) {
+      dirty_.stats().count_rejected_push();
+      return false;
+    }
+
+    size_type hole = fields_.size;
+    while (hole > 0) {
+      const size_type parent = (hole - 1) / 2;
+      if (!Compare()(value, data_[parent]))
+        break;
+      move(parent, hole);
+      hole = parent;
+    }
+
+    data_[hole] = value;
+    mark_element(hole);
+    ++(fields_.size);
+    mark_header();
+    return true;
+  }
+
+  /** Pops the element at the queue's top.
+   *
+   * The last element of the heap moves down from the top while one of its
+   * children goes before it.
+   *
+   * @return True if there was an element to pop; false otherwise.
+   */
+  bool pop() {
+    if (empty())
+      return false;
+
+    const size_type size = --(fields_.size);
+    mark_header();
+    if (size == 0)
+      return true;
+
+    const value_type last = data_[size];
+    size_type hole = 0;
+    for (;;) {
+      size_type child = 2 * hole + 1;
+      if (child >= size)
+        break;
+      if (child + 1 < size && Compare()(data_[child + 1], data_[child]))
+        ++child;
+      if (!Compare()(data_[child], last))
+        break;
+      move(child, hole);
+      hole = child;
+    }
+
+    data_[hole] = last;
+    mark_element(hole);
+    return true;
+  }
+
+  /** Removes all the elements from the queue. */
+  void clear() {
+    fields_.size = 0;
+    mark_header();
+  }
+
+  /** Checks whether the queue was modified since the last commit.
+   *
+   * @return True if there are uncommitted changes; false otherwise.
+   */
+  bool dirty() const {
+    return dirty_.dirty();
+  }
+
+  /** Makes the queue's modifications persistent.
+   *
+   * The storage backend is only committed if the queue was modified since
+   * the last commit; otherwise, this is a no-op.
+   *
+   * @return True if the changes were committed, or there was nothing to
+   *         commit; false otherwise.
+   */
+  bool commit() {
+    return dirty_.commit();
+  }
+
+#if defined(PERSISTENT_CONTAINERS_STATS)
+  /** Returns the queue's statistics.
+   *
+   * Only available if PERSISTENT_CONTAINERS_STATS is defined.
+   *
+   * @return A constant reference to the statistics.
+   */
+  const persistent_stats& stats() const {
+    return dirty_.stats();
+  }
+
+  /** Returns the estimated erase cycles of the flash backing the queue.
+   *
+   * This is the number of commits issued to the storage backend since boot,
+   * by any container. Only available if PERSISTENT_CONTAINERS_STATS is
+   * defined.
+   *
+   * @return The estimated erase cycles.
+   */
+  unsigned long estimated_erase_cycles() const {
+    return backend_commits<Backend>();
+  }
+#endif
+
+private:
+  struct header_fields {
+    size_type size;
+  };
+
+  typedef persistent_header<header_fields> header_type;
+
+  // Elements start right after the header, at the next multiple of their
+  // alignment.
+  static constexpr size_type DATA_OFFSET {
+    persistent_align(header_type::storage_size(), alignof(value_type))
+  };
+
+  static constexpr unsigned SIGNATURE {
+    persistent_signature(persistent_kind::priority_queue, sizeof(value_type),
+        persistent_schema<value_type>::version)
+  };
+
+  const size_type capacity_;
+  const size_type offset_;
+  header_type header_;
+  header_fields fields_;
+  value_type* const data_;
+  bool header_changed_;
+  dirty_range dirty_;
+
+  /** Writes the header before the storage is committed. */
+  static void on_commit(void* context, bool committed) {
+    persistent_priority_queue* queue =
+        static_cast<persistent_priority_queue*>(context);
+    if (!queue->header_changed_)
+      return;
+
+    if (committed) {
+      queue->header_.committed();
+      queue->header_changed_ = false;
+    } else {
+      queue->header_.stage(queue->fields_);
+    }
+  }
+
+  /** Moves an element into the hole left on the sift path. */
+  void move(size_type from, size_type to) {
+    data_[to] = data_[from];
+    mark_element(to);
+  }
+
+  void mark_header() {
+    header_changed_ = true;
+    dirty_.mark(offset_ + header_.staged_offset(), header_type::copy_size());
+    dirty_.stats().count_header_write();
+  }
+
+  void mark_element(size_type pos) {
+    dirty_.mark(offset_ + storage_size(pos), sizeof(value_type));
+    dirty_.stats().count_element_writes(1);
+  }
+
+  persistent_priority_queue() = delete;
+
+  persistent_priority_queue(const persistent_priority_queue& other) = delete;
+  persistent_priority_queue& operator=(const persistent_priority_queue& other) = delete;
+
+  persistent_priority_queue(persistent_priority_queue&& other) = delete;
+  persistent_priority_queue& operator=(persistent_priority_queue&& other) = delete;
+};
+
+#endif // PERSISTENT_PRIORITY_QUEUE
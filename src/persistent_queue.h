@@ -1,36 +1,87 @@
 #ifndef PERSISTENT_QUEUE
 #define PERSISTENT_QUEUE
 
-#include <EEPROM.h>
+#include "dirty_range.h"
+#include "eeprom_backend.h"
+#include "persistent_header.h"
+#include "persistent_lock.h"
+#include "persistent_signature.h"
+#include "persistent_traits.h"
 
 /** This class implements a fixed-size circular queue.
  *
  * The queue is stored on the EEPROM of an ESP8266 micro-controller.
+ *
+ * Modifications are only made to the EEPROM's RAM copy. They become
+ * persistent once commit() is called, so several operations can be grouped
+ * into a single flash write.
+ *
+ * The queue's header is double-buffered (see persistent_header).
+ *
+ * With a lock policy other than persistent_no_lock, the queue can be shared
+ * between tasks (e.g., on both cores of the ESP32) or interrupt handlers.
+ * Every operation that modifies the queue, or copies its elements, holds
+ * the lock. size(), empty() and full() read a single word and take no lock.
+ * front() only takes it to mark the element as modified, and the spans take
+ * none; the elements they return are only safe to access in the single
+ * consumer's context. commit() holds the lock only while staging the header
+ * and taking the modified range, so the other contexts keep pushing and
+ * popping while the storage is committed. Meanwhile, the slots of popped
+ * elements are not reused, as the staged header still covers them, and
+ * push_overwrite() is rejected if there is no free slot. commit() must be
+ * called from one context at a time, and not within a transaction.
+ *
+ * @tparam T Element type.
+ * @tparam Backend Storage backend mapped in RAM (see eeprom_backend).
+ * @tparam Lock Lock policy (see persistent_lock.h).
  */
-template<class T>
+template<class T, class Backend = eeprom_backend,
+    class Lock = persistent_no_lock>
 class persistent_queue {
 public:
   typedef T value_type;
   typedef std::size_t size_type;
+  typedef Backend backend_type;
   typedef value_type& reference;
   typedef const value_type& const_reference;
+
+  static_assert(persistent_storable<value_type>::value,
+      "the element type must be trivially copyable");
+  static_assert(persistent_mapped<Backend>::value,
+      "the backend must be mapped in RAM; use a cached container instead");
+
+  /** Contiguous sequence of elements stored in the queue. */
+  struct const_span {
+    const value_type* data;
+    size_type size;
+  };
  
   /** Constructor.
    *
-   * @param offset Offset from the EEPROM base address.
+   * @param offset Offset from the storage's base address (a multiple of
+   *               persistent_max_align()).
    * @param capacity Queue's capacity (in elements).
    */ 
   persistent_queue(int offset, size_type capacity)
     : capacity_{capacity}
+    , offset_{static_cast<size_type>(offset)}
+    , header_{Backend::data() + offset, SIGNATURE}
+    , data_{reinterpret_cast<value_type*>(
+          Backend::data() + offset + DATA_OFFSET)}
+    , header_changed_{false}
+    , header_staged_{false}
+    , committing_{false}
+    , pinned_{0}
+    , dirty_{&persistent_commit<Backend>, &persistent_queue::on_commit, this}
   {
-    uint8_t* data = EEPROM.getDataPtr() + offset;
-    storage_ = reinterpret_cast<storage_area*>(data);
-            
-    if (storage_->signature != SIGNATURE) {
-      storage_->signature = SIGNATURE;
-      storage_->begin = 0;
-      storage_->end = 0;
-      storage_->size = 0;
+    if (!header_.load(fields_)
+        || fields_.begin >= capacity_
+        || fields_.end >= capacity_
+        || fields_.size > capacity_) {
+      fields_.begin = 0;
+      fields_.end = 0;
+      fields_.size = 0;
+      mark_header();
     }
   }
 
@@ -40,11 +91,7 @@ public:
    * @param capacity Queue's capacity (in elements).
    */
   static constexpr size_type storage_size(size_type capacity) {
-    return sizeof(storage_area::signature)
-        + sizeof(storage_area::begin)
-        + sizeof(storage_area::end)
-        + sizeof(storage_area::size)
-        + capacity * sizeof(value_type);
+    return DATA_OFFSET + capacity * sizeof(value_type);
   }
 
   /** Checks whether the queue is empty.
@@ -70,7 +117,7 @@ public:
    * @return The queue's size.
    */
   size_type size() const {
-    return storage_->size;
+    return fields_.size;
   }
 
   /** Returns the queue's capacity.
@@ -85,11 +132,16 @@ public:
   }
 
   /** Returns the element at the queue's front.
+   *
+   * The element is marked as modified, as it can be written through the
+   * returned reference.
    *
    * @return The element at the front.
    */
   reference front() {
-    return storage_->data()[storage_->begin];
+    persistent_lock_guard<Lock> guard(lock_);
+    mark_element(fields_.begin);
+    return data_[fields_.begin];
   }
 
   /** Returns the element at the queue's front.
@@ -97,7 +149,31 @@ public:
    * @return The element at the front.
    */
   const_reference front() const {
-    return storage_->data()[storage_->begin];
+    return data_[fields_.begin];
+  }
+
+  /** Returns the elements at the queue's front that are stored contiguously.
+   *
+   * The span covers the queue's elements up to the point where the storage
+   * wraps around; second_span() covers the rest. Together, they allow
+   * reading the queue's elements in place, without copying them. Once
+   * processed, the elements can be removed with pop(count).
+   *
+   * @return The first span of elements (empty if the queue is empty).
+   */
+  const_span first_span() const {
+    return { &data_[fields_.begin],
+             contiguous(fields_.begin, size()) };
+  }
+
+  /** Returns the elements that follow first_span().
+   *
+   * @return The second span of elements (empty if the queue's elements do
+   *         not wrap around).
+   */
+  const_span second_span() const {
+    return { &data_[0],
+             size() - contiguous(fields_.begin, size()) };
   }
 
   /** Pushes an element into the queue.
@@ -108,12 +184,17 @@ public:
    * @return True if the element was insterted; false otherwise. 
    */
   bool push(const value_type& value) {
-    if (full())
+    persistent_lock_guard<Lock> guard(lock_);
+    if (room() == 0) {
+      dirty_.stats().count_rejected_push();
       return false;
+    }
     
-    storage_->data()[storage_->end] = value;
-    increment(storage_->end);
-    ++(storage_->size);
+    data_[fields_.end] = value;
+    mark_element(fields_.end);
+    increment(fields_.end);
+    ++(fields_.size);
+    mark_header();
     return true;
   }
 
@@ -125,15 +206,124 @@ public:
    * @return True if the element was insterted; false otherwise. 
    */
   bool push(value_type&& value) {
-    if (full())
+    persistent_lock_guard<Lock> guard(lock_);
+    if (room() == 0) {
+      dirty_.stats().count_rejected_push();
       return false;
+    }
 
-    storage_->data()[storage_->end] = std::move(value);
-    increment(storage_->end);
-    ++(storage_->size);
+    data_[fields_.end] = std::move(value);
+    mark_element(fields_.end);
+    increment(fields_.end);
+    ++(fields_.size);
+    mark_header();
     return true;
   }
 
+  /** Pushes an element into the queue, overwriting the oldest one if full.
+   *
+   * The element is pushed at the end of the queue. If the queue is full, the
+   * element at the front is dropped to make room for it, so that the queue
+   * keeps the most recent elements. Either way, the queue's header is
+   * updated only once.
+   *
+   * @param value The element to be pushed.
+   * @return True if the element at the front was overwritten; false
+   *         otherwise.
+   */
+  bool push_overwrite(const value_type& value) {
+    persistent_lock_guard<Lock> guard(lock_);
+    if (pinned_full())
+      return false;
+
+    data_[fields_.end] = value;
+    return overwrite_end();
+  }
+
+  /** Pushes an element into the queue, overwriting the oldest one if full.
+   *
+   * The element is pushed at the end of the queue. If the queue is full, the
+   * element at the front is dropped to make room for it, so that the queue
+   * keeps the most recent elements. Either way, the queue's header is
+   * updated only once.
+   *
+   * @param value The element to be pushed.
+   * @return True if the element at the front was overwritten; false
+   *         otherwise.
+   */
+  bool push_overwrite(value_type&& value) {
+    persistent_lock_guard<Lock> guard(lock_);
+    if (pinned_full())
+      return false;
+
+    data_[fields_.end] = std::move(value);
+    return overwrite_end();
+  }
+
+  /** Pushes several elements into the queue.
+   *
+   * The elements are pushed at the end of the queue, in order, until the
+   * queue becomes full. The queue's header is updated only once.
+   *
+   * @param first Iterator to the first element to be pushed.
+   * @param last Iterator past the last element to be pushed.
+   * @return The number of elements inserted.
+   */
+  template<class InputIt>
+  size_type push(InputIt first, InputIt last) {
+    persistent_lock_guard<Lock> guard(lock_);
+    const size_type start = fields_.end;
+    const size_type available = room();
+    size_type count = 0;
+    for (; first != last && count < available; ++first, ++count) {
+      data_[fields_.end] = *first;
+      increment(fields_.end);
+    }
+
+    if (first != last)
+      dirty_.stats().count_rejected_push();
+
+    if (count == 0)
+      return 0;
+
+    mark_elements(start, count);
+    fields_.size += count;
+    mark_header();
+    return count;
+  }
+
+  /** Pushes several elements into the queue.
+   *
+   * The elements are pushed at the end of the queue, in order, until the
+   * queue becomes full. Elements are copied with at most two calls to
+   * memcpy, and the queue's header is updated only once.
+   *
+   * @param values Pointer to the first element to be pushed.
+   * @param count Number of elements to be pushed.
+   * @return The number of elements inserted.
+   */
+  size_type push(const value_type* values, size_type count) {
+    persistent_lock_guard<Lock> guard(lock_);
+    if (count > room()) {
+      dirty_.stats().count_rejected_push();
+      count = room();
+    }
+    if (count == 0)
+      return 0;
+
+    const size_type first_part = contiguous(fields_.end, count);
+    memcpy(&data_[fields_.end], values,
+        first_part * sizeof(value_type));
+    memcpy(&data_[0], values + first_part,
+        (count - first_part) * sizeof(value_type));
+
+    mark_elements(fields_.end, count);
+    advance(fields_.end, count);
+    fields_.size += count;
+    mark_header();
+    return count;
+  }
+
   /** Pops an element from the queue.
    *
    * The element at the front is popped (removed).
@@ -141,40 +331,247 @@ public:
    * @return True if there was an element to pop; false otherwise.
    */
   bool pop() {
+    persistent_lock_guard<Lock> guard(lock_);
     if (empty())
       return false;
 
-    increment(storage_->begin);
-    --(storage_->size);
+    pin(1);
+    increment(fields_.begin);
+    --(fields_.size);
+    mark_header();
     return true;
   }
 
+  /** Pops several elements from the queue.
+   *
+   * The elements at the front are popped (removed). The queue's header is
+   * updated only once.
+   *
+   * @param count Number of elements to pop.
+   * @return The number of elements popped, which is lower than count if the
+   *         queue did not have enough elements.
+   */
+  size_type pop(size_type count) {
+    persistent_lock_guard<Lock> guard(lock_);
+    if (count > size())
+      count = size();
+    if (count == 0)
+      return 0;
+
+    pin(count);
+    advance(fields_.begin, count);
+    fields_.size -= count;
+    mark_header();
+    return count;
+  }
+
+  /** Copies elements from the queue's front without popping them.
+   *
+   * Elements are copied with at most two calls to memcpy.
+   *
+   * @param values Pointer to the buffer where elements are copied.
+   * @param count Maximum number of elements to copy.
+   * @return The number of elements copied, which is lower than count if the
+   *         queue did not have enough elements.
+   */
+  size_type read(value_type* values, size_type count) const {
+    persistent_lock_guard<Lock> guard(lock_);
+    if (count > size())
+      count = size();
+    if (count == 0)
+      return 0;
+
+    const size_type first_part = contiguous(fields_.begin, count);
+    memcpy(values, &data_[fields_.begin],
+        first_part * sizeof(value_type));
+    memcpy(values + first_part, &data_[0],
+        (count - first_part) * sizeof(value_type));
+    return count;
+  }
+
+  /** Checks whether the queue was modified since the last commit.
+   *
+   * @return True if there are uncommitted changes; false otherwise.
+   */
+  bool dirty() const {
+    return dirty_.dirty();
+  }
+
+  /** Makes the queue's modifications persistent.
+   *
+   * The storage backend is only committed if the queue was modified since
+   * the last commit; otherwise, this is a no-op.
+   *
+   * @return True if the changes were committed, or there was nothing to
+   *         commit; false otherwise.
+   */
+  bool commit() {
+    set_committing(true);
+    const bool committed = dirty_.commit(lock_);
+    set_committing(false);
+    return committed;
+  }
+
+#if defined(PERSISTENT_CONTAINERS_STATS)
+  /** Returns the queue's statistics.
+   *
+   * Only available if PERSISTENT_CONTAINERS_STATS is defined.
+   *
+   * @return A constant reference to the statistics.
+   */
+  const persistent_stats& stats() const {
+    return dirty_.stats();
+  }
+
+  /** Returns the estimated erase cycles of the flash backing the queue.
+   *
+   * This is the number of commits issued to the storage backend since boot,
+   * by any container. Only available if PERSISTENT_CONTAINERS_STATS is
+   * defined.
+   *
+   * @return The estimated erase cycles.
+   */
+  unsigned long estimated_erase_cycles() const {
+    return backend_commits<Backend>();
+  }
+#endif
+
 private:
-  struct storage_area {
-    unsigned signature;
+  struct header_fields {
     unsigned begin;
     unsigned end;
     size_type size;
-    
-    value_type* data() {
-      uint8_t* ptr_to_data =
-          reinterpret_cast<uint8_t*>(&signature)
-          + sizeof(signature)
-          + sizeof(begin)
-          + sizeof(end)
-          + sizeof(size);
-      return reinterpret_cast<value_type*>(ptr_to_data);
-    }
   };
 
-  static constexpr unsigned SIGNATURE { 0xa2bedef9 };
+  typedef persistent_header<header_fields> header_type;
+
+  // Elements start right after the header, at the next multiple of their
+  // alignment.
+  static constexpr size_type DATA_OFFSET {
+    persistent_align(header_type::storage_size(), alignof(value_type))
+  };
+
+  static constexpr unsigned SIGNATURE {
+    persistent_signature(persistent_kind::queue, sizeof(value_type),
+        persistent_schema<value_type>::version)
+  };
   
   const size_type capacity_;
-  storage_area* storage_;
+  const size_type offset_;
+  header_type header_;
+  header_fields fields_;
+  value_type* const data_;
+  bool header_changed_;
+  bool header_staged_;
+  bool committing_;
+  size_type pinned_;
+  mutable Lock lock_;
+  dirty_range dirty_;
+
+  /** Writes the header before the storage is committed.
+   *
+   * The header may change again while the storage is being committed, so
+   * the copy staged is tracked apart from the pending changes.
+   */
+  static void on_commit(void* context, bool committed) {
+    persistent_queue* queue = static_cast<persistent_queue*>(context);
+    if (committed) {
+      if (queue->header_staged_)
+        queue->header_.committed();
+      queue->header_staged_ = false;
+    } else if (queue->header_changed_ || queue->header_staged_) {
+      queue->header_.stage(queue->fields_);
+      queue->dirty_.mark(queue->offset_ + queue->header_.staged_offset(),
+          header_type::copy_size());
+      queue->header_changed_ = false;
+      queue->header_staged_ = true;
+    }
+  }
+
+  /** Returns the number of slots that can be pushed into.
+   *
+   * While a commit is in progress, the slots of the elements popped since
+   * it started are still covered by the staged header.
+   */
+  size_type room() const {
+    return capacity_ - fields_.size - pinned_;
+  }
+
+  /** Checks whether push_overwrite() would overwrite a slot covered by the
+   * header being committed, and counts a rejected push if so.
+   */
+  bool pinned_full() {
+    if (!committing_ || room() > 0)
+      return false;
 
-  void increment(unsigned& idx) const {
-    if (++idx == capacity_)
+    dirty_.stats().count_rejected_push();
+    return true;
+  }
+
+  void pin(size_type count) {
+    if (committing_)
+      pinned_ += count;
+  }
+
+  void set_committing(bool committing) {
+    persistent_lock_guard<Lock> guard(lock_);
+    committing_ = committing;
+    pinned_ = 0;
+  }
+
+  void increment(unsigned& idx) {
+    if (++idx == capacity_) {
       idx = 0;
+      dirty_.stats().count_wrap_around();
+    }
+  }
+
+  void advance(unsigned& idx, size_type count) {
+    idx += count;
+    if (idx >= capacity_) {
+      idx -= capacity_;
+      dirty_.stats().count_wrap_around();
+    }
+  }
+
+  /** Returns how many of count elements starting at idx fit before the
+   * storage wraps around.
+   */
+  size_type contiguous(unsigned idx, size_type count) const {
+    return count < capacity_ - idx ? count : capacity_ - idx;
+  }
+
+  /** Completes push_overwrite() once the element is stored at the end. */
+  bool overwrite_end() {
+    mark_element(fields_.end);
+    increment(fields_.end);
+
+    const bool overwritten = full();
+    if (overwritten)
+      fields_.begin = fields_.end;
+    else
+      ++(fields_.size);
+    mark_header();
+    return overwritten;
+  }
+
+  void mark_header() {
+    header_changed_ = true;
+    dirty_.mark(offset_ + header_.staged_offset(), header_type::copy_size());
+    dirty_.stats().count_header_write();
+  }
+
+  void mark_element(unsigned idx) {
+    dirty_.mark(offset_ + storage_size(idx), sizeof(value_type));
+    dirty_.stats().count_element_writes(1);
+  }
+
+  void mark_elements(unsigned idx, size_type count) {
+    const size_type first_part = contiguous(idx, count);
+    dirty_.mark(offset_ + storage_size(idx), first_part * sizeof(value_type));
+    dirty_.mark(offset_ + storage_size(0),
+        (count - first_part) * sizeof(value_type));
+    dirty_.stats().count_element_writes(count);
   }
 
   persistent_queue() = delete;
@@ -0,0 +1,88 @@
+#ifndef PERSISTENT_SIGNATURE
+#define PERSISTENT_SIGNATURE
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Kinds of persistent containers, as encoded in their signatures. */
+enum class persistent_kind : uint8_t {
+  queue = 1,
+  vector = 2,
+  static_queue = 3,
+  static_vector = 4,
+  cached_queue = 5,
+  cached_vector = 6,
+  log_queue = 7,
+  map = 8,
+  pool = 9,
+  bitset = 10,
+  counters = 11,
+  flash_counter = 12,
+  compressed_queue = 13,
+  staged_queue = 14,
+  priority_queue = 15,
+  blob_queue = 16,
+};
+
+/** This class holds the schema version of a container's element type.
+ *
+ * The version is part of the container's signature, so bumping it when the
+ * element type changes its meaning (but not its size) makes the containers
+ * storing it start over instead of misreading old elements. Specialize it
+ * for the element type:
+ *
+ *     template<> struct persistent_schema<sample> {
+ *       static constexpr uint8_t version = 2;
+ *     };
+ *
+ * @tparam T Element type.
+ */
+template<class T>
+struct persistent_schema {
+  static constexpr uint8_t version = 0;
+};
+
+/** Computes the signature of a container.
+ *
+ * The signature encodes the container's kind, its element size and the
+ * element's schema version, so that a region formatted by a container is
+ * not reinterpreted as a different container or element type. Kinds above
+ * 15 also change the signature's top nibble, so the signatures of the first
+ * fifteen kinds are unchanged.
+ *
+ * @param kind Container's kind.
+ * @param element_size Size of the container's elements.
+ * @param version Schema version of the container's elements.
+ * @return The container's signature.
+ */
+constexpr uint32_t persistent_signature(persistent_kind kind,
+    size_t element_size, uint8_t version) {
+  return 0xa0000000u
+      | (static_cast<uint32_t>(kind) & 0x1f) << 24
+      | (static_cast<uint32_t>(element_size) & 0xffff) << 8
+      | version;
+}
+
+// Not constexpr: reaching it while computing a constant fails the build.
+inline void persistent_signature16_kind_above_15() {}
+
+/** Computes the signature of a container, folded into 16 bits.
+ *
+ * Only the kinds up to 15 fit, so computing the signature of a later kind as
+ * a constant (e.g., a static constexpr member) fails to compile.
+ *
+ * @param kind Container's kind.
+ * @param element_size Size of the container's elements.
+ * @param version Schema version of the container's elements.
+ * @return The container's 16-bit signature.
+ */
+constexpr uint16_t persistent_signature16(persistent_kind kind,
+    size_t element_size, uint8_t version) {
+  return static_cast<uint32_t>(kind) < 16
+      ? static_cast<uint16_t>(
+          (static_cast<uint32_t>(kind) << 12 | 0x0a00 | version)
+          ^ (static_cast<uint32_t>(element_size) * 0x9e37u))
+      : (persistent_signature16_kind_above_15(), uint16_t(0));
+}
+
+#endif // PERSISTENT_SIGNATURE
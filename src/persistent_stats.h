@@ -0,0 +1,106 @@
+#ifndef PERSISTENT_STATS
+#define PERSISTENT_STATS
+
+#include <stddef.h>
+
+#if defined(PERSISTENT_CONTAINERS_STATS)
+
+/** This class counts the storage operations performed by a container.
+ *
+ * Statistics are only collected when PERSISTENT_CONTAINERS_STATS is defined
+ * before including the containers; otherwise, this class has no members and
+ * counting compiles to nothing. Counters are kept in RAM and start from zero
+ * whenever the container is constructed.
+ */
+struct persistent_stats {
+  /** Number of elements written, or accessed through a non-const reference. */
+  unsigned long element_writes;
+
+  /** Number of header updates. */
+  unsigned long header_writes;
+
+  /** Number of calls to commit(). */
+  unsigned long commits_requested;
+
+  /** Number of commits that wrote the container's changes to storage. */
+  unsigned long commits;
+
+  /** Number of times an index wrapped around the end of the storage. */
+  unsigned long wrap_arounds;
+
+  /** Number of pushes that could not insert all their elements because the
+   * container was full.
+   */
+  unsigned long rejected_pushes;
+
+  persistent_stats() {
+    reset();
+  }
+
+  /** Sets all the counters to zero. */
+  void reset() {
+    element_writes = 0;
+    header_writes = 0;
+    commits_requested = 0;
+    commits = 0;
+    wrap_arounds = 0;
+    rejected_pushes = 0;
+  }
+
+  void count_element_writes(size_t count) { element_writes += count; }
+  void count_header_write() { ++header_writes; }
+  void count_commit_request() { ++commits_requested; }
+  void count_commit() { ++commits; }
+  void count_wrap_around() { ++wrap_arounds; }
+  void count_rejected_push() { ++rejected_pushes; }
+};
+
+/** Returns the number of commits issued to a storage backend.
+ *
+ * With EEPROM emulation, every commit erases the flash sector backing the
+ * EEPROM, so this is an estimate of the sector's erase cycles since boot.
+ *
+ * @tparam Backend Storage backend.
+ * @return A reference to the backend's commit counter.
+ */
+template<class Backend>
+unsigned long& backend_commits() {
+  static unsigned long count = 0;
+  return count;
+}
+
+#else
+
+struct persistent_stats {
+  void count_element_writes(size_t) {}
+  void count_header_write() {}
+  void count_commit_request() {}
+  void count_commit() {}
+  void count_wrap_around() {}
+  void count_rejected_push() {}
+};
+
+#endif
+
+/** Commits a storage backend.
+ *
+ * Containers commit through this function, so that commits can be counted
+ * per backend when statistics are enabled.
+ *
+ * @tparam Backend Storage backend.
+ * @return True if data was committed; false otherwise.
+ */
+template<class Backend>
+bool persistent_commit() {
+#if defined(PERSISTENT_CONTAINERS_STATS)
+  if (!Backend::commit())
+    return false;
+
+  ++backend_commits<Backend>();
+  return true;
+#else
+  return Backend::commit();
+#endif
+}
+
+#endif // PERSISTENT_STATS
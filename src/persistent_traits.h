@@ -0,0 +1,62 @@
+#ifndef PERSISTENT_TRAITS
+#define PERSISTENT_TRAITS
+
+#include <stddef.h>
+
+/** This class tells whether a type can be stored in a container.
+ *
+ * Containers store their elements as raw bytes, which are copied around
+ * and read back after a reboot without running any constructor, so element
+ * types must be trivially copyable (e.g., not std::string or String). The
+ * check uses the compiler's builtins, as <type_traits> is not available on
+ * every board.
+ *
+ * @tparam T Element type.
+ */
+template<class T>
+struct persistent_storable {
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ < 5
+  static constexpr bool value = __has_trivial_copy(T)
+      && __has_trivial_assign(T) && __has_trivial_destructor(T);
+#else
+  static constexpr bool value = __is_trivially_copyable(T);
+#endif
+};
+
+// A union of the fundamental types with the strictest alignments.
+union persistent_max_align_type {
+  long long integer;
+  long double floating;
+  void* pointer;
+  void (*function)();
+};
+
+/** Rounds an offset up to a multiple of an alignment.
+ *
+ * Containers place their elements at the first offset after their header
+ * that is aligned for the element type, so elements are copied with aligned
+ * loads and stores.
+ *
+ * @param offset Offset to round up.
+ * @param alignment Alignment (e.g., alignof(T)).
+ * @return The first multiple of alignment not lower than offset.
+ */
+constexpr size_t persistent_align(size_t offset, size_t alignment) {
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+/** Returns the strictest alignment of the fundamental types.
+ *
+ * This is alignof(max_align_t), which not every board's toolchain defines.
+ * Containers align their elements relative to their own offset, so an
+ * offset that is a multiple of it keeps any element type aligned in absolute
+ * terms, as long as the storage itself (e.g., the EEPROM's RAM copy, which
+ * is allocated on the heap) is.
+ *
+ * @return The alignment (in bytes).
+ */
+constexpr size_t persistent_max_align() {
+  return alignof(persistent_max_align_type);
+}
+
+#endif // PERSISTENT_TRAITS
@@ -0,0 +1,75 @@
+#ifndef PERSISTENT_TRANSACTION
+#define PERSISTENT_TRANSACTION
+
+#include "dirty_range.h"
+
+/** This class groups container modifications into a single commit.
+ *
+ * While a transaction is in scope, the modifications made to any container
+ * are staged in the EEPROM's RAM copy, and calls to the containers' commit()
+ * are deferred. The staged modifications are committed at once when the
+ * transaction ends, with one commit per storage backend.
+ *
+ * Transactions can be nested; only the outermost one commits.
+ *
+ * Example:
+ * @code
+ * {
+ *   persistent_transaction transaction;
+ *   queue.push(sample);
+ *   totals[0] += sample;
+ * } // single EEPROM commit
+ * @endcode
+ */
+class persistent_transaction {
+public:
+  /** Constructor.
+   *
+   * Opens the transaction.
+   */
+  persistent_transaction()
+    : open_{true}
+  {
+    ++dirty_range::transaction_depth();
+  }
+
+  /** Destructor.
+   *
+   * Commits the transaction, unless it was already committed.
+   */
+  ~persistent_transaction() {
+    commit();
+  }
+
+  /** Commits the transaction.
+   *
+   * A storage backend is committed only if some of its containers was
+   * modified during the transaction. Once committed, the transaction is
+   * closed and this method becomes a no-op. Nested transactions defer the
+   * commit to the outermost one.
+   *
+   * @return True if the changes were committed, or there was nothing to
+   *         commit; false otherwise.
+   */
+  bool commit() {
+    if (!open_)
+      return true;
+
+    open_ = false;
+    if (--dirty_range::transaction_depth() > 0)
+      return true;
+
+    return dirty_range::commit_enlisted();
+  }
+
+private:
+  bool open_;
+
+  persistent_transaction(const persistent_transaction& other) = delete;
+  persistent_transaction& operator=(const persistent_transaction& other) = delete;
+
+  persistent_transaction(persistent_transaction&& other) = delete;
+  persistent_transaction& operator=(persistent_transaction&& other) = delete;
+};
+
+#endif // PERSISTENT_TRANSACTION
@@ -1,34 +1,77 @@
 #ifndef PERSISTENT_VECTOR
 #define PERSISTENT_VECTOR
 
-#include <EEPROM.h>
+#include "dirty_range.h"
+#include "eeprom_backend.h"
+#include "persistent_header.h"
+#include "persistent_less.h"
+#include "persistent_lock.h"
+#include "persistent_signature.h"
+#include "persistent_traits.h"
 
 /** This class implements a fixed-size vector.
  *
  * The vector is stored on the EEPROM of an ESP8266 micro-controller.
+ *
+ * Modifications are only made to the EEPROM's RAM copy. They become
+ * persistent once commit() is called, so several operations can be grouped
+ * into a single flash write.
+ *
+ * The vector's header is double-buffered (see persistent_header).
+ *
+ * With a lock policy other than persistent_no_lock, the vector can be
+ * shared between tasks (e.g., on both cores of the ESP32) or interrupt
+ * handlers. Every operation that modifies the vector, or that returns a
+ * value computed from several elements, holds the lock; size(), empty()
+ * and full() take no lock. References, pointers and iterators are not
+ * protected once returned, so elements shared this way should be read and
+ * written under an external lock. commit() holds the lock only while
+ * staging the header and taking the modified range, and the storage is
+ * committed without it. An element replaced while the storage is being
+ * committed may be written half-updated, which the next commit repairs.
+ * commit() must be called from one context at a time, and not within a
+ * transaction.
+ *
+ * @tparam T Element type.
+ * @tparam Backend Storage backend mapped in RAM (see eeprom_backend).
+ * @tparam Lock Lock policy (see persistent_lock.h).
  */
-template<class T>
+template<class T, class Backend = eeprom_backend,
+    class Lock = persistent_no_lock>
 class persistent_vector {
 public:
   typedef T value_type;
   typedef std::size_t size_type;
+  typedef Backend backend_type;
   typedef value_type& reference;
   typedef const value_type& const_reference;
+  typedef value_type* iterator;
+  typedef const value_type* const_iterator;
+
+  static_assert(persistent_storable<value_type>::value,
+      "the element type must be trivially copyable");
+  static_assert(persistent_mapped<Backend>::value,
+      "the backend must be mapped in RAM; use a cached container instead");
   
   /** Constructor.
    *
-   * @param offset Offset from the EEPROM base address.
+   * @param offset Offset from the storage's base address (a multiple of
+   *               persistent_max_align()).
    * @param capacity Vector's capacity (in elements).
    */ 
   persistent_vector(int offset, size_type capacity)
     : capacity_{capacity}
+    , offset_{static_cast<size_type>(offset)}
+    , header_{Backend::data() + offset, SIGNATURE}
+    , data_{reinterpret_cast<value_type*>(
+          Backend::data() + offset + DATA_OFFSET)}
+    , header_changed_{false}
+    , header_staged_{false}
+    , dirty_{&persistent_commit<Backend>, &persistent_vector::on_commit, this}
   {
-    uint8_t* data = EEPROM.getDataPtr() + offset;
-    storage_ = reinterpret_cast<storage_area*>(data);
-            
-    if (storage_->signature != SIGNATURE) {
-      storage_->signature = SIGNATURE;
-      storage_->size = 0;
+    if (!header_.load(fields_) || fields_.size > capacity_) {
+      fields_.size = 0;
+      mark_header();
     }
   }
 
@@ -38,9 +81,7 @@ public:
    * @param capacity Vector's capacity (in elements).
    */
   static constexpr size_type storage_size(size_type capacity) {
-    return sizeof(storage_area::signature)
-        + sizeof(storage_area::size)
-        + capacity * sizeof(value_type);
+    return DATA_OFFSET + capacity * sizeof(value_type);
   }
 
   /** Checks whether the vector is empty.
@@ -66,7 +107,7 @@ public:
    * @return The vector's size.
    */
   size_type size() const {
-    return storage_->size;
+    return fields_.size;
   }
 
   /** Returns the vector's capacity.
@@ -81,12 +122,17 @@ public:
   }
 
   /** Returns an element given its position in the vector.
+   *
+   * The element is marked as modified, as it can be written through the
+   * returned reference.
    *
    * @param pos The position or index of the element to retrieve.
    * @return A reference to the element.
    */
   reference operator[](size_type pos) {
-    return storage_->data()[pos];
+    persistent_lock_guard<Lock> guard(lock_);
+    mark_element(pos);
+    return data_[pos];
   }
 
   /** Returns an element given its position in the vector.
@@ -95,7 +141,63 @@ public:
    * @return A constant reference to the element.
    */
   const_reference operator[](size_type pos) const {
-    return storage_->data()[pos];
+    return data_[pos];
+  }
+
+  /** Returns a pointer to the vector's elements.
+   *
+   * The vector's elements are marked as modified, as they can be written
+   * through the returned pointer.
+   *
+   * @return A pointer to the first element.
+   */
+  value_type* data() {
+    persistent_lock_guard<Lock> guard(lock_);
+    mark_elements(0, size());
+    return data_;
+  }
+
+  /** Returns a pointer to the vector's elements.
+   *
+   * @return A constant pointer to the first element.
+   */
+  const value_type* data() const {
+    return data_;
+  }
+
+  /** Returns an iterator to the vector's first element.
+   *
+   * The vector's elements are marked as modified, as they can be written
+   * through the returned iterator.
+   *
+   * @return An iterator to the first element.
+   */
+  iterator begin() {
+    return data();
+  }
+
+  /** Returns an iterator to the vector's first element.
+   *
+   * @return A constant iterator to the first element.
+   */
+  const_iterator begin() const {
+    return data();
+  }
+
+  /** Returns an iterator past the vector's last element.
+   *
+   * @return An iterator past the last element.
+   */
+  iterator end() {
+    return data_ + size();
+  }
+
+  /** Returns an iterator past the vector's last element.
+   *
+   * @return A constant iterator past the last element.
+   */
+  const_iterator end() const {
+    return data() + size();
   }
 
   /** Pushes an element into the vector.
@@ -106,11 +208,16 @@ public:
    * @return True if the element was insterted; false otherwise. 
    */
   bool push_back(const value_type& value) {
-    if (full())
+    persistent_lock_guard<Lock> guard(lock_);
+    if (full()) {
+      dirty_.stats().count_rejected_push();
       return false;
+    }
     
-    storage_->data()[storage_->size] = value;
-    ++(storage_->size);
+    data_[fields_.size] = value;
+    mark_element(fields_.size);
+    ++(fields_.size);
+    mark_header();
     return true;
   }
 
@@ -122,11 +229,16 @@ public:
    * @return True if the element was insterted; false otherwise. 
    */
   bool push_back(value_type&& value) {
-    if (full())
+    persistent_lock_guard<Lock> guard(lock_);
+    if (full()) {
+      dirty_.stats().count_rejected_push();
       return false;
+    }
 
-    storage_->data()[storage_->size] = std::move(value);
-    ++(storage_->size);
+    data_[fields_.size] = std::move(value);
+    mark_element(fields_.size);
+    ++(fields_.size);
+    mark_header();
     return true;
   }
 
@@ -137,31 +249,370 @@ public:
    * @return True if there was an element to pop; false otherwise.
    */
   bool pop_back() {
+    persistent_lock_guard<Lock> guard(lock_);
     if (empty())
       return false;
 
-    --(storage_->size);
+    --(fields_.size);
+    mark_header();
     return true;
   }
 
+  /** Removes all the elements from the vector. */
+  void clear() {
+    persistent_lock_guard<Lock> guard(lock_);
+    if (empty())
+      return;
+
+    fields_.size = 0;
+    mark_header();
+  }
+
+  /** Replaces the vector's elements.
+   *
+   * Elements are copied until the vector becomes full. The vector's header
+   * is updated only once.
+   *
+   * @param first Iterator to the first element to be copied.
+   * @param last Iterator past the last element to be copied.
+   * @return The number of elements copied.
+   */
+  template<class InputIt>
+  size_type assign(InputIt first, InputIt last) {
+    persistent_lock_guard<Lock> guard(lock_);
+    fields_.size = 0;
+    return append_range(first, last);
+  }
+
+  /** Replaces the vector's elements.
+   *
+   * Elements are copied, with a single call to memcpy, until the vector
+   * becomes full. The vector's header is updated only once.
+   *
+   * @param values Pointer to the first element to be copied.
+   * @param count Number of elements to be copied.
+   * @return The number of elements copied.
+   */
+  size_type assign(const value_type* values, size_type count) {
+    persistent_lock_guard<Lock> guard(lock_);
+    fields_.size = 0;
+    return append_values(values, count);
+  }
+
+  /** Appends elements at the end of the vector.
+   *
+   * Elements are appended until the vector becomes full. The vector's header
+   * is updated only once.
+   *
+   * @param first Iterator to the first element to be appended.
+   * @param last Iterator past the last element to be appended.
+   * @return The number of elements appended.
+   */
+  template<class InputIt>
+  size_type append(InputIt first, InputIt last) {
+    persistent_lock_guard<Lock> guard(lock_);
+    return append_range(first, last);
+  }
+
+  /** Appends elements at the end of the vector.
+   *
+   * Elements are appended, with a single call to memcpy, until the vector
+   * becomes full. The vector's header is updated only once.
+   *
+   * @param values Pointer to the first element to be appended.
+   * @param count Number of elements to be appended.
+   * @return The number of elements appended.
+   */
+  size_type append(const value_type* values, size_type count) {
+    persistent_lock_guard<Lock> guard(lock_);
+    return append_values(values, count);
+  }
+
+  /** Removes an element from the vector.
+   *
+   * The elements after the removed one are moved with a single call to
+   * memmove.
+   *
+   * @param pos Iterator to the element to remove.
+   * @return An iterator to the element that followed the removed one.
+   */
+  iterator erase(const_iterator pos) {
+    return erase(pos, pos + 1);
+  }
+
+  /** Removes a range of elements from the vector.
+   *
+   * The elements after the removed ones are moved with a single call to
+   * memmove.
+   *
+   * @param first Iterator to the first element to remove.
+   * @param last Iterator past the last element to remove.
+   * @return An iterator to the element that followed the removed ones.
+   */
+  iterator erase(const_iterator first, const_iterator last) {
+    persistent_lock_guard<Lock> guard(lock_);
+    const size_type pos = first - data_;
+    const size_type count = last - first;
+    if (count == 0)
+      return data_ + pos;
+
+    const size_type moved = size() - pos - count;
+    memmove(data_ + pos, last, moved * sizeof(value_type));
+    mark_elements(pos, moved);
+    fields_.size -= count;
+    mark_header();
+    return data_ + pos;
+  }
+
+  /** Returns the first element that does not go before a value.
+   *
+   * The vector's elements must be sorted (e.g., by only adding them with
+   * sorted_insert() and merge()); they are binary searched.
+   *
+   * @param value The value to search for.
+   * @param compare Function object that returns true if its first argument
+   *                goes before its second one.
+   * @return An iterator to the first element not before value, or end() if
+   *         there is none.
+   */
+  template<class Compare = persistent_less<value_type>>
+  const_iterator lower_bound(const value_type& value,
+      Compare compare = Compare()) const {
+    persistent_lock_guard<Lock> guard(lock_);
+    return data_ + search(value, compare);
+  }
+
+  /** Checks whether a sorted vector contains a value.
+   *
+   * @param value The value to search for.
+   * @param compare Function object that returns true if its first argument
+   *                goes before its second one.
+   * @return True if an element is equivalent to value; false otherwise.
+   */
+  template<class Compare = persistent_less<value_type>>
+  bool contains(const value_type& value, Compare compare = Compare()) const {
+    persistent_lock_guard<Lock> guard(lock_);
+    const size_type pos = search(value, compare);
+    return pos != size() && !compare(value, data_[pos]);
+  }
+
+  /** Inserts an element into a sorted vector, keeping it sorted.
+   *
+   * The element is inserted before the first element that does not go
+   * before it. The elements after it are moved with a single call to
+   * memmove.
+   *
+   * @param value The element to be inserted.
+   * @param compare Function object that returns true if its first argument
+   *                goes before its second one.
+   * @return True if the element was insterted; false otherwise.
+   */
+  template<class Compare = persistent_less<value_type>>
+  bool sorted_insert(const value_type& value, Compare compare = Compare()) {
+    persistent_lock_guard<Lock> guard(lock_);
+    if (full()) {
+      dirty_.stats().count_rejected_push();
+      return false;
+    }
+
+    const size_type pos = search(value, compare);
+    memmove(data_ + pos + 1, data_ + pos,
+        (size() - pos) * sizeof(value_type));
+    data_[pos] = value;
+    mark_elements(pos, size() + 1 - pos);
+    ++(fields_.size);
+    mark_header();
+    return true;
+  }
+
+  /** Merges a sorted sequence of elements into a sorted vector.
+   *
+   * The vector and the sequence are merged in place in a single pass from
+   * their ends, so each element is moved at most once, and the vector's
+   * header is updated only once. Elements equivalent to one in the vector
+   * are placed after it. If the vector becomes full, the rest of the
+   * sequence is not merged.
+   *
+   * @param first Iterator to the first element to be merged.
+   * @param last Iterator past the last element to be merged.
+   * @param compare Function object that returns true if its first argument
+   *                goes before its second one.
+   * @return The number of elements merged.
+   */
+  template<class RandomIt, class Compare = persistent_less<value_type>>
+  size_type merge(RandomIt first, RandomIt last,
+      Compare compare = Compare()) {
+    persistent_lock_guard<Lock> guard(lock_);
+    size_type count = last - first;
+    if (count > capacity() - size()) {
+      dirty_.stats().count_rejected_push();
+      count = capacity() - size();
+    }
+    if (count == 0)
+      return 0;
+
+    size_type i = size();
+    size_type j = count;
+    size_type k = size() + count;
+    while (j > 0) {
+      if (i > 0 && compare(first[j - 1], data_[i - 1]))
+        data_[--k] = data_[--i];
+      else
+        data_[--k] = first[--j];
+    }
+
+    mark_elements(k, size() + count - k);
+    fields_.size += count;
+    mark_header();
+    return count;
+  }
+
+  /** Checks whether the vector was modified since the last commit.
+   *
+   * @return True if there are uncommitted changes; false otherwise.
+   */
+  bool dirty() const {
+    return dirty_.dirty();
+  }
+
+  /** Makes the vector's modifications persistent.
+   *
+   * The storage backend is only committed if the vector was modified since
+   * the last commit; otherwise, this is a no-op.
+   *
+   * @return True if the changes were committed, or there was nothing to
+   *         commit; false otherwise.
+   */
+  bool commit() {
+    return dirty_.commit(lock_);
+  }
+
+#if defined(PERSISTENT_CONTAINERS_STATS)
+  /** Returns the vector's statistics.
+   *
+   * Only available if PERSISTENT_CONTAINERS_STATS is defined.
+   *
+   * @return A constant reference to the statistics.
+   */
+  const persistent_stats& stats() const {
+    return dirty_.stats();
+  }
+
+  /** Returns the estimated erase cycles of the flash backing the vector.
+   *
+   * This is the number of commits issued to the storage backend since boot,
+   * by any container. Only available if PERSISTENT_CONTAINERS_STATS is
+   * defined.
+   *
+   * @return The estimated erase cycles.
+   */
+  unsigned long estimated_erase_cycles() const {
+    return backend_commits<Backend>();
+  }
+#endif
+
 private:
-  struct storage_area {
-    unsigned signature;
+  struct header_fields {
     size_type size;
-    
-    value_type* data() {
-      uint8_t* ptr_to_data =
-          reinterpret_cast<uint8_t*>(&signature)
-          + sizeof(signature)
-          + sizeof(size);
-      return reinterpret_cast<value_type*>(ptr_to_data);
-    }
   };
 
-  static constexpr unsigned SIGNATURE { 0xa2bedef9 };
+  typedef persistent_header<header_fields> header_type;
+
+  // Elements start right after the header, at the next multiple of their
+  // alignment.
+  static constexpr size_type DATA_OFFSET {
+    persistent_align(header_type::storage_size(), alignof(value_type))
+  };
+
+  static constexpr unsigned SIGNATURE {
+    persistent_signature(persistent_kind::vector, sizeof(value_type),
+        persistent_schema<value_type>::version)
+  };
   
   const size_type capacity_;
-  storage_area* storage_;
+  const size_type offset_;
+  header_type header_;
+  header_fields fields_;
+  value_type* const data_;
+  bool header_changed_;
+  bool header_staged_;
+  mutable Lock lock_;
+  dirty_range dirty_;
+
+  /** Writes the header before the storage is committed.
+   *
+   * The header may change again while the storage is being committed, so
+   * the copy staged is tracked apart from the pending changes.
+   */
+  static void on_commit(void* context, bool committed) {
+    persistent_vector* vector = static_cast<persistent_vector*>(context);
+    if (committed) {
+      if (vector->header_staged_)
+        vector->header_.committed();
+      vector->header_staged_ = false;
+    } else if (vector->header_changed_ || vector->header_staged_) {
+      vector->header_.stage(vector->fields_);
+      vector->dirty_.mark(vector->offset_ + vector->header_.staged_offset(),
+          header_type::copy_size());
+      vector->header_changed_ = false;
+      vector->header_staged_ = true;
+    }
+  }
+
+  /** Returns the position of the first element that does not go before a
+   * value (see lower_bound()).
+   */
+  template<class Compare>
+  size_type search(const value_type& value, Compare compare) const {
+    const value_type* data = data_;
+    return persistent_lower_bound(
+        [data](size_type pos) -> const value_type& { return data[pos]; },
+        size(), value, compare);
+  }
+
+  template<class InputIt>
+  size_type append_range(InputIt first, InputIt last) {
+    size_type count = 0;
+    for (; first != last && size() + count < capacity(); ++first, ++count)
+      data_[size() + count] = *first;
+
+    if (first != last)
+      dirty_.stats().count_rejected_push();
+
+    mark_elements(size(), count);
+    fields_.size += count;
+    mark_header();
+    return count;
+  }
+
+  size_type append_values(const value_type* values, size_type count) {
+    if (count > capacity() - size()) {
+      dirty_.stats().count_rejected_push();
+      count = capacity() - size();
+    }
+
+    memcpy(data_ + size(), values, count * sizeof(value_type));
+    mark_elements(size(), count);
+    fields_.size += count;
+    mark_header();
+    return count;
+  }
+
+  void mark_header() {
+    header_changed_ = true;
+    dirty_.mark(offset_ + header_.staged_offset(), header_type::copy_size());
+    dirty_.stats().count_header_write();
+  }
+
+  void mark_element(size_type pos) {
+    dirty_.mark(offset_ + storage_size(pos), sizeof(value_type));
+    dirty_.stats().count_element_writes(1);
+  }
+
+  void mark_elements(size_type pos, size_type count) {
+    dirty_.mark(offset_ + storage_size(pos), count * sizeof(value_type));
+    dirty_.stats().count_element_writes(count);
+  }
 
   persistent_vector() = delete;
   
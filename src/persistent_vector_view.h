@@ -0,0 +1,217 @@
+#ifndef PERSISTENT_VECTOR_VIEW
+#define PERSISTENT_VECTOR_VIEW
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "persistent_header.h"
+#include "persistent_less.h"
+#include "persistent_signature.h"
+#include "persistent_traits.h"
+
+/** This class implements a read-only view of a persistent_vector.
+ *
+ * The view reads a vector's committed storage in place, from any memory
+ * holding it (e.g., flash mapped in the address space; see
+ * persistent_flash_map.h), without going through the EEPROM's RAM copy. A
+ * large table that is only read then needs neither the heap for that copy
+ * nor the time to fill it at boot.
+ *
+ * The storage must hold a vector committed with the same element type and
+ * schema version; otherwise, the view is empty and valid() returns false.
+ * The view's contents are those found when it is constructed.
+ *
+ * Flash mapped on the ESP8266 only allows aligned 32-bit loads, so elements
+ * are read with such loads into a copy, which operator[] returns, and the
+ * searches compare those copies. The pointers returned by data(), begin()
+ * and end() are only meant for storage without that restriction (e.g., the
+ * ESP32's mapped partitions, or RAM).
+ *
+ * @tparam T Element type.
+ */
+template<class T>
+class persistent_vector_view {
+public:
+  typedef T value_type;
+  typedef std::size_t size_type;
+  typedef const value_type* const_iterator;
+
+  static_assert(persistent_storable<value_type>::value,
+      "the element type must be trivially copyable");
+
+  /** Constructor.
+   *
+   * @param storage Pointer to the vector's storage (its header).
+   * @param capacity Vector's capacity (in elements).
+   */
+  persistent_vector_view(const void* storage, size_type capacity)
+    : data_{reinterpret_cast<const value_type*>(
+          static_cast<const uint8_t*>(storage) + DATA_OFFSET)}
+    , size_{0}
+    , valid_{false}
+  {
+    // The header is only read, from a copy.
+    alignas(uint32_t) alignas(header_fields)
+        uint8_t copy[header_type::storage_size()];
+    read_words<sizeof(copy)>(storage, copy);
+    header_type header { copy, SIGNATURE };
+    header_fields fields;
+    if (header.load(fields) && fields.size <= capacity) {
+      size_ = fields.size;
+      valid_ = true;
+    }
+  }
+
+  /**
+   * Computes the storage size of a vector of the given capacity.
+   *
+   * @param capacity Vector's capacity (in elements).
+   */
+  static constexpr size_type storage_size(size_type capacity) {
+    return DATA_OFFSET + capacity * sizeof(value_type);
+  }
+
+  /** Checks whether the storage holds a valid vector.
+   *
+   * @return True if a valid header was found; false otherwise.
+   */
+  bool valid() const {
+    return valid_;
+  }
+
+  /** Checks whether the vector is empty.
+   *
+   * @return True if the vector is empty; false otherwise.
+   */
+  bool empty() const {
+    return size() == 0;
+  }
+
+  /** Returns the vector's size.
+   *
+   * @return The vector's size.
+   */
+  size_type size() const {
+    return size_;
+  }
+
+  /** Returns an element given its position in the vector.
+   *
+   * The element is read with aligned 32-bit loads.
+   *
+   * @param pos The position or index of the element to retrieve.
+   * @return A copy of the element.
+   */
+  value_type operator[](size_type pos) const {
+    value_type value;
+    read_words<sizeof(value_type)>(data_ + pos, &value);
+    return value;
+  }
+
+  /** Returns a pointer to the vector's elements.
+   *
+   * @return A constant pointer to the first element.
+   */
+  const value_type* data() const {
+    return data_;
+  }
+
+  /** Returns an iterator to the vector's first element.
+   *
+   * @return A constant iterator to the first element.
+   */
+  const_iterator begin() const {
+    return data_;
+  }
+
+  /** Returns an iterator past the vector's last element.
+   *
+   * @return A constant iterator past the last element.
+   */
+  const_iterator end() const {
+    return data_ + size_;
+  }
+
+  /** Returns the first element that does not go before a value.
+   *
+   * The vector's elements must be sorted (see persistent_vector); they are
+   * binary searched.
+   *
+   * @param value The value to search for.
+   * @param compare Function object that returns true if its first argument
+   *                goes before its second one.
+   * @return An iterator to the first element not before value, or end() if
+   *         there is none.
+   */
+  template<class Compare = persistent_less<value_type>>
+  const_iterator lower_bound(const value_type& value,
+      Compare compare = Compare()) const {
+    return data_ + search(value, compare);
+  }
+
+  /** Checks whether a sorted vector contains a value.
+   *
+   * @param value The value to search for.
+   * @param compare Function object that returns true if its first argument
+   *                goes before its second one.
+   * @return True if an element is equivalent to value; false otherwise.
+   */
+  template<class Compare = persistent_less<value_type>>
+  bool contains(const value_type& value, Compare compare = Compare()) const {
+    const size_type pos = search(value, compare);
+    return pos != size_ && !compare(value, (*this)[pos]);
+  }
+
+private:
+  // Same layout and signature as persistent_vector's header.
+  struct header_fields {
+    size_type size;
+  };
+
+  typedef persistent_header<header_fields> header_type;
+
+  // Elements start right after the header, at the next multiple of their
+  // alignment.
+  static constexpr size_type DATA_OFFSET {
+    persistent_align(header_type::storage_size(), alignof(value_type))
+  };
+
+  static constexpr unsigned SIGNATURE {
+    persistent_signature(persistent_kind::vector, sizeof(value_type),
+        persistent_schema<value_type>::version)
+  };
+
+  const value_type* const data_;
+  size_type size_;
+  bool valid_;
+
+  /** Copies data with aligned 32-bit loads.
+   *
+   * @tparam Size Number of bytes to copy.
+   * @param from Address of the data, which need not be aligned.
+   * @param to Buffer where the data is copied.
+   */
+  template<size_type Size>
+  static void read_words(const void* from, void* to) {
+    const uintptr_t address = reinterpret_cast<uintptr_t>(from);
+    const volatile uint32_t* first =
+        reinterpret_cast<const volatile uint32_t*>(address & ~uintptr_t(3));
+    const size_type skip = address & 3;
+
+    // Words overlapping the data, whatever its offset within a word.
+    uint32_t words[(Size + 3 + 3) / 4];
+    for (size_type i = 0; i < (skip + Size + 3) / 4; ++i)
+      words[i] = first[i];
+    memcpy(to, reinterpret_cast<const uint8_t*>(words) + skip, Size);
+  }
+
+  template<class Compare>
+  size_type search(const value_type& value, Compare compare) const {
+    return persistent_lower_bound(
+        [this](size_type pos) { return (*this)[pos]; },
+        size_, value, compare);
+  }
+};
+
+#endif // PERSISTENT_VECTOR_VIEW
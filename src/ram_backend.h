@@ -0,0 +1,70 @@
+#ifndef RAM_BACKEND
+#define RAM_BACKEND
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "persistent_traits.h"
+
+/** This class implements a storage backend on a static RAM buffer.
+ *
+ * Contents do not survive a reset, which makes this backend useful for
+ * tests and for data that only needs to outlive a container. commit() does
+ * nothing except counting how many times it was called. The buffer is
+ * aligned for any element type.
+ *
+ * @tparam Size Buffer size (in bytes).
+ * @tparam Tag Type used to tell apart several buffers of the same size.
+ */
+template<size_t Size, class Tag = void>
+struct ram_backend {
+  /** Returns a pointer to the buffer.
+   *
+   * @return A pointer to the buffer's first byte.
+   */
+  static uint8_t* data() {
+    alignas(persistent_max_align_type) static uint8_t buffer[Size];
+    return buffer;
+  }
+
+  /** Reads data from the buffer.
+   *
+   * @param offset Offset from the buffer's base address.
+   * @param data Buffer where data is stored.
+   * @param size Number of bytes to read.
+   */
+  static void read(size_t offset, void* data, size_t size) {
+    memcpy(data, ram_backend::data() + offset, size);
+  }
+
+  /** Writes data into the buffer.
+   *
+   * @param offset Offset from the buffer's base address.
+   * @param data Buffer containing the data to write.
+   * @param size Number of bytes to write.
+   */
+  static void write(size_t offset, const void* data, size_t size) {
+    memcpy(ram_backend::data() + offset, data, size);
+  }
+
+  /** Counts a commit.
+   *
+   * @return Always true.
+   */
+  static bool commit() {
+    ++commits();
+    return true;
+  }
+
+  /** Returns the number of times commit() was called.
+   *
+   * @return A reference to the commit counter.
+   */
+  static unsigned long& commits() {
+    static unsigned long count = 0;
+    return count;
+  }
+};
+
+#endif // RAM_BACKEND
@@ -0,0 +1,79 @@
+#ifndef RTC_MEMORY_BACKEND
+#define RTC_MEMORY_BACKEND
+
+#include <Arduino.h>
+
+/** This class implements a storage backend on the RTC user memory.
+ *
+ * The RTC user memory of an ESP8266 survives deep sleep (but not a power
+ * loss) and has no write cost, so commit() does nothing. It is accessed in
+ * four-byte blocks; unaligned writes read the blocks they modify first.
+ */
+struct rtc_memory_backend {
+  /** Returns the size of the RTC user memory (in bytes).
+   *
+   * @return The memory's size.
+   */
+  static constexpr size_t size() {
+    return 512;
+  }
+
+  /** Reads data from the RTC user memory.
+   *
+   * @param offset Offset from the RTC user memory base address.
+   * @param data Buffer where data is stored.
+   * @param size Number of bytes to read.
+   */
+  static void read(size_t offset, void* data, size_t size) {
+    uint8_t* bytes = static_cast<uint8_t*>(data);
+    while (size > 0) {
+      const size_t skip = offset % BLOCK_SIZE;
+      const size_t count = size < BLOCK_SIZE - skip ? size : BLOCK_SIZE - skip;
+
+      uint32_t block;
+      ESP.rtcUserMemoryRead(offset / BLOCK_SIZE, &block, BLOCK_SIZE);
+      memcpy(bytes, reinterpret_cast<uint8_t*>(&block) + skip, count);
+
+      bytes += count;
+      offset += count;
+      size -= count;
+    }
+  }
+
+  /** Writes data into the RTC user memory.
+   *
+   * @param offset Offset from the RTC user memory base address.
+   * @param data Buffer containing the data to write.
+   * @param size Number of bytes to write.
+   */
+  static void write(size_t offset, const void* data, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    while (size > 0) {
+      const size_t skip = offset % BLOCK_SIZE;
+      const size_t count = size < BLOCK_SIZE - skip ? size : BLOCK_SIZE - skip;
+
+      uint32_t block;
+      if (count < BLOCK_SIZE)
+        ESP.rtcUserMemoryRead(offset / BLOCK_SIZE, &block, BLOCK_SIZE);
+      memcpy(reinterpret_cast<uint8_t*>(&block) + skip, bytes, count);
+      ESP.rtcUserMemoryWrite(offset / BLOCK_SIZE, &block, BLOCK_SIZE);
+
+      bytes += count;
+      offset += count;
+      size -= count;
+    }
+  }
+
+  /** Does nothing, as writes are immediately effective.
+   *
+   * @return Always true.
+   */
+  static bool commit() {
+    return true;
+  }
+
+private:
+  static constexpr size_t BLOCK_SIZE { 4 };
+};
+
+#endif // RTC_MEMORY_BACKEND
@@ -0,0 +1,370 @@
+#ifndef SPSC_PERSISTENT_QUEUE
+#define SPSC_PERSISTENT_QUEUE
+
+#include "dirty_range.h"
+#include "eeprom_backend.h"
+#include "persistent_index.h"
+#include "persistent_signature.h"
+#include "persistent_traits.h"
+
+/** This class implements a single-producer, single-consumer circular queue.
+ *
+ * Elements can be pushed from one context (e.g., an interrupt handler) and
+ * popped from another (e.g., the main loop) without disabling interrupts.
+ * The producer only writes the back index and the consumer only writes the
+ * front index; the size is derived from both. Indices are published with
+ * release stores and read with acquire loads, so an element is visible to
+ * the consumer before the index covering it, on both the ESP8266 and the
+ * dual-core ESP32.
+ *
+ * The queue uses the same storage layout as static_persistent_queue. The
+ * changes are only marked when commit() is called, which must happen in the
+ * consumer's context; push() does not touch any shared state besides the
+ * element and the back index. Statistics only count what commit() marks.
+ *
+ * @tparam T Element type.
+ * @tparam N Queue's capacity (in elements).
+ * @tparam Backend Storage backend mapped in RAM (see eeprom_backend).
+ */
+template<class T, size_t N, class Backend = eeprom_backend>
+class spsc_persistent_queue {
+public:
+  typedef T value_type;
+  typedef size_t size_type;
+  typedef Backend backend_type;
+  typedef const value_type& const_reference;
+  typedef typename persistent_index<2 * N - 1>::type index_type;
+
+  static_assert(persistent_storable<value_type>::value,
+      "the element type must be trivially copyable");
+  static_assert(N > 0, "the queue's capacity must be positive");
+  static_assert(persistent_mapped<Backend>::value,
+      "the backend must be mapped in RAM; use a cached container instead");
+
+  /** Constructor.
+   *
+   * The queue must be constructed before the producer starts pushing.
+   *
+   * @param offset Offset from the storage's base address (a multiple of
+   *               persistent_max_align()).
+   */
+  explicit spsc_persistent_queue(int offset)
+    : offset_{static_cast<size_type>(offset)}
+    , dirty_{&persistent_commit<Backend>}
+  {
+    uint8_t* data = Backend::data() + offset;
+    storage_ = reinterpret_cast<storage_area*>(data);
+
+    // A torn or corrupted header may keep its signature; indices out of
+    // range would then address past the storage.
+    if (storage_->signature != SIGNATURE
+        || (!MASKED
+            && (storage_->begin >= POSITIONS || storage_->end >= POSITIONS))
+        || size() > N) {
+      storage_->signature = SIGNATURE;
+      storage_->begin = 0;
+      storage_->end = 0;
+      dirty_.mark(offset_, sizeof(storage_area));
+      dirty_.stats().count_header_write();
+    }
+
+    marked_begin_ = storage_->begin;
+    marked_end_ = storage_->end;
+  }
+
+  /**
+   * Computes the necessary storage size to hold the queue.
+   */
+  static constexpr size_type storage_size() {
+    return DATA_OFFSET + N * sizeof(value_type);
+  }
+
+  /** Returns the queue's capacity.
+   *
+   * @return The queue's capacity.
+   */
+  static constexpr size_type capacity() {
+    return N;
+  }
+
+  /** Returns the queue's size.
+   *
+   * When called while the other context is pushing or popping, the result
+   * may already be out of date, but it is never larger than the number of
+   * elements the consumer can pop nor smaller than the room the producer
+   * can fill.
+   *
+   * @return The queue's size.
+   */
+  size_type size() const {
+    return distance(load(storage_->begin), load(storage_->end));
+  }
+
+  /** Checks whether the queue is empty (consumer side).
+   *
+   * @return True if the queue is empty; false otherwise.
+   */
+  bool empty() const {
+    return load(storage_->end) == storage_->begin;
+  }
+
+  /** Checks whether the queue is full (producer side).
+   *
+   * @return True if the queue is full; false otherwise.
+   */
+  bool full() const {
+    return distance(load(storage_->begin), storage_->end) == N;
+  }
+
+  /** Pushes an element into the queue (producer side).
+   *
+   * @param value The element to be pushed.
+   * @return True if the element was insterted; false otherwise.
+   */
+  bool push(const value_type& value) {
+    const index_type end = storage_->end;
+    if (distance(load(storage_->begin), end) == N)
+      return false;
+
+    storage_->data()[slot(end)] = value;
+    store(storage_->end, next(end));
+    return true;
+  }
+
+  /** Pushes several elements into the queue (producer side).
+   *
+   * The elements are pushed in order until the queue becomes full, and they
+   * are published to the consumer all at once.
+   *
+   * @param values Pointer to the first element to be pushed.
+   * @param count Number of elements to be pushed.
+   * @return The number of elements inserted.
+   */
+  size_type push(const value_type* values, size_type count) {
+    const index_type end = storage_->end;
+    const size_type room = N - distance(load(storage_->begin), end);
+    if (count > room)
+      count = room;
+    if (count == 0)
+      return 0;
+
+    const size_type first_part = contiguous(slot(end), count);
+    memcpy(&storage_->data()[slot(end)], values,
+        first_part * sizeof(value_type));
+    memcpy(&storage_->data()[0], values + first_part,
+        (count - first_part) * sizeof(value_type));
+    store(storage_->end, forward(end, count));
+    return count;
+  }
+
+  /** Returns the element at the queue's front (consumer side).
+   *
+   * @return The element at the front.
+   */
+  const_reference front() const {
+    return storage_->data()[slot(storage_->begin)];
+  }
+
+  /** Copies elements from the queue's front without popping them (consumer
+   * side).
+   *
+   * @param values Pointer to the buffer where elements are copied.
+   * @param count Maximum number of elements to copy.
+   * @return The number of elements copied, which is lower than count if the
+   *         queue did not have enough elements.
+   */
+  size_type read(value_type* values, size_type count) const {
+    const index_type begin = storage_->begin;
+    const size_type available = distance(begin, load(storage_->end));
+    if (count > available)
+      count = available;
+    if (count == 0)
+      return 0;
+
+    const size_type first_part = contiguous(slot(begin), count);
+    memcpy(values, &storage_->data()[slot(begin)],
+        first_part * sizeof(value_type));
+    memcpy(values + first_part, &storage_->data()[0],
+        (count - first_part) * sizeof(value_type));
+    return count;
+  }
+
+  /** Pops an element from the queue (consumer side).
+   *
+   * @return True if there was an element to pop; false otherwise.
+   */
+  bool pop() {
+    const index_type begin = storage_->begin;
+    if (load(storage_->end) == begin)
+      return false;
+
+    store(storage_->begin, next(begin));
+    return true;
+  }
+
+  /** Pops several elements from the queue (consumer side).
+   *
+   * @param count Number of elements to pop.
+   * @return The number of elements popped, which is lower than count if the
+   *         queue did not have enough elements.
+   */
+  size_type pop(size_type count) {
+    const index_type begin = storage_->begin;
+    const size_type available = distance(begin, load(storage_->end));
+    if (count > available)
+      count = available;
+    if (count == 0)
+      return 0;
+
+    store(storage_->begin, forward(begin, count));
+    return count;
+  }
+
+  /** Checks whether the queue was modified since the last commit.
+   *
+   * @return True if there are uncommitted changes; false otherwise.
+   */
+  bool dirty() const {
+    return dirty_.dirty()
+        || storage_->begin != marked_begin_
+        || load(storage_->end) != marked_end_;
+  }
+
+  /** Makes the queue's modifications persistent (consumer side).
+   *
+   * The elements pushed and the indices moved since the last call are
+   * marked, and the storage backend is committed. Elements pushed while
+   * committing are left for the next commit.
+   *
+   * @return True if the changes were committed, or there was nothing to
+   *         commit; false otherwise.
+   */
+  bool commit() {
+    const index_type begin = storage_->begin;
+    const index_type end = load(storage_->end);
+
+    const size_type pushed = distance(marked_end_, end);
+    if (pushed > 0) {
+      mark_elements(slot(marked_end_), pushed);
+      if (slot(marked_end_) + pushed >= N)
+        dirty_.stats().count_wrap_around();
+    }
+    if (begin != marked_begin_ || end != marked_end_) {
+      dirty_.mark(offset_, sizeof(storage_area));
+      dirty_.stats().count_header_write();
+    }
+
+    marked_begin_ = begin;
+    marked_end_ = end;
+    return dirty_.commit();
+  }
+
+#if defined(PERSISTENT_CONTAINERS_STATS)
+  /** Returns the queue's statistics.
+   *
+   * Only available if PERSISTENT_CONTAINERS_STATS is defined.
+   *
+   * @return A constant reference to the statistics.
+   */
+  const persistent_stats& stats() const {
+    return dirty_.stats();
+  }
+
+  /** Returns the estimated erase cycles of the flash backing the queue.
+   *
+   * This is the number of commits issued to the storage backend since boot,
+   * by any container. Only available if PERSISTENT_CONTAINERS_STATS is
+   * defined.
+   *
+   * @return The estimated erase cycles.
+   */
+  unsigned long estimated_erase_cycles() const {
+    return backend_commits<Backend>();
+  }
+#endif
+
+private:
+  struct storage_area {
+    uint16_t signature;
+    index_type begin;
+    index_type end;
+
+    value_type* data() {
+      uint8_t* ptr_to_data = reinterpret_cast<uint8_t*>(this) + DATA_OFFSET;
+      return reinterpret_cast<value_type*>(ptr_to_data);
+    }
+  };
+
+  // Same layout and signature as static_persistent_queue.
+  static constexpr uint16_t SIGNATURE {
+    persistent_signature16(persistent_kind::static_queue, sizeof(value_type),
+        persistent_schema<value_type>::version)
+  };
+
+  static constexpr size_type DATA_OFFSET {
+    persistent_align(sizeof(storage_area), alignof(value_type))
+  };
+
+  static constexpr size_type POSITIONS { 2 * N };
+  static constexpr bool MASKED { (N & (N - 1)) == 0 };
+
+  const size_type offset_;
+  storage_area* storage_;
+  dirty_range dirty_;
+  index_type marked_begin_;
+  index_type marked_end_;
+
+  /** Reads an index written by the other context. */
+  static index_type load(const index_type& idx) {
+    return __atomic_load_n(&idx, __ATOMIC_ACQUIRE);
+  }
+
+  /** Publishes an index to the other context. */
+  static void store(index_type& idx, index_type value) {
+    __atomic_store_n(&idx, value, __ATOMIC_RELEASE);
+  }
+
+  static size_type slot(index_type idx) {
+    return MASKED ? idx & (N - 1) : idx < N ? idx : idx - N;
+  }
+
+  static index_type next(index_type idx) {
+    return MASKED || idx + 1u != POSITIONS ? idx + 1u : 0;
+  }
+
+  static index_type forward(index_type idx, size_type count) {
+    const size_type result = idx + count;
+    return MASKED || result < POSITIONS ? result : result - POSITIONS;
+  }
+
+  static size_type distance(index_type from, index_type to) {
+    return MASKED
+        ? static_cast<index_type>(to - from)
+        : to >= from ? to - from : to + POSITIONS - from;
+  }
+
+  static size_type contiguous(size_type slot, size_type count) {
+    return count < N - slot ? count : N - slot;
+  }
+
+  void mark_elements(size_type slot, size_type count) {
+    const size_type first_part = contiguous(slot, count);
+    dirty_.mark(
+        offset_ + DATA_OFFSET + slot * sizeof(value_type),
+        first_part * sizeof(value_type));
+    dirty_.mark(
+        offset_ + DATA_OFFSET,
+        (count - first_part) * sizeof(value_type));
+    dirty_.stats().count_element_writes(count);
+  }
+
+  spsc_persistent_queue() = delete;
+
+  spsc_persistent_queue(const spsc_persistent_queue& other) = delete;
+  spsc_persistent_queue& operator=(const spsc_persistent_queue& other) = delete;
+
+  spsc_persistent_queue(spsc_persistent_queue&& other) = delete;
+  spsc_persistent_queue& operator=(spsc_persistent_queue&& other) = delete;
+};
+
+#endif // SPSC_PERSISTENT_QUEUE
@@ -0,0 +1,391 @@
+#ifndef STAGED_PERSISTENT_QUEUE
+#define STAGED_PERSISTENT_QUEUE
+
+#include "dirty_range.h"
+#include "eeprom_backend.h"
+#include "persistent_crc.h"
+#include "persistent_header.h"
+#include "persistent_queue.h"
+#include "persistent_signature.h"
+#include "persistent_traits.h"
+#include "persistent_transaction.h"
+#include "rtc_memory_backend.h"
+
+/** This class implements a persistent_queue with a staging buffer.
+ *
+ * Pushed elements are first appended to a small buffer on a storage that
+ * needs no commit, by default the RTC user memory of the ESP8266, which
+ * survives deep sleep. Once the buffer is full, its elements are moved to
+ * the queue with a single push and a single commit. A node that pushes one
+ * element per wake-up thus erases the flash sector once every N wake-ups
+ * instead of every time.
+ *
+ * The queue's elements come before the staged ones, and all the accessors
+ * see both. Staged elements are lost on a power loss (but not on a deep
+ * sleep or a reset); commit() moves them to the queue before committing it.
+ *
+ * Each batch of staged elements is numbered, and the number of the last
+ * batch moved to the queue is committed along with it, after the queue's
+ * storage. A batch that is still found in the buffer after a reboot, because
+ * power was lost between committing the queue and emptying the buffer, is
+ * thus dropped rather than moved to the queue twice.
+ *
+ * The staged elements are also kept in RAM, so the buffer is only read
+ * when the queue is constructed.
+ *
+ * @tparam T Element type.
+ * @tparam N Number of elements staged before moving them to the queue.
+ * @tparam Backend Queue's storage backend, mapped in RAM (see eeprom_backend).
+ * @tparam Staging Staging buffer's storage backend (see rtc_memory_backend).
+ */
+template<class T, size_t N, class Backend = eeprom_backend,
+    class Staging = rtc_memory_backend>
+class staged_persistent_queue {
+public:
+  typedef T value_type;
+  typedef size_t size_type;
+  typedef Backend backend_type;
+  typedef const value_type& const_reference;
+  typedef persistent_queue<T, Backend> queue_type;
+
+  static_assert(persistent_storable<value_type>::value,
+      "the element type must be trivially copyable");
+  static_assert(N > 0 && N < 0x10000, "the buffer's capacity is out of range");
+
+  /** Constructor.
+   *
+   * @param offset Queue's offset from the storage's base address (a
+   *               multiple of persistent_max_align()).
+   * @param capacity Queue's capacity (in elements), which includes the
+   *                 staged elements.
+   * @param staging_offset Buffer's offset from the staging storage's base
+   *                       address.
+   */
+  staged_persistent_queue(int offset, size_type capacity,
+      int staging_offset = 0)
+    : queue_{offset, capacity}
+    , spill_offset_{static_cast<size_type>(offset) + spill_offset(capacity)}
+    , spill_header_{Backend::data() + spill_offset_, SIGNATURE}
+    , spilled_{&persistent_commit<Backend>}
+    , staging_offset_{static_cast<size_type>(staging_offset)}
+    , unsaved_{false}
+    , unsaved_pushes_{0}
+  {
+    if (!spill_header_.load(spill_fields_))
+      spill_fields_.batch = 0;
+
+    // A batch numbered up to the last one spilled is already in the queue.
+    Staging::read(staging_offset_, &header_, sizeof(header_));
+    if (header_.check != checksum()
+        || header_.begin > header_.end
+        || header_.end > N
+        || queue_.size() + (header_.end - header_.begin) > capacity
+        || static_cast<int32_t>(header_.batch - spill_fields_.batch) <= 0) {
+      header_.batch = spill_fields_.batch + 1;
+      header_.begin = 0;
+      header_.end = 0;
+      write_header();
+    }
+
+    Staging::read(element_offset(0), staged_, header_.end * sizeof(value_type));
+  }
+
+  /**
+   * Computes the necessary storage size to hold the queue of the given
+   * capacity.
+   *
+   * @param capacity Queue's capacity (in elements).
+   */
+  static constexpr size_type storage_size(size_type capacity) {
+    return spill_offset(capacity) + spill_header_type::storage_size();
+  }
+
+  /**
+   * Computes the necessary staging storage size to hold the buffer.
+   */
+  static constexpr size_type staging_size() {
+    return sizeof(staging_header) + N * sizeof(value_type);
+  }
+
+  /** Checks whether the queue is empty.
+   *
+   * @return True if the queue is empty; false otherwise.
+   */
+  bool empty() const {
+    return size() == 0;
+  }
+
+  /** Checks whether the queue is full.
+   *
+   * @return True if the queue is full; false otherwise.
+   */
+  bool full() const {
+    return size() == capacity();
+  }
+
+  /** Returns the queue's size.
+   *
+   * The size includes the staged elements.
+   *
+   * @return The queue's size.
+   */
+  size_type size() const {
+    return queue_.size() + staged();
+  }
+
+  /** Returns the number of elements in the staging buffer.
+   *
+   * @return The number of staged elements.
+   */
+  size_type staged() const {
+    return header_.end - header_.begin;
+  }
+
+  /** Returns the queue's capacity.
+   *
+   * @return The queue's capacity.
+   */
+  size_type capacity() const {
+    return queue_.capacity();
+  }
+
+  /** Returns the element at the queue's front.
+   *
+   * @return The element at the front.
+   */
+  const_reference front() const {
+    return queue_.empty() ? staged_[header_.begin] : queue_.front();
+  }
+
+  /** Pushes an element into the staging buffer.
+   *
+   * If the buffer becomes full, the staged elements are moved to the queue,
+   * which is committed. Should that commit fail, the buffer keeps them, and
+   * the elements pushed until the queue is committed go straight to the
+   * queue's RAM copy. The commit is then retried once every N such pushes
+   * (or on commit()), rather than on every push.
+   *
+   * @param value The element to be pushed.
+   * @return True if the element was insterted; false otherwise.
+   */
+  bool push(const value_type& value) {
+    if (full())
+      return false;
+
+    if (unsaved_) {
+      queue_.push(value);
+      if (++unsaved_pushes_ == N)
+        save();
+      return true;
+    }
+
+    staged_[header_.end] = value;
+    Staging::write(element_offset(header_.end), &value, sizeof(value_type));
+    ++(header_.end);
+    write_header();
+
+    if (header_.end == N)
+      spill();
+    return true;
+  }
+
+  /** Pops an element from the queue.
+   *
+   * Popping an element from the queue (rather than from the staging buffer)
+   * is only persistent once the queue is committed.
+   *
+   * @return True if there was an element to pop; false otherwise.
+   */
+  bool pop() {
+    if (queue_.pop())
+      return true;
+    if (staged() == 0)
+      return false;
+
+    ++(header_.begin);
+    write_header();
+    return true;
+  }
+
+  /** Pops several elements from the queue.
+   *
+   * @param count Number of elements to pop.
+   * @return The number of elements popped, which is lower than count if the
+   *         queue did not have enough elements.
+   */
+  size_type pop(size_type count) {
+    size_type popped = queue_.pop(count);
+    if (popped < count && staged() > 0) {
+      const size_type n =
+          count - popped < staged() ? count - popped : staged();
+      header_.begin += n;
+      write_header();
+      popped += n;
+    }
+    return popped;
+  }
+
+  /** Copies elements from the queue's front without popping them.
+   *
+   * @param values Pointer to the buffer where elements are copied.
+   * @param count Maximum number of elements to copy.
+   * @return The number of elements copied, which is lower than count if the
+   *         queue did not have enough elements.
+   */
+  size_type read(value_type* values, size_type count) const {
+    size_type copied = queue_.read(values, count);
+    const size_type n =
+        count - copied < staged() ? count - copied : staged();
+    memcpy(values + copied, &staged_[header_.begin], n * sizeof(value_type));
+    return copied + n;
+  }
+
+  /** Checks whether there are changes that are not committed to the queue.
+   *
+   * @return True if there are staged elements or the queue has uncommitted
+   *         changes; false otherwise.
+   */
+  bool dirty() const {
+    return staged() > 0 || unsaved_ || queue_.dirty();
+  }
+
+  /** Moves the staged elements to the queue and commits it.
+   *
+   * @return True if the changes were committed, or there was nothing to
+   *         commit; false otherwise.
+   */
+  bool commit() {
+    if (staged() > 0)
+      return spill();
+    return unsaved_ ? save() : queue_.commit();
+  }
+
+#if defined(PERSISTENT_CONTAINERS_STATS)
+  /** Returns the queue's statistics.
+   *
+   * Only available if PERSISTENT_CONTAINERS_STATS is defined. Staged
+   * elements are counted once they are moved to the queue.
+   *
+   * @return A constant reference to the statistics.
+   */
+  const persistent_stats& stats() const {
+    return queue_.stats();
+  }
+
+  /** Returns the estimated erase cycles of the flash backing the queue.
+   *
+   * This is the number of commits issued to the storage backend since boot,
+   * by any container. Only available if PERSISTENT_CONTAINERS_STATS is
+   * defined.
+   *
+   * @return The estimated erase cycles.
+   */
+  unsigned long estimated_erase_cycles() const {
+    return backend_commits<Backend>();
+  }
+#endif
+
+private:
+  // The check covers the batch number and the indices, so a buffer that
+  // was never written (or was overwritten by something else) is detected.
+  struct staging_header {
+    uint32_t check;
+    uint32_t batch;
+    uint16_t begin;
+    uint16_t end;
+  };
+
+  // Number of the last batch moved to the queue, stored after the queue.
+  struct spill_fields {
+    uint32_t batch;
+  };
+
+  typedef persistent_header<spill_fields> spill_header_type;
+
+  static constexpr uint32_t SIGNATURE {
+    persistent_signature(persistent_kind::staged_queue, sizeof(value_type),
+        persistent_schema<value_type>::version)
+  };
+
+  static constexpr size_type spill_offset(size_type capacity) {
+    return persistent_align(queue_type::storage_size(capacity),
+        alignof(uint32_t));
+  }
+
+  queue_type queue_;
+  const size_type spill_offset_;
+  spill_header_type spill_header_;
+  spill_fields spill_fields_;
+  dirty_range spilled_;
+  const size_type staging_offset_;
+  staging_header header_;
+  value_type staged_[N];
+  bool unsaved_;
+  size_type unsaved_pushes_;
+
+  size_type element_offset(size_type idx) const {
+    return staging_offset_ + sizeof(staging_header) + idx * sizeof(value_type);
+  }
+
+  uint32_t checksum() const {
+    return persistent_crc32(&header_.batch, sizeof(header_) - sizeof(uint32_t),
+        SIGNATURE);
+  }
+
+  void write_header() {
+    header_.check = checksum();
+    Staging::write(staging_offset_, &header_, sizeof(header_));
+  }
+
+  /** Moves the staged elements to the queue, and commits it. */
+  bool spill() {
+    queue_.push(&staged_[header_.begin], staged());
+    header_.begin = header_.end;
+    return save();
+  }
+
+  /** Commits the queue, and then empties the staging buffer.
+   *
+   * The batch's number is committed along with the queue. Until then, the
+   * buffer keeps the elements moved to the queue's RAM copy, so they survive
+   * a deep sleep.
+   */
+  bool save() {
+    spill_fields fields { header_.batch };
+    spill_header_.stage(fields);
+    spilled_.mark(spill_offset_ + spill_header_.staged_offset(),
+        spill_header_type::copy_size());
+
+    bool committed;
+    {
+      persistent_transaction transaction;
+      queue_.commit();
+      spilled_.commit();
+      committed = transaction.commit();
+    }
+    if (!committed) {
+      unsaved_ = true;
+      unsaved_pushes_ = 0;
+      return false;
+    }
+
+    spill_header_.committed();
+    spill_fields_ = fields;
+    header_.batch = fields.batch + 1;
+    header_.begin = 0;
+    header_.end = 0;
+    write_header();
+    unsaved_ = false;
+    return true;
+  }
+
+  staged_persistent_queue() = delete;
+
+  staged_persistent_queue(const staged_persistent_queue& other) = delete;
+  staged_persistent_queue& operator=(const staged_persistent_queue& other) = delete;
+
+  staged_persistent_queue(staged_persistent_queue&& other) = delete;
+  staged_persistent_queue& operator=(staged_persistent_queue&& other) = delete;
+};
+
+#endif // STAGED_PERSISTENT_QUEUE
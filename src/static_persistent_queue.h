@@ -0,0 +1,463 @@
+#ifndef STATIC_PERSISTENT_QUEUE
+#define STATIC_PERSISTENT_QUEUE
+
+#include "dirty_range.h"
+#include "eeprom_backend.h"
+#include "persistent_index.h"
+#include "persistent_signature.h"
+#include "persistent_traits.h"
+
+/** This class implements a fixed-size circular queue with a static capacity.
+ *
+ * The queue behaves like persistent_queue, but its capacity is a template
+ * argument. This allows a compact header: the front and back indices use the
+ * narrowest type that fits the capacity, and the size is derived from them
+ * instead of being stored. Indices run over twice the capacity, so that a
+ * full queue can be told apart from an empty one. With a capacity of up to
+ * 128 elements the header takes 4 bytes, and 6 bytes with up to 32768. The
+ * header is padded to the element's alignment.
+ *
+ * When the capacity is a power of two the indices run freely over the whole
+ * range of their type instead, so they wrap around by unsigned overflow and
+ * are turned into slots with a bit mask, without any comparison.
+ *
+ * @tparam T Element type.
+ * @tparam N Queue's capacity (in elements).
+ * @tparam Backend Storage backend mapped in RAM (see eeprom_backend).
+ */
+template<class T, size_t N, class Backend = eeprom_backend>
+class static_persistent_queue {
+public:
+  typedef T value_type;
+  typedef size_t size_type;
+  typedef Backend backend_type;
+  typedef value_type& reference;
+  typedef const value_type& const_reference;
+  typedef typename persistent_index<2 * N - 1>::type index_type;
+
+  static_assert(persistent_storable<value_type>::value,
+      "the element type must be trivially copyable");
+  static_assert(N > 0, "the queue's capacity must be positive");
+  static_assert(persistent_mapped<Backend>::value,
+      "the backend must be mapped in RAM; use a cached container instead");
+
+  /** Contiguous sequence of elements stored in the queue. */
+  struct const_span {
+    const value_type* data;
+    size_type size;
+  };
+
+  /** Constructor.
+   *
+   * @param offset Offset from the storage's base address (a multiple of
+   *               persistent_max_align()).
+   */
+  explicit static_persistent_queue(int offset)
+    : offset_{static_cast<size_type>(offset)}
+    , dirty_{&persistent_commit<Backend>}
+  {
+    uint8_t* data = Backend::data() + offset;
+    storage_ = reinterpret_cast<storage_area*>(data);
+
+    // A torn or corrupted header may keep its signature; indices out of
+    // range would then address past the storage.
+    if (storage_->signature != SIGNATURE
+        || (!MASKED
+            && (storage_->begin >= POSITIONS || storage_->end >= POSITIONS))
+        || size() > N) {
+      storage_->signature = SIGNATURE;
+      storage_->begin = 0;
+      storage_->end = 0;
+      mark_header();
+    }
+  }
+
+  /**
+   * Computes the necessary storage size to hold the queue.
+   */
+  static constexpr size_type storage_size() {
+    return DATA_OFFSET + N * sizeof(value_type);
+  }
+
+  /** Checks whether the queue is empty.
+   *
+   * @return True if the queue is empty; false otherwise.
+   */
+  bool empty() const {
+    return storage_->begin == storage_->end;
+  }
+
+  /** Checks whether the queue is full.
+   *
+   * @return True if the queue is full; false otherwise.
+   */
+  bool full() const {
+    return size() == capacity();
+  }
+
+  /** Returns the queue's size.
+   *
+   * The size correspond to the number of elements currently in the queue.
+   *
+   * @return The queue's size.
+   */
+  size_type size() const {
+    return MASKED
+        ? static_cast<index_type>(storage_->end - storage_->begin)
+        : storage_->end >= storage_->begin
+            ? storage_->end - storage_->begin
+            : storage_->end + POSITIONS - storage_->begin;
+  }
+
+  /** Returns the queue's capacity.
+   *
+   * The capacity correspond to the maximum number of elements that the queue
+   * can store.
+   *
+   * @return The queue's capacity.
+   */
+  static constexpr size_type capacity() {
+    return N;
+  }
+
+  /** Returns the element at the queue's front.
+   *
+   * The element is marked as modified, as it can be written through the
+   * returned reference.
+   *
+   * @return The element at the front.
+   */
+  reference front() {
+    mark_element(slot(storage_->begin));
+    return storage_->data()[slot(storage_->begin)];
+  }
+
+  /** Returns the element at the queue's front.
+   *
+   * @return The element at the front.
+   */
+  const_reference front() const {
+    return storage_->data()[slot(storage_->begin)];
+  }
+
+  /** Returns the elements at the queue's front that are stored contiguously.
+   *
+   * The span covers the queue's elements up to the point where the storage
+   * wraps around; second_span() covers the rest. Once processed, the
+   * elements can be removed with pop(count).
+   *
+   * @return The first span of elements (empty if the queue is empty).
+   */
+  const_span first_span() const {
+    const size_type begin = slot(storage_->begin);
+    return { &storage_->data()[begin], contiguous(begin, size()) };
+  }
+
+  /** Returns the elements that follow first_span().
+   *
+   * @return The second span of elements (empty if the queue's elements do
+   *         not wrap around).
+   */
+  const_span second_span() const {
+    const size_type begin = slot(storage_->begin);
+    return { &storage_->data()[0], size() - contiguous(begin, size()) };
+  }
+
+  /** Pushes an element into the queue.
+   *
+   * The element is pushed at the end of the queue.
+   *
+   * @param value The element to be pushed.
+   * @return True if the element was insterted; false otherwise.
+   */
+  bool push(const value_type& value) {
+    if (full()) {
+      dirty_.stats().count_rejected_push();
+      return false;
+    }
+
+    storage_->data()[slot(storage_->end)] = value;
+    mark_element(slot(storage_->end));
+    increment(storage_->end);
+    mark_header();
+    return true;
+  }
+
+  /** Pushes an element into the queue, overwriting the oldest one if full.
+   *
+   * The element is pushed at the end of the queue. If the queue is full, the
+   * element at the front is dropped to make room for it. Either way, the
+   * queue's header is updated only once.
+   *
+   * @param value The element to be pushed.
+   * @return True if the element at the front was overwritten; false
+   *         otherwise.
+   */
+  bool push_overwrite(const value_type& value) {
+    const bool overwritten = full();
+
+    storage_->data()[slot(storage_->end)] = value;
+    mark_element(slot(storage_->end));
+    increment(storage_->end);
+    if (overwritten)
+      storage_->begin = next(storage_->begin);
+    mark_header();
+    return overwritten;
+  }
+
+  /** Pushes several elements into the queue.
+   *
+   * The elements are pushed at the end of the queue, in order, until the
+   * queue becomes full. The queue's header is updated only once.
+   *
+   * @param first Iterator to the first element to be pushed.
+   * @param last Iterator past the last element to be pushed.
+   * @return The number of elements inserted.
+   */
+  template<class InputIt>
+  size_type push(InputIt first, InputIt last) {
+    const size_type start = slot(storage_->end);
+    const size_type room = capacity() - size();
+    size_type count = 0;
+    for (; first != last && count < room; ++first, ++count) {
+      storage_->data()[slot(storage_->end)] = *first;
+      increment(storage_->end);
+    }
+
+    if (first != last)
+      dirty_.stats().count_rejected_push();
+    if (count == 0)
+      return 0;
+
+    mark_elements(start, count);
+    mark_header();
+    return count;
+  }
+
+  /** Pushes several elements into the queue.
+   *
+   * The elements are pushed at the end of the queue, in order, until the
+   * queue becomes full. Elements are copied with at most two calls to
+   * memcpy, and the queue's header is updated only once.
+   *
+   * @param values Pointer to the first element to be pushed.
+   * @param count Number of elements to be pushed.
+   * @return The number of elements inserted.
+   */
+  size_type push(const value_type* values, size_type count) {
+    if (count > capacity() - size()) {
+      dirty_.stats().count_rejected_push();
+      count = capacity() - size();
+    }
+    if (count == 0)
+      return 0;
+
+    const size_type end = slot(storage_->end);
+    const size_type first_part = contiguous(end, count);
+    memcpy(&storage_->data()[end], values, first_part * sizeof(value_type));
+    memcpy(&storage_->data()[0], values + first_part,
+        (count - first_part) * sizeof(value_type));
+
+    mark_elements(end, count);
+    advance(storage_->end, count);
+    mark_header();
+    return count;
+  }
+
+  /** Pops an element from the queue.
+   *
+   * The element at the front is popped (removed).
+   *
+   * @return True if there was an element to pop; false otherwise.
+   */
+  bool pop() {
+    if (empty())
+      return false;
+
+    increment(storage_->begin);
+    mark_header();
+    return true;
+  }
+
+  /** Pops several elements from the queue.
+   *
+   * The elements at the front are popped (removed). The queue's header is
+   * updated only once.
+   *
+   * @param count Number of elements to pop.
+   * @return The number of elements popped, which is lower than count if the
+   *         queue did not have enough elements.
+   */
+  size_type pop(size_type count) {
+    if (count > size())
+      count = size();
+    if (count == 0)
+      return 0;
+
+    advance(storage_->begin, count);
+    mark_header();
+    return count;
+  }
+
+  /** Copies elements from the queue's front without popping them.
+   *
+   * Elements are copied with at most two calls to memcpy.
+   *
+   * @param values Pointer to the buffer where elements are copied.
+   * @param count Maximum number of elements to copy.
+   * @return The number of elements copied, which is lower than count if the
+   *         queue did not have enough elements.
+   */
+  size_type read(value_type* values, size_type count) const {
+    if (count > size())
+      count = size();
+    if (count == 0)
+      return 0;
+
+    const size_type begin = slot(storage_->begin);
+    const size_type first_part = contiguous(begin, count);
+    memcpy(values, &storage_->data()[begin], first_part * sizeof(value_type));
+    memcpy(values + first_part, &storage_->data()[0],
+        (count - first_part) * sizeof(value_type));
+    return count;
+  }
+
+  /** Checks whether the queue was modified since the last commit.
+   *
+   * @return True if there are uncommitted changes; false otherwise.
+   */
+  bool dirty() const {
+    return dirty_.dirty();
+  }
+
+  /** Makes the queue's modifications persistent.
+   *
+   * The storage backend is only committed if the queue was modified since
+   * the last commit; otherwise, this is a no-op.
+   *
+   * @return True if the changes were committed, or there was nothing to
+   *         commit; false otherwise.
+   */
+  bool commit() {
+    return dirty_.commit();
+  }
+
+#if defined(PERSISTENT_CONTAINERS_STATS)
+  /** Returns the queue's statistics.
+   *
+   * Only available if PERSISTENT_CONTAINERS_STATS is defined.
+   *
+   * @return A constant reference to the statistics.
+   */
+  const persistent_stats& stats() const {
+    return dirty_.stats();
+  }
+
+  /** Returns the estimated erase cycles of the flash backing the queue.
+   *
+   * This is the number of commits issued to the storage backend since boot,
+   * by any container. Only available if PERSISTENT_CONTAINERS_STATS is
+   * defined.
+   *
+   * @return The estimated erase cycles.
+   */
+  unsigned long estimated_erase_cycles() const {
+    return backend_commits<Backend>();
+  }
+#endif
+
+private:
+  struct storage_area {
+    uint16_t signature;
+    index_type begin;
+    index_type end;
+
+    value_type* data() {
+      uint8_t* ptr_to_data = reinterpret_cast<uint8_t*>(this) + DATA_OFFSET;
+      return reinterpret_cast<value_type*>(ptr_to_data);
+    }
+  };
+
+  static constexpr uint16_t SIGNATURE {
+    persistent_signature16(persistent_kind::static_queue, sizeof(value_type),
+        persistent_schema<value_type>::version)
+  };
+
+  // Elements start right after the header, at the next multiple of their
+  // alignment.
+  static constexpr size_type DATA_OFFSET {
+    persistent_align(sizeof(storage_area), alignof(value_type))
+  };
+
+  // Indices run over [0, POSITIONS); the element at index i is stored at
+  // slot i modulo N. With a power-of-two capacity they run over the whole
+  // range of index_type, which is a multiple of N.
+  static constexpr size_type POSITIONS { 2 * N };
+  static constexpr bool MASKED { (N & (N - 1)) == 0 };
+
+  const size_type offset_;
+  storage_area* storage_;
+  dirty_range dirty_;
+
+  static size_type slot(index_type idx) {
+    return MASKED ? idx & (N - 1) : idx < N ? idx : idx - N;
+  }
+
+  static index_type next(index_type idx) {
+    return MASKED || idx + 1u != POSITIONS ? idx + 1u : 0;
+  }
+
+  void increment(index_type& idx) {
+    idx = next(idx);
+    if (slot(idx) == 0)
+      dirty_.stats().count_wrap_around();
+  }
+
+  void advance(index_type& idx, size_type count) {
+    if (slot(idx) + count >= N)
+      dirty_.stats().count_wrap_around();
+
+    const size_type forward = idx + count;
+    idx = MASKED || forward < POSITIONS ? forward : forward - POSITIONS;
+  }
+
+  /** Returns how many of count elements starting at slot fit before the
+   * storage wraps around.
+   */
+  static size_type contiguous(size_type slot, size_type count) {
+    return count < N - slot ? count : N - slot;
+  }
+
+  void mark_header() {
+    dirty_.mark(offset_, sizeof(storage_area));
+    dirty_.stats().count_header_write();
+  }
+
+  void mark_element(size_type slot) {
+    dirty_.mark(
+        offset_ + DATA_OFFSET + slot * sizeof(value_type),
+        sizeof(value_type));
+    dirty_.stats().count_element_writes(1);
+  }
+
+  void mark_elements(size_type slot, size_type count) {
+    const size_type first_part = contiguous(slot, count);
+    dirty_.mark(
+        offset_ + DATA_OFFSET + slot * sizeof(value_type),
+        first_part * sizeof(value_type));
+    dirty_.mark(
+        offset_ + DATA_OFFSET,
+        (count - first_part) * sizeof(value_type));
+    dirty_.stats().count_element_writes(count);
+  }
+
+  static_persistent_queue() = delete;
+
+  static_persistent_queue(const static_persistent_queue& other) = delete;
+  static_persistent_queue& operator=(const static_persistent_queue& other) = delete;
+
+  static_persistent_queue(static_persistent_queue&& other) = delete;
+  static_persistent_queue& operator=(static_persistent_queue&& other) = delete;
+};
+
+#endif // STATIC_PERSISTENT_QUEUE
@@ -0,0 +1,452 @@
+#ifndef STATIC_PERSISTENT_VECTOR
+#define STATIC_PERSISTENT_VECTOR
+
+#include "dirty_range.h"
+#include "eeprom_backend.h"
+#include "persistent_index.h"
+#include "persistent_signature.h"
+#include "persistent_traits.h"
+
+/** This class implements a fixed-size vector with a static capacity.
+ *
+ * The vector behaves like persistent_vector, but its capacity is a template
+ * argument, so capacity checks fold to constants. Its header only holds a
+ * 16-bit signature and the size, using the narrowest type that fits the
+ * capacity, padded to the element's alignment.
+ *
+ * @tparam T Element type.
+ * @tparam N Vector's capacity (in elements).
+ * @tparam Backend Storage backend mapped in RAM (see eeprom_backend).
+ */
+template<class T, size_t N, class Backend = eeprom_backend>
+class static_persistent_vector {
+public:
+  typedef T value_type;
+  typedef size_t size_type;
+  typedef Backend backend_type;
+  typedef value_type& reference;
+  typedef const value_type& const_reference;
+  typedef value_type* iterator;
+  typedef const value_type* const_iterator;
+  typedef typename persistent_index<N>::type index_type;
+
+  static_assert(persistent_storable<value_type>::value,
+      "the element type must be trivially copyable");
+  static_assert(N > 0, "the vector's capacity must be positive");
+  static_assert(persistent_mapped<Backend>::value,
+      "the backend must be mapped in RAM; use a cached container instead");
+
+  /** Constructor.
+   *
+   * @param offset Offset from the storage's base address (a multiple of
+   *               persistent_max_align()).
+   */
+  explicit static_persistent_vector(int offset)
+    : offset_{static_cast<size_type>(offset)}
+    , dirty_{&persistent_commit<Backend>}
+  {
+    uint8_t* data = Backend::data() + offset;
+    storage_ = reinterpret_cast<storage_area*>(data);
+
+    // A torn or corrupted header may keep its signature; a size over the
+    // capacity would then address past the storage.
+    if (storage_->signature != SIGNATURE || storage_->size > N) {
+      storage_->signature = SIGNATURE;
+      storage_->size = 0;
+      mark_header();
+    }
+  }
+
+  /**
+   * Computes the necessary storage size to hold the vector.
+   */
+  static constexpr size_type storage_size() {
+    return DATA_OFFSET + N * sizeof(value_type);
+  }
+
+  /** Checks whether the vector is empty.
+   *
+   * @return True if the vector is empty; false otherwise.
+   */
+  bool empty() const {
+    return size() == 0;
+  }
+
+  /** Checks whether the vector is full.
+   *
+   * @return True if the vector is full; false otherwise.
+   */
+  bool full() const {
+    return size() == capacity();
+  }
+
+  /** Returns the vector's size.
+   *
+   * The size correspond to the number of elements currently in the vector.
+   *
+   * @return The vector's size.
+   */
+  size_type size() const {
+    return storage_->size;
+  }
+
+  /** Returns the vector's capacity.
+   *
+   * The capacity correspond to the maximum number of elements that the vector
+   * can store.
+   *
+   * @return The vector's capacity.
+   */
+  static constexpr size_type capacity() {
+    return N;
+  }
+
+  /** Returns an element given its position in the vector.
+   *
+   * The element is marked as modified, as it can be written through the
+   * returned reference.
+   *
+   * @param pos The position or index of the element to retrieve.
+   * @return A reference to the element.
+   */
+  reference operator[](size_type pos) {
+    mark_element(pos);
+    return storage_->data()[pos];
+  }
+
+  /** Returns an element given its position in the vector.
+   *
+   * @param pos The position or index of the element to retrieve.
+   * @return A constant reference to the element.
+   */
+  const_reference operator[](size_type pos) const {
+    return storage_->data()[pos];
+  }
+
+  /** Returns a pointer to the vector's elements.
+   *
+   * The vector's elements are marked as modified, as they can be written
+   * through the returned pointer.
+   *
+   * @return A pointer to the first element.
+   */
+  value_type* data() {
+    mark_elements(0, size());
+    return storage_->data();
+  }
+
+  /** Returns a pointer to the vector's elements.
+   *
+   * @return A constant pointer to the first element.
+   */
+  const value_type* data() const {
+    return storage_->data();
+  }
+
+  /** Returns an iterator to the vector's first element.
+   *
+   * The vector's elements are marked as modified, as they can be written
+   * through the returned iterator.
+   *
+   * @return An iterator to the first element.
+   */
+  iterator begin() {
+    return data();
+  }
+
+  /** Returns an iterator to the vector's first element.
+   *
+   * @return A constant iterator to the first element.
+   */
+  const_iterator begin() const {
+    return data();
+  }
+
+  /** Returns an iterator past the vector's last element.
+   *
+   * @return An iterator past the last element.
+   */
+  iterator end() {
+    return storage_->data() + size();
+  }
+
+  /** Returns an iterator past the vector's last element.
+   *
+   * @return A constant iterator past the last element.
+   */
+  const_iterator end() const {
+    return data() + size();
+  }
+
+  /** Pushes an element into the vector.
+   *
+   * The element is pushed at the end of the vector.
+   *
+   * @param value The element to be pushed.
+   * @return True if the element was insterted; false otherwise.
+   */
+  bool push_back(const value_type& value) {
+    if (full()) {
+      dirty_.stats().count_rejected_push();
+      return false;
+    }
+
+    storage_->data()[storage_->size] = value;
+    mark_element(storage_->size);
+    ++(storage_->size);
+    mark_header();
+    return true;
+  }
+
+  /** Pushes an element into the vector.
+   *
+   * The element is pushed at the end of the vector.
+   *
+   * @param value The element to be pushed.
+   * @return True if the element was insterted; false otherwise.
+   */
+  bool push_back(value_type&& value) {
+    if (full()) {
+      dirty_.stats().count_rejected_push();
+      return false;
+    }
+
+    storage_->data()[storage_->size] = std::move(value);
+    mark_element(storage_->size);
+    ++(storage_->size);
+    mark_header();
+    return true;
+  }
+
+  /** Pops an element from the vector.
+   *
+   * The element at the end is popped (removed).
+   *
+   * @return True if there was an element to pop; false otherwise.
+   */
+  bool pop_back() {
+    if (empty())
+      return false;
+
+    --(storage_->size);
+    mark_header();
+    return true;
+  }
+
+  /** Removes all the elements from the vector. */
+  void clear() {
+    if (empty())
+      return;
+
+    storage_->size = 0;
+    mark_header();
+  }
+
+  /** Replaces the vector's elements.
+   *
+   * Elements are copied until the vector becomes full. The vector's header
+   * is updated only once.
+   *
+   * @param first Iterator to the first element to be copied.
+   * @param last Iterator past the last element to be copied.
+   * @return The number of elements copied.
+   */
+  template<class InputIt>
+  size_type assign(InputIt first, InputIt last) {
+    storage_->size = 0;
+    return append(first, last);
+  }
+
+  /** Replaces the vector's elements.
+   *
+   * Elements are copied, with a single call to memcpy, until the vector
+   * becomes full. The vector's header is updated only once.
+   *
+   * @param values Pointer to the first element to be copied.
+   * @param count Number of elements to be copied.
+   * @return The number of elements copied.
+   */
+  size_type assign(const value_type* values, size_type count) {
+    storage_->size = 0;
+    return append(values, count);
+  }
+
+  /** Appends elements at the end of the vector.
+   *
+   * Elements are appended until the vector becomes full. The vector's header
+   * is updated only once.
+   *
+   * @param first Iterator to the first element to be appended.
+   * @param last Iterator past the last element to be appended.
+   * @return The number of elements appended.
+   */
+  template<class InputIt>
+  size_type append(InputIt first, InputIt last) {
+    size_type count = 0;
+    for (; first != last && size() + count < capacity(); ++first, ++count)
+      storage_->data()[size() + count] = *first;
+
+    if (first != last)
+      dirty_.stats().count_rejected_push();
+
+    mark_elements(size(), count);
+    storage_->size += count;
+    mark_header();
+    return count;
+  }
+
+  /** Appends elements at the end of the vector.
+   *
+   * Elements are appended, with a single call to memcpy, until the vector
+   * becomes full. The vector's header is updated only once.
+   *
+   * @param values Pointer to the first element to be appended.
+   * @param count Number of elements to be appended.
+   * @return The number of elements appended.
+   */
+  size_type append(const value_type* values, size_type count) {
+    if (count > capacity() - size()) {
+      dirty_.stats().count_rejected_push();
+      count = capacity() - size();
+    }
+
+    memcpy(storage_->data() + size(), values, count * sizeof(value_type));
+    mark_elements(size(), count);
+    storage_->size += count;
+    mark_header();
+    return count;
+  }
+
+  /** Removes an element from the vector.
+   *
+   * The elements after the removed one are moved with a single call to
+   * memmove.
+   *
+   * @param pos Iterator to the element to remove.
+   * @return An iterator to the element that followed the removed one.
+   */
+  iterator erase(const_iterator pos) {
+    return erase(pos, pos + 1);
+  }
+
+  /** Removes a range of elements from the vector.
+   *
+   * The elements after the removed ones are moved with a single call to
+   * memmove.
+   *
+   * @param first Iterator to the first element to remove.
+   * @param last Iterator past the last element to remove.
+   * @return An iterator to the element that followed the removed ones.
+   */
+  iterator erase(const_iterator first, const_iterator last) {
+    const size_type pos = first - storage_->data();
+    const size_type count = last - first;
+    if (count == 0)
+      return storage_->data() + pos;
+
+    const size_type moved = size() - pos - count;
+    memmove(storage_->data() + pos, last, moved * sizeof(value_type));
+    mark_elements(pos, moved);
+    storage_->size -= count;
+    mark_header();
+    return storage_->data() + pos;
+  }
+
+  /** Checks whether the vector was modified since the last commit.
+   *
+   * @return True if there are uncommitted changes; false otherwise.
+   */
+  bool dirty() const {
+    return dirty_.dirty();
+  }
+
+  /** Makes the vector's modifications persistent.
+   *
+   * The storage backend is only committed if the vector was modified since
+   * the last commit; otherwise, this is a no-op.
+   *
+   * @return True if the changes were committed, or there was nothing to
+   *         commit; false otherwise.
+   */
+  bool commit() {
+    return dirty_.commit();
+  }
+
+#if defined(PERSISTENT_CONTAINERS_STATS)
+  /** Returns the vector's statistics.
+   *
+   * Only available if PERSISTENT_CONTAINERS_STATS is defined.
+   *
+   * @return A constant reference to the statistics.
+   */
+  const persistent_stats& stats() const {
+    return dirty_.stats();
+  }
+
+  /** Returns the estimated erase cycles of the flash backing the vector.
+   *
+   * This is the number of commits issued to the storage backend since boot,
+   * by any container. Only available if PERSISTENT_CONTAINERS_STATS is
+   * defined.
+   *
+   * @return The estimated erase cycles.
+   */
+  unsigned long estimated_erase_cycles() const {
+    return backend_commits<Backend>();
+  }
+#endif
+
+private:
+  struct storage_area {
+    uint16_t signature;
+    index_type size;
+
+    value_type* data() {
+      uint8_t* ptr_to_data = reinterpret_cast<uint8_t*>(this) + DATA_OFFSET;
+      return reinterpret_cast<value_type*>(ptr_to_data);
+    }
+  };
+
+  static constexpr uint16_t SIGNATURE {
+    persistent_signature16(persistent_kind::static_vector,
+        sizeof(value_type), persistent_schema<value_type>::version)
+  };
+
+  // Elements start right after the header, at the next multiple of their
+  // alignment.
+  static constexpr size_type DATA_OFFSET {
+    persistent_align(sizeof(storage_area), alignof(value_type))
+  };
+
+  const size_type offset_;
+  storage_area* storage_;
+  dirty_range dirty_;
+
+  void mark_header() {
+    dirty_.mark(offset_, sizeof(storage_area));
+    dirty_.stats().count_header_write();
+  }
+
+  void mark_element(size_type pos) {
+    dirty_.mark(offset_ + DATA_OFFSET + pos * sizeof(value_type),
+        sizeof(value_type));
+    dirty_.stats().count_element_writes(1);
+  }
+
+  void mark_elements(size_type pos, size_type count) {
+    dirty_.mark(offset_ + DATA_OFFSET + pos * sizeof(value_type),
+        count * sizeof(value_type));
+    dirty_.stats().count_element_writes(count);
+  }
+
+  static_persistent_vector() = delete;
+
+  static_persistent_vector(const static_persistent_vector& other) = delete;
+  static_persistent_vector& operator=(const static_persistent_vector& other) = delete;
+
+  static_persistent_vector(static_persistent_vector&& other) = delete;
+  static_persistent_vector& operator=(static_persistent_vector&& other) = delete;
+};
+
+#endif // STATIC_PERSISTENT_VECTOR
+